@@ -0,0 +1,280 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Camera quality and frame rate following the multicast receivers' RTCP
+// receiver reports
+// Implementation
+
+#include "AdaptiveQualityController.hh"
+
+#include <string.h>
+#include <sys/time.h>
+
+#include <string>
+
+#define ADAPT_MIN_INTERVAL 1000000  // microseconds between evaluations
+#define ADAPT_HOLD_OFF 6000000      // microseconds after a change: more than
+                                    // the 5 s minimum RTCP interval, so
+                                    // that reports cover the new settings
+#define ADAPT_CLEAN_REPORTS 3       // clean evaluations before recovering
+#define ADAPT_QUALITY_STEP_DOWN 10
+#define ADAPT_QUALITY_STEP_UP 5
+#define ADAPT_MIN_QUALITY 30
+#define ADAPT_MIN_FPS 5
+
+AdaptiveQualityController*
+AdaptiveQualityController::createNew(UsageEnvironment& env, RTCPInstance* rtcp,
+                                     RTPSink* sink,
+                                     WebcamJPEGDeviceSource* source,
+                                     unsigned targetLossPercent,
+                                     char const* auditFileName)
+{
+    if(targetLossPercent == 0 || targetLossPercent > 50) {
+        env.setResultMsg("The target loss must be 1..50 percent");
+        return NULL;
+    }
+    FILE* auditFile = NULL;
+    if(auditFileName != NULL) {
+        auditFile = fopen(auditFileName, "a");
+        if(auditFile == NULL) {
+            env.setResultErrMsg("Failed to open the audit file: ");
+            return NULL;
+        }
+        setvbuf(auditFile, NULL, _IOLBF, 0);
+    }
+    return new AdaptiveQualityController(env, rtcp, sink, source,
+                                         targetLossPercent, auditFile);
+}
+
+AdaptiveQualityController
+::AdaptiveQualityController(UsageEnvironment& env, RTCPInstance* rtcp,
+                            RTPSink* sink, WebcamJPEGDeviceSource* source,
+                            unsigned targetLossPercent, FILE* auditFile)
+  : Medium(env), fRTCP(rtcp), fSink(sink), fSource(source),
+    fTargetLoss(targetLossPercent*256/100), fAuditFile(auditFile),
+    fInitialQuality(source->quality()),
+    fInitialTimePerFrame(source->timePerFrame()), fCleanReports(0),
+    fLastLoss(0), fLastAction("none"), fNumChanges(0), fPendingAction(NULL),
+    fPendingReceivers(0), fPendingJitterMs(0)
+{
+    fHoldUntil.tv_sec = fHoldUntil.tv_usec = 0;
+    fLastChange.tv_sec = fLastChange.tv_usec = 0;
+    if(fInitialQuality < 0)
+        env << "The camera has no JPEG quality control; adapting the frame rate only\n";
+    fRTCP->setRRHandler(rrHandler, this);
+}
+
+AdaptiveQualityController::~AdaptiveQualityController()
+{
+    fRTCP->setRRHandler(NULL, NULL);
+    fSource->forgetReconfigureHandler(this);
+    if(fAuditFile != NULL)
+        fclose(fAuditFile);
+}
+
+void AdaptiveQualityController::rrHandler(void* clientData)
+{
+    ((AdaptiveQualityController*)clientData)->evaluate();
+}
+
+static void addMicroseconds(struct timeval& tv, unsigned us)
+{
+    tv.tv_usec += us;
+    tv.tv_sec += tv.tv_usec/1000000;
+    tv.tv_usec %= 1000000;
+}
+
+void AdaptiveQualityController::evaluate()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if(fPendingAction != NULL || timercmp(&now, &fHoldUntil, <))
+        return;
+
+    // the worst receiver decides: a multicast stream can't do better for
+    // one receiver than for another.  A receiver whose latest report
+    // predates the last change still describes the old settings.
+    unsigned receivers = 0, loss = 0, jitter = 0;
+    RTPTransmissionStatsDB::Iterator iter(fSink->transmissionStatsDB());
+    RTPTransmissionStats* stats;
+    while((stats = iter.next()) != NULL) {
+        if(timercmp(&stats->lastTimeReceived(), &fLastChange, <))
+            continue;
+        receivers++;
+        if(stats->packetLossRatio() > loss)
+            loss = stats->packetLossRatio();
+        if(stats->jitter() > jitter)
+            jitter = stats->jitter();
+    }
+    if(receivers == 0)
+        return;
+    fLastLoss = loss;
+    unsigned jitterMs = jitter/90; // 90 kHz RTP clock
+
+    int quality = fSource->quality();
+    char const* action;
+    if(loss > fTargetLoss || jitterMs*1000 > fSource->timePerFrame()) {
+        fCleanReports = 0;
+        action = degrade(quality);
+    } else if(loss > fTargetLoss/4) {
+        // acceptable, but not clean: the clean evaluations must be in a row
+        fCleanReports = 0;
+        action = "steady";
+    } else if(++fCleanReports >= ADAPT_CLEAN_REPORTS) {
+        fCleanReports = 0;
+        action = recover(quality);
+    } else {
+        action = "steady";
+    }
+
+    bool changed = strcmp(action, "quality-down") == 0 || strcmp(action, "fps-down") == 0
+        || strcmp(action, "quality-up") == 0 || strcmp(action, "fps-up") == 0;
+    fLastAction = action;
+    if(changed && fPendingAction != NULL) {
+        fLastAction = "pending";
+        // decided, but not done yet: see reconfigureDone()
+        fPendingReceivers = receivers;
+        fPendingJitterMs = jitterMs;
+        envir() << "Adaptive quality: " << loss*100/256 << "% loss, "
+                << jitterMs << " ms jitter over " << receivers
+                << " receiver(s): " << action << " pending\n";
+        audit(receivers, jitterMs, (std::string(action) + "-pending").c_str(), quality);
+        return;
+    }
+    if(changed) {
+        applied(now, action, receivers, jitterMs);
+        return;
+    }
+    fHoldUntil = now;
+    addMicroseconds(fHoldUntil, ADAPT_MIN_INTERVAL);
+    audit(receivers, jitterMs, action, quality);
+}
+
+// Records a change that has taken effect
+void AdaptiveQualityController::applied(struct timeval const& now,
+                                        char const* action, unsigned receivers,
+                                        unsigned jitterMs)
+{
+    fHoldUntil = now;
+    addMicroseconds(fHoldUntil, ADAPT_HOLD_OFF);
+    fLastChange = now;
+    fNumChanges++;
+    int quality = fSource->quality();
+    envir() << "Adaptive quality: " << fLastLoss*100/256 << "% loss, "
+            << jitterMs << " ms jitter over " << receivers
+            << " receiver(s): " << action << " to quality " << quality
+            << ", " << 1000000/fSource->timePerFrame() << " fps\n";
+    audit(receivers, jitterMs, action, quality);
+}
+
+// Asks the source for the new settings (0 keeps the frame interval, -1
+// the quality).  Returns -1 if it refuses them; a change the source has
+// to defer leaves "action" in fPendingAction.
+int AdaptiveQualityController::request(unsigned timePerFrame, int quality,
+                                       char const* action)
+{
+    int result = fSource->reconfigure(0, 0, timePerFrame, quality,
+                                      reconfigureDone, this);
+    if(result < 0) {
+        envir() << "Adaptive quality: " << envir().getResultMsg() << "\n";
+        return -1;
+    }
+    if(result > 0)
+        fPendingAction = action;
+    return 0;
+}
+
+void AdaptiveQualityController::reconfigureDone(void* clientData, int result)
+{
+    AdaptiveQualityController* controller = (AdaptiveQualityController*)clientData;
+    char const* action = controller->fPendingAction;
+    controller->fPendingAction = NULL;
+    if(action == NULL)
+        return;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if(result == 0) {
+        controller->applied(now, action, controller->fPendingReceivers,
+                            controller->fPendingJitterMs);
+        return;
+    }
+    controller->envir() << "Adaptive quality: " << action << " failed: "
+                        << controller->fSource->lastReconfigureError() << "\n";
+    controller->fLastAction = "failed";
+    controller->fHoldUntil = now;
+    addMicroseconds(controller->fHoldUntil, ADAPT_MIN_INTERVAL);
+    controller->audit(controller->fPendingReceivers, controller->fPendingJitterMs,
+                      (std::string(action) + "-failed").c_str(),
+                      controller->fSource->quality());
+}
+
+// Lowers the quality, or the frame rate once the quality is at its floor
+// (or can't be set)
+char const* AdaptiveQualityController::degrade(int quality)
+{
+    if(quality > ADAPT_MIN_QUALITY) {
+        int q = quality - ADAPT_QUALITY_STEP_DOWN;
+        if(q < ADAPT_MIN_QUALITY)
+            q = ADAPT_MIN_QUALITY;
+        if(request(0, q, "quality-down") == 0)
+            return "quality-down";
+    }
+    unsigned timePerFrame = fSource->timePerFrame();
+    if(1000000/timePerFrame > ADAPT_MIN_FPS) {
+        unsigned slower = timePerFrame*3/2;
+        if(slower > 1000000/ADAPT_MIN_FPS)
+            slower = 1000000/ADAPT_MIN_FPS;
+        if(request(slower, -1, "fps-down") == 0)
+            return "fps-down";
+    }
+    return "at-minimum";
+}
+
+// Undoes the steps of degrade(), frame rate first, up to the initial
+// settings
+char const* AdaptiveQualityController::recover(int quality)
+{
+    unsigned timePerFrame = fSource->timePerFrame();
+    if(timePerFrame > fInitialTimePerFrame) {
+        unsigned faster = timePerFrame*2/3;
+        if(faster < fInitialTimePerFrame)
+            faster = fInitialTimePerFrame;
+        if(request(faster, -1, "fps-up") == 0)
+            return "fps-up";
+        return "steady";
+    }
+    if(quality >= 0 && quality < fInitialQuality) {
+        int q = quality + ADAPT_QUALITY_STEP_UP;
+        if(q > fInitialQuality)
+            q = fInitialQuality;
+        if(request(0, q, "quality-up") == 0)
+            return "quality-up";
+    }
+    return "steady";
+}
+
+void AdaptiveQualityController::audit(unsigned receivers, unsigned jitterMs,
+                                      char const* action, int quality)
+{
+    if(fAuditFile == NULL)
+        return;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    fprintf(fAuditFile, "%ld.%03ld,%u,%.1f,%u,%s,%d,%u\n",
+            (long)now.tv_sec, (long)now.tv_usec/1000, receivers,
+            fLastLoss*100.0/256, jitterMs, action, quality,
+            1000000/fSource->timePerFrame());
+}
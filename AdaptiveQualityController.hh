@@ -0,0 +1,92 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Camera quality and frame rate following the multicast receivers' RTCP
+// receiver reports
+// C++ header
+
+#ifndef _ADAPTIVE_QUALITY_CONTROLLER_HH
+#define _ADAPTIVE_QUALITY_CONTROLLER_HH
+
+#include "Media.hh"
+#include "RTCP.hh"
+#include "WebcamJPEGDeviceSource.hh"
+
+#include <stdio.h>
+
+// Keeps the worst receiver's packet loss under a target.  On too much loss
+// (or jitter beyond a frame interval) it first lowers the camera's JPEG
+// quality, where the driver has that control, then the frame rate; after
+// a run of clean reports in a row it undoes the steps in reverse order, up
+// to the settings it started with.  Reports older than the last change are
+// ignored.  Every decision is logged and, optionally, appended to a CSV
+// audit file; one the camera can only apply after the frame in flight is
+// logged as "<action>-pending", then as "<action>" or "<action>-failed"
+// once applied, and only then counts as a change:
+//   time,receivers,loss_percent,jitter_ms,action,quality,fps
+class AdaptiveQualityController: public Medium {
+public:
+    static AdaptiveQualityController* createNew(UsageEnvironment& env,
+                                                RTCPInstance* rtcp,
+                                                RTPSink* sink,
+                                                WebcamJPEGDeviceSource* source,
+                                                unsigned targetLossPercent,
+                                                char const* auditFileName = NULL);
+
+    char const* lastAction() const { return fLastAction; }
+    unsigned lastLossPercent() const { return fLastLoss*100/256; }
+    unsigned long numChanges() const { return fNumChanges; }
+
+protected:
+    AdaptiveQualityController(UsageEnvironment& env, RTCPInstance* rtcp,
+                              RTPSink* sink, WebcamJPEGDeviceSource* source,
+                              unsigned targetLossPercent, FILE* auditFile);
+    // called only by createNew()
+    virtual ~AdaptiveQualityController();
+
+private:
+    static void rrHandler(void* clientData);
+    void evaluate();
+    char const* degrade(int quality);
+    char const* recover(int quality);
+    int request(unsigned timePerFrame, int quality, char const* action);
+    void applied(struct timeval const& now, char const* action,
+                 unsigned receivers, unsigned jitterMs);
+    static void reconfigureDone(void* clientData, int result);
+    void audit(unsigned receivers, unsigned jitterMs, char const* action,
+               int quality);
+
+private:
+    RTCPInstance* fRTCP;
+    RTPSink* fSink;
+    WebcamJPEGDeviceSource* fSource;
+    unsigned fTargetLoss;       // fraction lost, x/256
+    FILE* fAuditFile;
+    int fInitialQuality;        // -1: no quality control
+    unsigned fInitialTimePerFrame;
+    struct timeval fHoldUntil;  // no evaluation until then
+    struct timeval fLastChange; // reports received before it are ignored
+    unsigned fCleanReports;
+    unsigned fLastLoss;
+    char const* fLastAction;
+    unsigned long fNumChanges;
+    // a change the source applies once the frame on the pool is through
+    char const* fPendingAction;
+    unsigned fPendingReceivers;
+    unsigned fPendingJitterMs;
+};
+
+#endif // _ADAPTIVE_QUALITY_CONTROLLER_HH
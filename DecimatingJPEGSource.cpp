@@ -0,0 +1,257 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// One unicast client's view of the webcam: every 2^k-th frame, with k
+// raised while the client's link shows backpressure
+// Implementation
+//
+// Dropping packets at random ruins every frame they belong to; dropping
+// whole frames only lowers the frame rate.  Each client has its own
+// source, so a slow client does not slow down the others.  Backpressure
+// shows up as a filling socket send queue (the link can't take the rate)
+// or, in the client's RTCP receiver reports, as loss or as jitter beyond
+// half a frame interval (a frame takes too long to get through).  Each
+// sign doubles the skip; a run of clean checks halves it again.
+
+#include "DecimatingJPEGSource.hh"
+#include "WebcamServerMediaSubsession.hh"
+
+#include <linux/sockios.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+DecimatingJPEGSource*
+DecimatingJPEGSource::createNew(UsageEnvironment& env,
+                                WebcamJPEGDeviceSource* input,
+                                unsigned clientSessionId,
+                                WebcamServerMediaSubsession* subsession)
+{
+    return new DecimatingJPEGSource(env, input, clientSessionId, subsession);
+}
+
+DecimatingJPEGSource
+::DecimatingJPEGSource(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+                       unsigned clientSessionId,
+                       WebcamServerMediaSubsession* subsession)
+  : JPEGVideoSource(env), fInput(input), fClientSessionId(clientSessionId),
+    fSubsession(subsession), fSink(NULL), fCheckTask(NULL), fLevel(0), fCleanChecks(0),
+    fReportsSeen(false), fLastReportPacketNum(0), fFrameCount(0),
+    fSkippedFrames(0), fType(0), fQFactor(0), fWidth(0), fHeight(0),
+    fPrecision(0), fRestartInterval(0), fQTablesLength(0)
+{
+    fInput->addFrameConsumer(this);
+}
+
+DecimatingJPEGSource::~DecimatingJPEGSource()
+{
+    envir().taskScheduler().unscheduleDelayedTask(fCheckTask);
+    fInput->removeFrameConsumer(this);
+    if(fSubsession != NULL)
+        fSubsession->cancelTranscode(this);
+}
+
+void DecimatingJPEGSource::setRTPSink(RTPSink* sink)
+{
+    fSink = sink;
+}
+
+void DecimatingJPEGSource::doGetNextFrame()
+{
+    // The next captured frame that is due for this client gets delivered
+    // by consumeJpegFrame(); meanwhile, keep an eye on the link.
+    if(fCheckTask == NULL)
+        fCheckTask = envir().taskScheduler().scheduleDelayedTask(DECIMATION_CHECK_INTERVAL,
+                        (TaskFunc*)checkBackpressure, this);
+}
+
+void DecimatingJPEGSource::doStopGettingFrames()
+{
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+    envir().taskScheduler().unscheduleDelayedTask(fCheckTask);
+}
+
+void DecimatingJPEGSource::consumeJpegFrame(JpegFrameParser& parser,
+                                            struct timeval presentationTime)
+{
+    unsigned long frame = fFrameCount++;
+    if((frame & ((1UL << fLevel) - 1)) != 0 || !isCurrentlyAwaitingData()) {
+        // not due, or the sink is still busy with the previous frame
+        fSkippedFrames++;
+        return;
+    }
+
+    if(fSubsession == NULL)
+        deliverFrame(parser, presentationTime, 1, NULL, 0);
+    else if(fSubsession->transcode(this, parser, presentationTime) < 0)
+        fSkippedFrames++;
+}
+
+// Called by consumeJpegFrame(), or later by the subsession once the worker
+// pool has transcoded the frame; either way on the event loop
+void DecimatingJPEGSource::deliverFrame(JpegFrameParser& parser,
+                                        struct timeval presentationTime,
+                                        int transcoded,
+                                        unsigned char const* scan,
+                                        unsigned scanLength)
+{
+    if(transcoded < 0 || !isCurrentlyAwaitingData()) {
+        fSkippedFrames++;
+        return;
+    }
+
+    // the parser's fields only last until the next frame
+    if(transcoded == 0) {
+        JpegTranscoder const& transcoder = fSubsession->transcoder();
+        fType = transcoder.type();
+        fWidth = transcoder.width();
+        fHeight = transcoder.height();
+        fRestartInterval = transcoder.restartInterval();
+        // new tables with every frame: send them in-band (RFC 2435 Q 255)
+        fQFactor = 255;
+        fPrecision = 0;
+        fQTablesLength = 128;
+        memcpy(fQTables, transcoder.quantizationTables(), fQTablesLength);
+    } else {
+        scan = parser.scandata(scanLength);
+        fType = parser.type();
+        fWidth = parser.width();
+        fHeight = parser.height();
+        fRestartInterval = parser.restartInterval();
+        fQFactor = parser.qFactor();
+        fPrecision = parser.precision();
+        unsigned short length;
+        unsigned char const* tables = parser.quantizationTables(length);
+        fQTablesLength = length < sizeof(fQTables) ? length : sizeof(fQTables);
+        memcpy(fQTables, tables, fQTablesLength);
+    }
+
+    if(scanLength > fMaxSize) {
+        fNumTruncatedBytes = scanLength - fMaxSize;
+        scanLength = fMaxSize;
+    }
+    memcpy(fTo, scan, scanLength);
+    fFrameSize = scanLength;
+    fPresentationTime = presentationTime;
+
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                    (TaskFunc*)FramedSource::afterGetting, this);
+}
+
+void DecimatingJPEGSource::checkBackpressure(void* clientData)
+{
+    ((DecimatingJPEGSource*)clientData)->checkBackpressure();
+}
+
+void DecimatingJPEGSource::checkBackpressure()
+{
+    fCheckTask = envir().taskScheduler().scheduleDelayedTask(DECIMATION_CHECK_INTERVAL,
+                    (TaskFunc*)checkBackpressure, this);
+    if(fSink == NULL)
+        return;
+
+    char const* reason = NULL;
+    if(sendQueueFill() >= DECIMATION_SENDQ_HIGH)
+        reason = "send queue filling up";
+
+    // one receiver per unicast client; only a new report counts
+    bool newReport = false;
+    unsigned jitterLimit = fInput->timePerFrame()*90/1000/2; // 90 kHz units
+    RTPTransmissionStatsDB::Iterator iter(fSink->transmissionStatsDB());
+    RTPTransmissionStats* stats;
+    while((stats = iter.next()) != NULL) {
+        if(fReportsSeen && stats->lastPacketNumReceived() == fLastReportPacketNum)
+            continue;
+        fReportsSeen = newReport = true;
+        fLastReportPacketNum = stats->lastPacketNumReceived();
+        if(reason == NULL && stats->packetLossRatio() >= DECIMATION_LOSS_HIGH)
+            reason = "packet loss";
+        else if(reason == NULL && stats->jitter() > jitterLimit)
+            reason = "jitter";
+    }
+
+    if(reason != NULL) {
+        fCleanChecks = 0;
+        if(fLevel < MAX_DECIMATION_LEVEL)
+            setLevel(fLevel + 1, reason);
+    } else if(fLevel > 0) {
+        // once the client sends receiver reports, wait for clean ones
+        if(!fReportsSeen || newReport)
+            fCleanChecks++;
+        if(fCleanChecks >= (fReportsSeen ? DECIMATION_CLEAN_REPORTS : DECIMATION_CLEAN_CHECKS)) {
+            fCleanChecks = 0;
+            setLevel(fLevel - 1, "link recovered");
+        }
+    }
+}
+
+// Percentage of the RTP socket's send buffer that is still queued; -1 if
+// unknown.  (Over RTP-over-RTSP the socket is idle and this stays 0.)
+int DecimatingJPEGSource::sendQueueFill()
+{
+    int fd = fSink->groupsockBeingUsed().socketNum();
+    int queued = 0, sendBuffer = 0;
+    socklen_t len = sizeof(sendBuffer);
+    if(ioctl(fd, SIOCOUTQ, &queued) != 0
+       || getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, &len) != 0
+       || sendBuffer <= 0)
+        return -1;
+    return (int)((long long)queued*100/sendBuffer);
+}
+
+void DecimatingJPEGSource::setLevel(unsigned level, char const* reason)
+{
+    fLevel = level;
+    envir() << "Client " << fClientSessionId << ": " << reason;
+    if(level == 0)
+        envir() << "; sending every frame\n";
+    else
+        envir() << "; sending every " << (1U << level)
+                << (level == 1 ? "nd" : "th") << " frame\n";
+}
+
+u_int8_t DecimatingJPEGSource::type()
+{
+    return fType;
+}
+
+u_int8_t DecimatingJPEGSource::qFactor()
+{
+    return fQFactor;
+}
+
+u_int8_t DecimatingJPEGSource::width()
+{
+    return fWidth;
+}
+
+u_int8_t DecimatingJPEGSource::height()
+{
+    return fHeight;
+}
+
+u_int8_t const* DecimatingJPEGSource::quantizationTables(u_int8_t& precision,
+                                                         u_int16_t& length)
+{
+    precision = fPrecision;
+    length = fQTablesLength;
+    return fQTables;
+}
+
+u_int16_t DecimatingJPEGSource::restartInterval()
+{
+    return fRestartInterval;
+}
@@ -0,0 +1,111 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// One unicast client's view of the webcam: every 2^k-th frame, with k
+// raised while the client's link shows backpressure
+// C++ header
+
+#ifndef _DECIMATING_JPEG_SOURCE_HH
+#define _DECIMATING_JPEG_SOURCE_HH
+
+#include "JPEGVideoSource.hh"
+#include "RTPSink.hh"
+#include "WebcamJPEGDeviceSource.hh"
+
+#define MAX_DECIMATION_LEVEL 4           // down to every 16th frame
+#define DECIMATION_CHECK_INTERVAL 500000 // microseconds
+#define DECIMATION_SENDQ_HIGH 50         // percent of SO_SNDBUF still queued
+#define DECIMATION_LOSS_HIGH 13          // RR fraction lost (x/256, ~5%)
+#define DECIMATION_CLEAN_CHECKS 6        // clean checks before stepping down,
+#define DECIMATION_CLEAN_REPORTS 2       // or clean RRs once the client sends them
+
+class WebcamServerMediaSubsession;
+
+class DecimatingJPEGSource: public JPEGVideoSource, public JpegFrameConsumer {
+public:
+    static DecimatingJPEGSource* createNew(UsageEnvironment& env,
+                                           WebcamJPEGDeviceSource* input,
+                                           unsigned clientSessionId,
+                                           WebcamServerMediaSubsession* subsession = NULL);
+    // "subsession", if given, requantizes or crops the frames (see
+    // WebcamServerMediaSubsession::transcode()), which then reach the sink
+    // through deliverFrame()
+
+    void setRTPSink(RTPSink* sink);
+    // the sink whose socket and RTCP receiver reports are watched; until
+    // it is set, every frame is sent
+    unsigned decimationLevel() const { return fLevel; }
+    // 0: every frame, k: every 2^k-th frame
+    unsigned long skippedFrames() const { return fSkippedFrames; }
+
+    virtual void consumeJpegFrame(JpegFrameParser& parser,
+                                  struct timeval presentationTime);
+    void deliverFrame(JpegFrameParser& parser, struct timeval presentationTime,
+                      int transcoded, unsigned char const* scan, unsigned scanLength);
+    // "transcoded" as in WebcamServerMediaSubsession::transcode(): 0 to
+    // send "scan" with the transcoder's header fields, 1 to send the frame
+    // as captured, -1 to skip it
+
+protected:
+    DecimatingJPEGSource(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+                         unsigned clientSessionId,
+                         WebcamServerMediaSubsession* subsession);
+    // called only by createNew()
+    virtual ~DecimatingJPEGSource();
+
+private:
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+    virtual void doStopGettingFrames();
+    virtual u_int8_t type();
+    virtual u_int8_t qFactor();
+    virtual u_int8_t width();
+    virtual u_int8_t height();
+    virtual u_int8_t const* quantizationTables(u_int8_t& precision,
+                                               u_int16_t& length);
+    virtual u_int16_t restartInterval();
+
+private:
+    static void checkBackpressure(void* clientData);
+    void checkBackpressure();
+    int sendQueueFill();
+    void setLevel(unsigned level, char const* reason);
+
+private:
+    WebcamJPEGDeviceSource* fInput;
+    unsigned fClientSessionId;
+    WebcamServerMediaSubsession* fSubsession;
+    RTPSink* fSink;
+    TaskToken fCheckTask;
+    unsigned fLevel;
+    unsigned fCleanChecks;
+    bool fReportsSeen;
+    unsigned fLastReportPacketNum;
+    unsigned long fFrameCount;
+    unsigned long fSkippedFrames;
+
+    // the header fields of the frame being delivered
+    u_int8_t fType;
+    u_int8_t fQFactor;
+    u_int8_t fWidth;
+    u_int8_t fHeight;
+    u_int8_t fPrecision;
+    u_int16_t fRestartInterval;
+    u_int8_t fQTables[256];
+    u_int16_t fQTablesLength;
+};
+
+#endif // _DECIMATING_JPEG_SOURCE_HH
@@ -0,0 +1,182 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-disk cache of V4L2 format/frame size/frame interval probe results
+// Implementation
+//
+// The cache is a text file with one line per device:
+//   <device-key> <mode-count> {<fourcc> <width> <height> <num> <den>}...
+
+#include "DeviceProbeCache.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+DeviceProbeCache::DeviceProbeCache(char const* fileName)
+{
+    fFileName = strdup(fileName);
+}
+
+DeviceProbeCache::~DeviceProbeCache()
+{
+    free(fFileName);
+}
+
+static int parseLine(char* line, char const* deviceKey,
+                     std::vector<CaptureMode>& modes)
+{
+    char* save = NULL;
+    char* tok = strtok_r(line, " \t\n", &save);
+    if (tok == NULL || strcmp(tok, deviceKey) != 0)
+        return -1;
+
+    tok = strtok_r(NULL, " \t\n", &save);
+    if (tok == NULL)
+        return -1;
+    unsigned long count = strtoul(tok, NULL, 10);
+
+    modes.clear();
+    for (unsigned long i = 0; i < count; i++) {
+        unsigned long field[5];
+        for (int j = 0; j < 5; j++) {
+            tok = strtok_r(NULL, " \t\n", &save);
+            if (tok == NULL)
+                return -1;
+            field[j] = strtoul(tok, NULL, 10);
+        }
+        if (field[3] == 0 || field[4] == 0)
+            return -1;
+        CaptureMode mode;
+        mode.pixelFormat = field[0];
+        mode.width = field[1];
+        mode.height = field[2];
+        mode.intervalNum = field[3];
+        mode.intervalDen = field[4];
+        modes.push_back(mode);
+    }
+    return modes.empty() ? -1 : 0;
+}
+
+int DeviceProbeCache::lookup(char const* deviceKey,
+                             std::vector<CaptureMode>& modes)
+{
+    FILE* fp = fopen(fFileName, "r");
+    if (fp == NULL)
+        return -1;
+
+    char* line = NULL;
+    size_t lineSize = 0;
+    int result = -1;
+    while (getline(&line, &lineSize, fp) != -1) {
+        if (parseLine(line, deviceKey, modes) == 0) {
+            result = 0;
+            break;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return result;
+}
+
+int DeviceProbeCache::store(char const* deviceKey,
+                            std::vector<CaptureMode> const& modes)
+{
+    return rewrite(deviceKey, &modes);
+}
+
+int DeviceProbeCache::invalidate(char const* deviceKey)
+{
+    return rewrite(deviceKey, NULL);
+}
+
+// Copies every other device's line to a temporary file, appends the new
+// entry (if any) and renames the result over the cache, so that a reader
+// never sees a half-written file.  Writers (other streamers probing other
+// devices) are serialized by an flock() on "<cache>.lock", held for the
+// whole read-modify-rename; the temporary file gets a unique name from
+// mkstemp(), since the cache usually lives in world-writable /var/tmp.
+int DeviceProbeCache::rewrite(char const* deviceKey,
+                              std::vector<CaptureMode> const* modes)
+{
+    size_t keyLen = strlen(deviceKey);
+    size_t nameLen = strlen(fFileName) + 8;
+    char* lockName = new char[nameLen];
+    snprintf(lockName, nameLen, "%s.lock", fFileName);
+    int lockFd = open(lockName, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    delete[] lockName;
+    if (lockFd < 0)
+        return -1;
+    while (flock(lockFd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            close(lockFd);
+            return -1;
+        }
+    }
+
+    char* tmpName = new char[nameLen];
+    snprintf(tmpName, nameLen, "%s.XXXXXX", fFileName);
+    int tmpFd = mkstemp(tmpName);
+    FILE* out = tmpFd < 0 ? NULL : fdopen(tmpFd, "w");
+    if (out == NULL) {
+        if (tmpFd >= 0) {
+            close(tmpFd);
+            unlink(tmpName);
+        }
+        delete[] tmpName;
+        close(lockFd);
+        return -1;
+    }
+    fchmod(tmpFd, 0644); // mkstemp() makes it 0600
+
+    FILE* in = fopen(fFileName, "r");
+    if (in != NULL) {
+        char* line = NULL;
+        size_t lineSize = 0;
+        while (getline(&line, &lineSize, in) != -1) {
+            if (strncmp(line, deviceKey, keyLen) == 0
+                && (line[keyLen] == ' ' || line[keyLen] == '\t'))
+                continue;
+            fputs(line, out);
+        }
+        free(line);
+        fclose(in);
+    }
+
+    if (modes != NULL) {
+        fprintf(out, "%s %u", deviceKey, (unsigned)modes->size());
+        for (size_t i = 0; i < modes->size(); i++) {
+            CaptureMode const& m = (*modes)[i];
+            fprintf(out, " %u %u %u %u %u", m.pixelFormat, m.width, m.height,
+                    m.intervalNum, m.intervalDen);
+        }
+        fputc('\n', out);
+    }
+
+    int result = 0;
+    if (fclose(out) != 0 || rename(tmpName, fFileName) != 0) {
+        unlink(tmpName);
+        result = -1;
+    }
+    delete[] tmpName;
+    close(lockFd); // releases the lock
+    return result;
+}
@@ -0,0 +1,54 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-disk cache of V4L2 format/frame size/frame interval probe results
+// C++ header
+
+#ifndef _DEVICE_PROBE_CACHE_HH
+#define _DEVICE_PROBE_CACHE_HH
+
+#include <vector>
+
+#define DEFAULT_PROBE_CACHE_FILE "/var/tmp/WebcamStreamer.probe"
+
+struct CaptureMode {
+    unsigned pixelFormat; // V4L2 fourcc
+    unsigned width;
+    unsigned height;
+    unsigned intervalNum; // frame interval, in seconds
+    unsigned intervalDen;
+};
+
+class DeviceProbeCache
+{
+public:
+    DeviceProbeCache(char const* fileName);
+    virtual ~DeviceProbeCache();
+
+    // "deviceKey" must not contain whitespace; it is built from the V4L2
+    // bus info, driver name and driver version of the device.
+    int lookup(char const* deviceKey, std::vector<CaptureMode>& modes);
+    int store(char const* deviceKey, std::vector<CaptureMode> const& modes);
+    int invalidate(char const* deviceKey);
+
+private:
+    int rewrite(char const* deviceKey, std::vector<CaptureMode> const* modes);
+
+private:
+    char* fFileName;
+};
+
+#endif // _DEVICE_PROBE_CACHE_HH
@@ -0,0 +1,505 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// live555 task scheduler on epoll(7), with a timer wheel for delayed tasks
+// and an eventfd for event triggers
+// Implementation
+//
+// Delayed tasks due within one rotation of a wheel of
+// EPOLL_TIMER_WHEEL_SLOTS slots, one per EPOLL_TIMER_TICK, hang off the
+// slot of their expiry tick; later ones (RTSP liveness checks, RTCP
+// reports) wait in a min-heap and move to the wheel as it turns.  A bitmap
+// of the busy slots finds the next due tick, so an iteration costs the
+// same however many timers there are: it visits the slots of the ticks
+// that passed and the heap entries that came within reach.  Scheduling
+// and unscheduling a near task is O(1), a later one O(log n).  Tokens are
+// ids looked up in a hash table, so unscheduling a task that already ran
+// is harmless, as with BasicTaskScheduler.
+
+#include "EpollTaskScheduler.hh"
+
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Timer::tick of a timer waiting in fLaterTimers, and of a due timer that
+// runDueTimers() took from there
+#define LATER_TIMER (-1)
+#define DUE_TIMER (-2)
+
+EpollTaskScheduler* EpollTaskScheduler::createNew(bool edgeTriggered)
+{
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd < 0)
+        return NULL;
+    int eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(eventFd < 0) {
+        close(epollFd);
+        return NULL;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = eventFd;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &ev) != 0) {
+        close(eventFd);
+        close(epollFd);
+        return NULL;
+    }
+    return new EpollTaskScheduler(epollFd, eventFd, edgeTriggered);
+}
+
+EpollTaskScheduler::EpollTaskScheduler(int epollFd, int eventFd,
+                                       bool edgeTriggered)
+  : fEpollFd(epollFd), fEventFd(eventFd), fEdgeTriggered(edgeTriggered),
+    fWheelTick(now()/EPOLL_TIMER_TICK), fNumLaterTimers(0), fLastTimerId(0),
+    fTriggersAwaitingHandling(0), fLastUsedTrigger(EPOLL_MAX_EVENT_TRIGGERS - 1)
+{
+    for(unsigned i = 0; i < EPOLL_TIMER_WHEEL_SLOTS; i++)
+        fWheel[i] = NULL;
+    for(unsigned i = 0; i < EPOLL_TIMER_WHEEL_SLOTS/64; i++)
+        fBusySlots[i] = 0;
+    for(unsigned i = 0; i < EPOLL_MAX_EVENT_TRIGGERS; i++) {
+        fTriggerHandlers[i] = NULL;
+        fTriggerClientDatas[i] = NULL;
+    }
+}
+
+EpollTaskScheduler::~EpollTaskScheduler()
+{
+    for(std::unordered_map<intptr_t, Timer*>::iterator it = fTimers.begin();
+        it != fTimers.end(); ++it)
+        delete it->second;
+    close(fEventFd);
+    close(fEpollFd);
+}
+
+int64_t EpollTaskScheduler::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+TaskToken EpollTaskScheduler::scheduleDelayedTask(int64_t microseconds,
+                                                  TaskFunc* proc,
+                                                  void* clientData)
+{
+    if(microseconds < 0)
+        microseconds = 0;
+    Timer* timer = new Timer;
+    timer->id = ++fLastTimerId;
+    timer->expiry = now() + microseconds;
+    timer->proc = proc;
+    timer->clientData = clientData;
+    addTimer(timer);
+    fTimers[timer->id] = timer;
+    return (TaskToken)timer->id;
+}
+
+void EpollTaskScheduler::addTimer(Timer* timer)
+{
+    if(timer->expiry/EPOLL_TIMER_TICK < fWheelTick + EPOLL_TIMER_WHEEL_SLOTS) {
+        linkTimer(timer);
+        return;
+    }
+    timer->tick = LATER_TIMER;
+    if(fLaterTimers.size() > 2*fNumLaterTimers + 64) {
+        // mostly unscheduled timers: rebuild from the live ones
+        fLaterTimers.clear();
+        for(std::unordered_map<intptr_t, Timer*>::iterator it = fTimers.begin();
+            it != fTimers.end(); ++it) {
+            if(it->second->tick == LATER_TIMER)
+                fLaterTimers.push_back(std::make_pair(it->second->expiry, it->first));
+        }
+        std::make_heap(fLaterTimers.begin(), fLaterTimers.end(),
+                       std::greater<std::pair<int64_t, intptr_t> >());
+    }
+    fLaterTimers.push_back(std::make_pair(timer->expiry, timer->id));
+    std::push_heap(fLaterTimers.begin(), fLaterTimers.end(),
+                   std::greater<std::pair<int64_t, intptr_t> >());
+    fNumLaterTimers++;
+}
+
+// Hangs "timer" off the slot of its expiry tick (fWheelTick, should the
+// loop lag behind the clock)
+void EpollTaskScheduler::linkTimer(Timer* timer)
+{
+    timer->tick = std::max(timer->expiry/EPOLL_TIMER_TICK, fWheelTick);
+    unsigned i = timer->tick % EPOLL_TIMER_WHEEL_SLOTS;
+    timer->prev = NULL;
+    timer->next = fWheel[i];
+    if(fWheel[i] != NULL)
+        fWheel[i]->prev = timer;
+    fWheel[i] = timer;
+    fBusySlots[i/64] |= (uint64_t)1 << (i%64);
+}
+
+void EpollTaskScheduler::unscheduleDelayedTask(TaskToken& prevTask)
+{
+    std::unordered_map<intptr_t, Timer*>::iterator it
+        = fTimers.find((intptr_t)prevTask);
+    prevTask = NULL;
+    if(it == fTimers.end())
+        return; // already ran, or never existed
+    unlinkTimer(it->second);
+    delete it->second;
+    fTimers.erase(it);
+}
+
+// Takes a timer out of the wheel; one in fLaterTimers just leaves a stale
+// entry behind, as it is no longer in fTimers.
+void EpollTaskScheduler::unlinkTimer(Timer* timer)
+{
+    if(timer->tick == LATER_TIMER)
+        fNumLaterTimers--;
+    if(timer->tick < 0)
+        return;
+    unsigned i = timer->tick % EPOLL_TIMER_WHEEL_SLOTS;
+    if(timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else
+        fWheel[i] = timer->next;
+    if(timer->next != NULL)
+        timer->next->prev = timer->prev;
+    if(fWheel[i] == NULL)
+        fBusySlots[i/64] &= ~((uint64_t)1 << (i%64));
+}
+
+void EpollTaskScheduler::dropStaleLaterTimers()
+{
+    while(!fLaterTimers.empty() && fTimers.count(fLaterTimers.front().second) == 0) {
+        std::pop_heap(fLaterTimers.begin(), fLaterTimers.end(),
+                      std::greater<std::pair<int64_t, intptr_t> >());
+        fLaterTimers.pop_back();
+    }
+}
+
+// Removes and returns the earliest timer of fLaterTimers if it expires
+// before tick "beforeTick", NULL otherwise.  The caller links it to the
+// wheel or marks it DUE_TIMER.
+EpollTaskScheduler::Timer* EpollTaskScheduler::popLaterTimer(int64_t beforeTick)
+{
+    dropStaleLaterTimers();
+    if(fLaterTimers.empty() || fLaterTimers.front().first/EPOLL_TIMER_TICK >= beforeTick)
+        return NULL;
+    Timer* timer = fTimers[fLaterTimers.front().second];
+    std::pop_heap(fLaterTimers.begin(), fLaterTimers.end(),
+                  std::greater<std::pair<int64_t, intptr_t> >());
+    fLaterTimers.pop_back();
+    fNumLaterTimers--;
+    return timer;
+}
+
+// The expiry of the first timer: in the first busy slot from fWheelTick
+// on, all of whose timers are due by the end of its tick, or else the
+// first one in fLaterTimers.
+int64_t EpollTaskScheduler::firstExpiry()
+{
+    unsigned start = fWheelTick % EPOLL_TIMER_WHEEL_SLOTS;
+    for(unsigned n = 0; n <= EPOLL_TIMER_WHEEL_SLOTS/64; n++) {
+        unsigned word = (start/64 + n) % (EPOLL_TIMER_WHEEL_SLOTS/64);
+        uint64_t bits = fBusySlots[word];
+        if(n == 0)
+            bits &= ~(uint64_t)0 << (start%64); // slots before start wrap around
+        else if(n == EPOLL_TIMER_WHEEL_SLOTS/64)
+            bits &= ~(~(uint64_t)0 << (start%64));
+        if(bits == 0)
+            continue;
+        unsigned i = word*64 + __builtin_ctzll(bits);
+        int64_t first = fWheel[i]->expiry;
+        for(Timer* t = fWheel[i]->next; t != NULL; t = t->next)
+            first = std::min(first, t->expiry);
+        return first;
+    }
+    dropStaleLaterTimers();
+    return fLaterTimers.empty() ? -1 : fLaterTimers.front().first;
+}
+
+// How long epoll_wait() may sleep, in milliseconds: until the first timer
+// is due, -1 if there are no timers.
+int EpollTaskScheduler::waitTimeout(int64_t now, unsigned maxDelayTime)
+{
+    int64_t wait = -1;
+    if(!fTimers.empty()) {
+        int64_t first = firstExpiry();
+        if(first >= 0)
+            wait = first > now ? first - now : 0;
+    }
+    if(maxDelayTime > 0 && (wait < 0 || wait > (int64_t)maxDelayTime))
+        wait = maxDelayTime;
+    if(wait < 0)
+        return -1;
+    return (int)((wait + 999)/1000); // never wake up early
+}
+
+void EpollTaskScheduler::SingleStep(unsigned maxDelayTime)
+{
+    int timeout = fStillReady.empty() ? waitTimeout(now(), maxDelayTime) : 0;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int n = epoll_wait(fEpollFd, events, EPOLL_MAX_EVENTS, timeout);
+    if(n < 0) {
+        if(errno != EINTR) {
+            perror("EpollTaskScheduler::SingleStep(): epoll_wait() failed");
+            internalError();
+        }
+        n = 0;
+    }
+
+    std::vector<std::pair<int, int> > stillReady;
+    stillReady.swap(fStillReady);
+    for(int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if(fd == fEventFd) {
+            uint64_t count;
+            while(read(fEventFd, &count, sizeof(count)) > 0) {}
+            continue;
+        }
+        unsigned e = events[i].events;
+        int resultConditionSet = 0;
+        if(e & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            resultConditionSet |= SOCKET_READABLE;
+        if(e & (EPOLLOUT | EPOLLERR))
+            resultConditionSet |= SOCKET_WRITABLE;
+        if(e & (EPOLLPRI | EPOLLERR))
+            resultConditionSet |= SOCKET_EXCEPTION;
+        for(size_t j = 0; j < stillReady.size(); j++) {
+            if(stillReady[j].first == fd)
+                stillReady[j].second = 0; // handled now
+        }
+        handleSocket(fd, resultConditionSet);
+    }
+    for(size_t i = 0; i < stillReady.size(); i++) {
+        if(stillReady[i].second != 0)
+            handleSocket(stillReady[i].first, stillReady[i].second);
+    }
+
+    handleTriggers();
+    runDueTimers();
+}
+
+void EpollTaskScheduler::handleSocket(int socketNum, int resultConditionSet)
+{
+    // the handler may have been removed by one that ran before it
+    std::unordered_map<int, Handler>::iterator it = fHandlers.find(socketNum);
+    if(it == fHandlers.end())
+        return;
+    Handler handler = it->second;
+    resultConditionSet &= handler.conditionSet;
+    if(resultConditionSet == 0)
+        return;
+    (*handler.proc)(handler.clientData, resultConditionSet);
+
+    if(fEdgeTriggered) {
+        // epoll reports the socket again only once more data arrives
+        it = fHandlers.find(socketNum);
+        if(it == fHandlers.end())
+            return;
+        struct pollfd pfd;
+        pfd.fd = socketNum;
+        pfd.events = 0;
+        if(it->second.conditionSet & SOCKET_READABLE)
+            pfd.events |= POLLIN;
+        if(it->second.conditionSet & SOCKET_WRITABLE)
+            pfd.events |= POLLOUT;
+        if(it->second.conditionSet & SOCKET_EXCEPTION)
+            pfd.events |= POLLPRI;
+        pfd.revents = 0;
+        if(poll(&pfd, 1, 0) <= 0 || (pfd.revents & POLLNVAL) != 0)
+            return;
+        int stillReady = 0;
+        if(pfd.revents & (POLLIN | POLLHUP | POLLERR))
+            stillReady |= SOCKET_READABLE;
+        if(pfd.revents & (POLLOUT | POLLERR))
+            stillReady |= SOCKET_WRITABLE;
+        if(pfd.revents & (POLLPRI | POLLERR))
+            stillReady |= SOCKET_EXCEPTION;
+        fStillReady.push_back(std::make_pair(socketNum, stillReady));
+    }
+}
+
+void EpollTaskScheduler::handleTriggers()
+{
+    EventTriggerId mask = fTriggersAwaitingHandling.exchange(0);
+    for(unsigned i = 0; mask != 0 && i < EPOLL_MAX_EVENT_TRIGGERS; i++) {
+        EventTriggerId bit = (EventTriggerId)1 << i;
+        if((mask & bit) == 0)
+            continue;
+        mask &= ~bit;
+        if(fTriggerHandlers[i] != NULL)
+            (*fTriggerHandlers[i])(fTriggerClientDatas[i]);
+    }
+}
+
+// Runs the tasks that are due, in order of expiry.  Tasks they schedule
+// wait for the next iteration, even with a zero delay.
+void EpollTaskScheduler::runDueTimers()
+{
+    if(fTimers.empty())
+        return;
+    int64_t t = now();
+    int64_t tick = t/EPOLL_TIMER_TICK;
+    int64_t ticks = std::min<int64_t>(tick - fWheelTick + 1, EPOLL_TIMER_WHEEL_SLOTS);
+
+    // Each slot holds a single tick: those before the current one are due
+    // as a whole.
+    std::vector<std::pair<int64_t, intptr_t> > due;
+    for(int64_t i = 0; i < ticks; i++) {
+        unsigned slot = (fWheelTick + i) % EPOLL_TIMER_WHEEL_SLOTS;
+        if((fBusySlots[slot/64] & ((uint64_t)1 << (slot%64))) == 0)
+            continue;
+        for(Timer* timer = fWheel[slot]; timer != NULL; timer = timer->next) {
+            if(timer->expiry <= t)
+                due.push_back(std::make_pair(timer->expiry, timer->id));
+        }
+    }
+    // Turn the wheel past the ticks that are over.  The current one stays:
+    // its slot may still get timers due within it, e.g. zero-delay tasks
+    // the due ones schedule, and holds nothing else to revisit.
+    fWheelTick = tick;
+    // Bring the later timers now within a rotation onto the wheel; after a
+    // stall of more than a rotation some of them may be due already.
+    while(Timer* timer = popLaterTimer(fWheelTick + EPOLL_TIMER_WHEEL_SLOTS)) {
+        if(timer->expiry <= t) {
+            due.push_back(std::make_pair(timer->expiry, timer->id));
+            timer->tick = DUE_TIMER;
+        } else {
+            linkTimer(timer);
+        }
+    }
+    std::sort(due.begin(), due.end());
+
+    for(size_t i = 0; i < due.size(); i++) {
+        // an earlier task may have unscheduled this one
+        std::unordered_map<intptr_t, Timer*>::iterator it = fTimers.find(due[i].second);
+        if(it == fTimers.end())
+            continue;
+        Timer* timer = it->second;
+        fTimers.erase(it);
+        unlinkTimer(timer);
+        TaskFunc* proc = timer->proc;
+        void* clientData = timer->clientData;
+        delete timer;
+        (*proc)(clientData);
+    }
+}
+
+unsigned EpollTaskScheduler::epollEvents(int conditionSet)
+{
+    unsigned events = 0;
+    if(conditionSet & SOCKET_READABLE)
+        events |= EPOLLIN;
+    if(conditionSet & SOCKET_WRITABLE)
+        events |= EPOLLOUT;
+    if(conditionSet & SOCKET_EXCEPTION)
+        events |= EPOLLPRI;
+    if(fEdgeTriggered)
+        events |= EPOLLET;
+    return events;
+}
+
+void EpollTaskScheduler::setBackgroundHandling(int socketNum, int conditionSet,
+                                               BackgroundHandlerProc* handlerProc,
+                                               void* clientData)
+{
+    if(socketNum < 0)
+        return;
+    if(conditionSet == 0 || handlerProc == NULL) {
+        if(fHandlers.erase(socketNum) > 0)
+            epoll_ctl(fEpollFd, EPOLL_CTL_DEL, socketNum, NULL);
+        return;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = epollEvents(conditionSet);
+    ev.data.fd = socketNum;
+    // A socket closed without turning off its handling has left the epoll
+    // set by itself; its number may come back for a new socket.
+    int op = fHandlers.count(socketNum) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if(epoll_ctl(fEpollFd, op, socketNum, &ev) != 0) {
+        if(op == EPOLL_CTL_MOD && errno == ENOENT)
+            op = EPOLL_CTL_ADD;
+        else if(op == EPOLL_CTL_ADD && errno == EEXIST)
+            op = EPOLL_CTL_MOD;
+        else
+            op = -1;
+        if(op == -1 || epoll_ctl(fEpollFd, op, socketNum, &ev) != 0) {
+            perror("EpollTaskScheduler::setBackgroundHandling(): epoll_ctl() failed");
+            return;
+        }
+    }
+    Handler& handler = fHandlers[socketNum];
+    handler.conditionSet = conditionSet;
+    handler.proc = handlerProc;
+    handler.clientData = clientData;
+}
+
+void EpollTaskScheduler::moveSocketHandling(int oldSocketNum, int newSocketNum)
+{
+    std::unordered_map<int, Handler>::iterator it = fHandlers.find(oldSocketNum);
+    if(oldSocketNum < 0 || newSocketNum < 0 || it == fHandlers.end())
+        return;
+    Handler handler = it->second;
+    setBackgroundHandling(oldSocketNum, 0, NULL, NULL);
+    setBackgroundHandling(newSocketNum, handler.conditionSet, handler.proc,
+                          handler.clientData);
+}
+
+EventTriggerId EpollTaskScheduler::createEventTrigger(TaskFunc* eventHandlerProc)
+{
+    unsigned i = fLastUsedTrigger;
+    do {
+        i = (i + 1) % EPOLL_MAX_EVENT_TRIGGERS;
+        if(fTriggerHandlers[i] == NULL) {
+            fTriggerHandlers[i] = eventHandlerProc;
+            fTriggerClientDatas[i] = NULL;
+            fLastUsedTrigger = i;
+            return (EventTriggerId)1 << i;
+        }
+    } while(i != fLastUsedTrigger);
+    return 0; // all in use
+}
+
+void EpollTaskScheduler::deleteEventTrigger(EventTriggerId eventTriggerId)
+{
+    fTriggersAwaitingHandling &= ~eventTriggerId;
+    for(unsigned i = 0; i < EPOLL_MAX_EVENT_TRIGGERS; i++) {
+        if(eventTriggerId & ((EventTriggerId)1 << i)) {
+            fTriggerHandlers[i] = NULL;
+            fTriggerClientDatas[i] = NULL;
+        }
+    }
+}
+
+void EpollTaskScheduler::triggerEvent(EventTriggerId eventTriggerId, void* clientData)
+{
+    for(unsigned i = 0; i < EPOLL_MAX_EVENT_TRIGGERS; i++) {
+        if(eventTriggerId & ((EventTriggerId)1 << i))
+            fTriggerClientDatas[i] = clientData;
+    }
+    fTriggersAwaitingHandling |= eventTriggerId;
+    uint64_t one = 1;
+    if(write(fEventFd, &one, sizeof(one)) < 0) {
+        // EAGAIN: the counter is saturated, a wakeup is pending anyway
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// live555 task scheduler on epoll(7), with a timer wheel for delayed tasks
+// and an eventfd for event triggers
+// C++ header
+
+#ifndef _EPOLL_TASK_SCHEDULER_HH
+#define _EPOLL_TASK_SCHEDULER_HH
+
+#include "BasicUsageEnvironment.hh"
+
+#include <atomic>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#define EPOLL_TIMER_WHEEL_SLOTS 512
+#define EPOLL_TIMER_TICK 1000 // microseconds covered by one wheel slot
+#define EPOLL_MAX_EVENTS 64   // events taken per epoll_wait()
+#define EPOLL_MAX_EVENT_TRIGGERS 32
+
+// A drop-in replacement for BasicTaskScheduler whose cost per loop
+// iteration depends on the number of sockets that are ready and timers
+// that are due, not on the number of sockets and timers there are, and
+// which has no FD_SETSIZE limit.
+class EpollTaskScheduler: public BasicTaskScheduler0 {
+public:
+    static EpollTaskScheduler* createNew(bool edgeTriggered = false);
+    // NULL if epoll or eventfd are unavailable.  "edgeTriggered" registers
+    // the sockets with EPOLLET; live555 handlers read only part of what is
+    // pending, so a socket that is still ready after its handler ran is
+    // then handled again on the next iteration without asking epoll.
+    virtual ~EpollTaskScheduler();
+
+    virtual void SingleStep(unsigned maxDelayTime = 0);
+    // "maxDelayTime" (microseconds), if non-zero, bounds the wait
+
+    // redefined virtual functions:
+    virtual TaskToken scheduleDelayedTask(int64_t microseconds, TaskFunc* proc,
+                                          void* clientData);
+    virtual void unscheduleDelayedTask(TaskToken& prevTask);
+    virtual void setBackgroundHandling(int socketNum, int conditionSet,
+                                       BackgroundHandlerProc* handlerProc,
+                                       void* clientData);
+    virtual void moveSocketHandling(int oldSocketNum, int newSocketNum);
+    virtual EventTriggerId createEventTrigger(TaskFunc* eventHandlerProc);
+    virtual void deleteEventTrigger(EventTriggerId eventTriggerId);
+    virtual void triggerEvent(EventTriggerId eventTriggerId, void* clientData = NULL);
+    // may be called from any thread; wakes up epoll_wait() at once
+
+protected:
+    EpollTaskScheduler(int epollFd, int eventFd, bool edgeTriggered);
+    // called only by createNew()
+
+private:
+    struct Timer {
+        intptr_t id;
+        int64_t expiry; // CLOCK_MONOTONIC, in microseconds
+        TaskFunc* proc;
+        void* clientData;
+        int64_t tick;   // of its wheel slot, or LATER_TIMER or DUE_TIMER
+        Timer* prev;    // within the wheel slot
+        Timer* next;
+    };
+    struct Handler {
+        int conditionSet;
+        BackgroundHandlerProc* proc;
+        void* clientData;
+    };
+
+    static int64_t now();
+    int waitTimeout(int64_t now, unsigned maxDelayTime);
+    void addTimer(Timer* timer);
+    void linkTimer(Timer* timer);
+    void unlinkTimer(Timer* timer);
+    Timer* popLaterTimer(int64_t beforeTick);
+    void dropStaleLaterTimers();
+    int64_t firstExpiry();
+    void runDueTimers();
+    void handleSocket(int socketNum, int resultConditionSet);
+    void handleTriggers();
+    unsigned epollEvents(int conditionSet);
+
+private:
+    int fEpollFd;
+    int fEventFd;
+    bool fEdgeTriggered;
+
+    std::unordered_map<int, Handler> fHandlers;
+    // edge-triggered: sockets (and conditions) to handle again without waiting
+    std::vector<std::pair<int, int> > fStillReady;
+
+    // The wheel holds the timers of ticks [fWheelTick, fWheelTick +
+    // EPOLL_TIMER_WHEEL_SLOTS), one tick per slot; later ones wait in a
+    // min-heap of (expiry, id), whose entries for unscheduled timers are
+    // dropped when they come up (or when they outnumber the live ones).
+    Timer* fWheel[EPOLL_TIMER_WHEEL_SLOTS];
+    uint64_t fBusySlots[EPOLL_TIMER_WHEEL_SLOTS/64]; // bit set: slot not empty
+    int64_t fWheelTick; // the first tick not fully run yet
+    std::vector<std::pair<int64_t, intptr_t> > fLaterTimers;
+    size_t fNumLaterTimers; // live entries in fLaterTimers
+    std::unordered_map<intptr_t, Timer*> fTimers;
+    intptr_t fLastTimerId;
+
+    TaskFunc* fTriggerHandlers[EPOLL_MAX_EVENT_TRIGGERS];
+    void* volatile fTriggerClientDatas[EPOLL_MAX_EVENT_TRIGGERS];
+    std::atomic<EventTriggerId> fTriggersAwaitingHandling;
+    unsigned fLastUsedTrigger;
+};
+
+#endif // _EPOLL_TASK_SCHEDULER_HH
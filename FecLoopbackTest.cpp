@@ -0,0 +1,218 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// A test program that sends RTP/JPEG-sized packets with XOR FEC over
+// loopback, drops some of them at random, and measures how many frames
+// the receiver-side FEC decoder recovers
+// main program
+
+#include "RtpXorFec.hh"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <set>
+#include <vector>
+
+#define MEDIA_PAYLOAD_TYPE 26 // JPEG
+#define MAX_PAYLOAD 1400
+
+char* progName;
+unsigned lossPercent = 5;
+unsigned groupSize = 4;
+unsigned numFrames = 1000;
+unsigned seed = 1;
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [-l <loss-percent>] [-g <group-size>]"
+            " [-n <frames>] [-s <seed>]\n", progName);
+    exit(1);
+}
+
+static int openReceiver(struct sockaddr_in& addr)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0; // any free port
+    socklen_t len = sizeof(addr);
+    int bufSize = 4 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        || getsockname(sock, (struct sockaddr*)&addr, &len) != 0) {
+        perror("receiver socket");
+        exit(1);
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    return sock;
+}
+
+// Packetizes one frame the way JPEGVideoRTPSink does: payload-size
+// fragments, marker bit on the last one.
+static void makeFrame(unsigned frameNum, uint16_t& seq,
+                      std::vector<std::vector<unsigned char> >& packets)
+{
+    unsigned frameSize = 20000 + rand() % 30000;
+    uint32_t timestamp = frameNum * 3000; // 30 fps at 90 kHz
+
+    packets.clear();
+    for (unsigned offset = 0; offset < frameSize; offset += MAX_PAYLOAD) {
+        unsigned payloadSize = frameSize - offset < MAX_PAYLOAD
+            ? frameSize - offset : MAX_PAYLOAD;
+        std::vector<unsigned char> p(RTP_HEADER_SIZE + payloadSize);
+        bool last = offset + payloadSize >= frameSize;
+        p[0] = 0x80;
+        p[1] = MEDIA_PAYLOAD_TYPE | (last ? 0x80 : 0);
+        p[2] = seq >> 8; p[3] = seq & 0xFF;
+        p[4] = timestamp >> 24; p[5] = timestamp >> 16;
+        p[6] = timestamp >> 8; p[7] = timestamp;
+        p[8] = 0x12; p[9] = 0x34; p[10] = 0x56; p[11] = 0x78;
+        for (unsigned i = RTP_HEADER_SIZE; i < p.size(); i++)
+            p[i] = rand();
+        packets.push_back(p);
+        seq++;
+    }
+}
+
+static bool dropped()
+{
+    return (unsigned)(rand() % 100) < lossPercent;
+}
+
+int main(int argc, char** argv)
+{
+    progName = argv[0];
+    int opt;
+    while ((opt = getopt(argc, argv, "l:g:n:s:")) != -1) {
+        switch (opt) {
+            case 'l':
+                if (sscanf(optarg, "%u", &lossPercent) != 1 || lossPercent > 100)
+                    usage();
+                break;
+            case 'g':
+                if (sscanf(optarg, "%u", &groupSize) != 1
+                    || groupSize == 0 || groupSize > FEC_MAX_GROUP_SIZE)
+                    usage();
+                break;
+            case 'n':
+                if (sscanf(optarg, "%u", &numFrames) != 1 || numFrames == 0)
+                    usage();
+                break;
+            case 's':
+                if (sscanf(optarg, "%u", &seed) != 1)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+    srand(seed);
+
+    struct sockaddr_in mediaAddr, fecAddr;
+    int mediaSock = openReceiver(mediaAddr);
+    int fecSock = openReceiver(fecAddr);
+    int sendSock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    RtpXorFecEncoder encoder;
+    encoder.setGroupSize(groupSize);
+    RtpXorFecDecoder decoder;
+
+    unsigned long mediaSent = 0, fecSent = 0, mediaBytes = 0, fecBytes = 0;
+    unsigned long lost = 0, recovered = 0, corrupt = 0;
+    unsigned long framesIntactWithout = 0, framesIntactWith = 0;
+    uint16_t seq = 0;
+    std::vector<std::vector<unsigned char> > packets;
+    std::vector<unsigned char> fec, rebuilt;
+    unsigned char buf[2048];
+
+    for (unsigned f = 0; f < numFrames; f++) {
+        makeFrame(f, seq, packets);
+        uint16_t firstSeq = seq - packets.size();
+        unsigned lostInFrame = 0;
+
+        // sender: media packets, each FEC packet after its group
+        for (size_t i = 0; i < packets.size(); i++) {
+            std::vector<unsigned char>& p = packets[i];
+            mediaSent++;
+            mediaBytes += p.size();
+            if (dropped())
+                lostInFrame++;
+            else
+                sendto(sendSock, &p[0], p.size(), 0,
+                       (struct sockaddr*)&mediaAddr, sizeof(mediaAddr));
+            if (encoder.addPacket(&p[0], p.size(), fec)) {
+                fecSent++;
+                fecBytes += fec.size();
+                if (!dropped())
+                    sendto(sendSock, &fec[0], fec.size(), 0,
+                           (struct sockaddr*)&fecAddr, sizeof(fecAddr));
+            }
+        }
+        lost += lostInFrame;
+        if (lostInFrame == 0)
+            framesIntactWithout++;
+
+        // receiver: media first, then the FEC packets of the frame
+        std::set<uint16_t> received;
+        ssize_t len;
+        while ((len = recv(mediaSock, buf, sizeof(buf), 0)) > 0) {
+            decoder.addMediaPacket(buf, len);
+            received.insert((buf[2] << 8) | buf[3]);
+        }
+        while ((len = recv(fecSock, buf, sizeof(buf), 0)) > 0) {
+            if (decoder.addFecPacket(buf, len, rebuilt) != 1)
+                continue;
+            uint16_t s = (rebuilt[2] << 8) | rebuilt[3];
+            uint16_t index = s - firstSeq;
+            if (index >= packets.size() || rebuilt != packets[index]) {
+                corrupt++;
+                continue;
+            }
+            recovered++;
+            received.insert(s);
+        }
+        if (received.size() == packets.size())
+            framesIntactWith++;
+    }
+
+    printf("loss %u%%, FEC group size %u, %u frames\n",
+           lossPercent, groupSize, numFrames);
+    printf("media packets: %lu sent, %lu lost, %lu recovered (%.1f%%)\n",
+           mediaSent, lost, recovered, lost ? 100.0*recovered/lost : 100.0);
+    printf("FEC packets: %lu, overhead %.1f%% of the media bytes\n",
+           fecSent, 100.0*fecBytes/mediaBytes);
+    printf("intact frames: %.1f%% without FEC, %.1f%% with FEC\n",
+           100.0*framesIntactWithout/numFrames,
+           100.0*framesIntactWith/numFrames);
+    if (corrupt != 0) {
+        printf("FAILED: %lu packets were rebuilt incorrectly\n", corrupt);
+        return 1;
+    }
+    if (lossPercent == 0 && framesIntactWith != numFrames) {
+        printf("FAILED: frames went missing without any loss\n");
+        return 1;
+    }
+    return 0;
+}
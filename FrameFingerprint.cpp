@@ -0,0 +1,94 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Fast 64-bit fingerprint of JPEG scan data
+// Implementation
+
+#include "FrameFingerprint.hh"
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_CRC32_LANES 1
+#endif
+
+static inline uint64_t load64(unsigned char const* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t wordHash(unsigned char const* data, unsigned int length)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ length;
+    unsigned int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        h ^= load64(data + i);
+        h *= 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, length - i);
+    h ^= tail;
+    return mix64(h);
+}
+
+#ifdef HAVE_CRC32_LANES
+// Three independent CRC32 streams hide the instruction's latency, so the
+// hash runs at close to one 8-byte word per cycle.
+__attribute__((target("sse4.2")))
+static uint64_t crc32Hash(unsigned char const* data, unsigned int length)
+{
+    uint64_t a = 0xffffffff, b = 0x12345678, c = 0x9abcdef0;
+    unsigned int i = 0;
+    for (; i + 24 <= length; i += 24) {
+        a = _mm_crc32_u64(a, load64(data + i));
+        b = _mm_crc32_u64(b, load64(data + i + 8));
+        c = _mm_crc32_u64(c, load64(data + i + 16));
+    }
+    for (; i + 8 <= length; i += 8) {
+        a = _mm_crc32_u64(a, load64(data + i));
+    }
+    for (; i < length; i++) {
+        b = _mm_crc32_u8((uint32_t)b, data[i]);
+    }
+    return mix64((a << 32) ^ (b << 16) ^ c ^ length);
+}
+#endif
+
+unsigned long long frameFingerprint(unsigned char const* data,
+                                    unsigned int length)
+{
+#ifdef HAVE_CRC32_LANES
+    static int haveSse42 = __builtin_cpu_supports("sse4.2");
+    if (haveSse42)
+        return crc32Hash(data, length);
+#endif
+    return wordHash(data, length);
+}
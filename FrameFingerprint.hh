@@ -0,0 +1,29 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Fast 64-bit fingerprint of JPEG scan data
+// C++ header
+
+#ifndef _FRAME_FINGERPRINT_HH
+#define _FRAME_FINGERPRINT_HH
+
+// Uses the SSE4.2 CRC32 instruction (three interleaved lanes) when the
+// CPU has it, and a multiply/xor word hash otherwise.  The result is only
+// meant for detecting repeated frames, not as a checksum.
+unsigned long long frameFingerprint(unsigned char const* data,
+                                    unsigned int length);
+
+#endif // _FRAME_FINGERPRINT_HH
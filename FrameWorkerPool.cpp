@@ -0,0 +1,223 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Work-stealing thread pool for per-frame processing, shared by all cameras
+// Implementation
+
+#include "FrameWorkerPool.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static thread_local int currentWorker = -1;
+
+FrameWorkerPool::FrameWorkerPool(unsigned numThreads)
+  : fNextWorker(0), fPending(0), fStopping(false)
+{
+    if(numThreads == 0)
+        numThreads = std::thread::hardware_concurrency();
+    if(numThreads == 0)
+        numThreads = 1;
+    for(unsigned i = 0; i < numThreads; i++)
+        fWorkers.push_back(new Worker);
+    for(unsigned i = 0; i < numThreads; i++)
+        fWorkers[i]->thread = std::thread(&FrameWorkerPool::run, this, i);
+}
+
+FrameWorkerPool::~FrameWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(fIdleMutex);
+        fStopping = true;
+    }
+    fIdleCond.notify_all();
+    for(size_t i = 0; i < fWorkers.size(); i++) {
+        fWorkers[i]->thread.join();
+        delete fWorkers[i];
+    }
+}
+
+void FrameWorkerPool::submit(JobFunc* func, void* clientData)
+{
+    Job job = { func, clientData };
+    unsigned index = currentWorker >= 0 ? (unsigned)currentWorker
+        : fNextWorker++ % fWorkers.size();
+    {
+        std::lock_guard<std::mutex> lock(fIdleMutex);
+        fPending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(fWorkers[index]->mutex);
+        fWorkers[index]->jobs.push_back(job);
+    }
+    fIdleCond.notify_one();
+}
+
+// Takes the oldest job of our own queue, or else steals the newest job of
+// another worker's queue.
+bool FrameWorkerPool::popJob(unsigned index, Job& job)
+{
+    {
+        Worker* w = fWorkers[index];
+        std::lock_guard<std::mutex> lock(w->mutex);
+        if(!w->jobs.empty()) {
+            job = w->jobs.front();
+            w->jobs.pop_front();
+            return true;
+        }
+    }
+    for(size_t i = 1; i < fWorkers.size(); i++) {
+        Worker* victim = fWorkers[(index + i) % fWorkers.size()];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if(!victim->jobs.empty()) {
+            job = victim->jobs.back();
+            victim->jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void FrameWorkerPool::run(unsigned index)
+{
+    currentWorker = index;
+    for(;;) {
+        Job job;
+        if(popJob(index, job)) {
+            {
+                std::lock_guard<std::mutex> lock(fIdleMutex);
+                fPending--;
+            }
+            job.func(job.clientData);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(fIdleMutex);
+        if(fStopping)
+            break;
+        if(fPending == 0)
+            fIdleCond.wait(lock);
+    }
+}
+
+FrameStrand::FrameStrand(FrameWorkerPool& pool, TaskScheduler& scheduler,
+                         FrameWorkerPool::JobFunc* work,
+                         CompletionFunc* completion, void* clientData)
+  : fPool(pool), fScheduler(scheduler), fWork(work), fCompletion(completion),
+    fClientData(clientData), fNextSeq(0), fNextToDeliver(0), fRunning(0)
+{
+    fTrigger = fScheduler.createEventTrigger(deliverCompletions);
+
+    // select() doesn't return for an event trigger; a byte on this pipe
+    // makes the event loop handle the trigger right away instead of at
+    // the next scheduler tick.
+    if(pipe(fWakeupPipe) == 0) {
+        fcntl(fWakeupPipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(fWakeupPipe[1], F_SETFL, O_NONBLOCK);
+        fScheduler.turnOnBackgroundReadHandling(fWakeupPipe[0], wakeupHandler, this);
+    } else {
+        fWakeupPipe[0] = fWakeupPipe[1] = -1;
+    }
+}
+
+FrameStrand::~FrameStrand()
+{
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+        while(fRunning > 0)
+            fIdleCond.wait(lock);
+    }
+    fScheduler.deleteEventTrigger(fTrigger);
+    if(fWakeupPipe[0] >= 0) {
+        fScheduler.turnOffBackgroundReadHandling(fWakeupPipe[0]);
+        ::close(fWakeupPipe[0]);
+        ::close(fWakeupPipe[1]);
+    }
+}
+
+void FrameStrand::submit(void* job)
+{
+    Entry* entry = new Entry;
+    entry->strand = this;
+    entry->job = job;
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        entry->seq = fNextSeq++;
+        fRunning++;
+    }
+    fPool.submit(runJob, entry);
+}
+
+unsigned FrameStrand::inFlight()
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fNextSeq - fNextToDeliver;
+}
+
+void FrameStrand::runJob(void* clientData)
+{
+    Entry* entry = (Entry*)clientData;
+    FrameStrand* strand = entry->strand;
+
+    strand->fWork(entry->job);
+    {
+        std::lock_guard<std::mutex> lock(strand->fMutex);
+        strand->fDone[entry->seq] = entry->job;
+    }
+    delete entry;
+
+    strand->fScheduler.triggerEvent(strand->fTrigger, strand);
+    if(strand->fWakeupPipe[1] >= 0) {
+        char c = 0;
+        if(write(strand->fWakeupPipe[1], &c, 1) < 0) {
+            // pipe full: the event loop is awake already
+        }
+    }
+
+    // last access to the strand: its destructor may run as soon as
+    // fRunning drops to zero
+    std::lock_guard<std::mutex> lock(strand->fMutex);
+    strand->fRunning--;
+    strand->fIdleCond.notify_all();
+}
+
+void FrameStrand::wakeupHandler(void* clientData, int /*mask*/)
+{
+    FrameStrand* strand = (FrameStrand*)clientData;
+    char buf[64];
+    while(read(strand->fWakeupPipe[0], buf, sizeof(buf)) > 0) {
+    }
+}
+
+// Hands finished jobs to the completion function, oldest first, stopping at
+// the first gap so that a camera's frames never overtake each other.
+void FrameStrand::deliverCompletions(void* clientData)
+{
+    FrameStrand* strand = (FrameStrand*)clientData;
+    for(;;) {
+        void* job;
+        {
+            std::lock_guard<std::mutex> lock(strand->fMutex);
+            std::map<unsigned long, void*>::iterator it
+                = strand->fDone.find(strand->fNextToDeliver);
+            if(it == strand->fDone.end())
+                break;
+            job = it->second;
+            strand->fDone.erase(it);
+            strand->fNextToDeliver++;
+        }
+        strand->fCompletion(strand->fClientData, job);
+    }
+}
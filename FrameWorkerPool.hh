@@ -0,0 +1,115 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Work-stealing thread pool for per-frame processing, shared by all cameras
+// C++ header
+
+#ifndef _FRAME_WORKER_POOL_HH
+#define _FRAME_WORKER_POOL_HH
+
+#include "UsageEnvironment.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FrameWorkerPool {
+public:
+    typedef void JobFunc(void* clientData);
+
+    FrameWorkerPool(unsigned numThreads = 0);
+    // 0 threads: one per online CPU
+    virtual ~FrameWorkerPool();
+
+    // May be called from any thread.  A job submitted from a worker goes to
+    // that worker's own queue; other submissions are spread round-robin.
+    // Idle workers steal from the back of busy workers' queues.
+    void submit(JobFunc* func, void* clientData);
+
+    unsigned numThreads() const { return fWorkers.size(); }
+
+private:
+    struct Job {
+        JobFunc* func;
+        void* clientData;
+    };
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+
+    void run(unsigned index);
+    bool popJob(unsigned index, Job& job);
+
+private:
+    std::vector<Worker*> fWorkers;
+    std::atomic<unsigned> fNextWorker;
+    std::mutex fIdleMutex;
+    std::condition_variable fIdleCond;
+    unsigned fPending;
+    bool fStopping;
+};
+
+// Runs the jobs of one camera on a FrameWorkerPool and hands them back to
+// that camera's live555 event loop in submission order, through an event
+// trigger.  submit() and the completion function run on the event loop.
+class FrameStrand {
+public:
+    typedef void CompletionFunc(void* clientData, void* job);
+
+    FrameStrand(FrameWorkerPool& pool, TaskScheduler& scheduler,
+                FrameWorkerPool::JobFunc* work, CompletionFunc* completion,
+                void* clientData);
+    virtual ~FrameStrand();
+    // waits for jobs still running on the pool; finished jobs that were
+    // not delivered yet are dropped
+
+    void submit(void* job);
+    unsigned inFlight(); // submitted but not yet completed
+
+private:
+    struct Entry {
+        FrameStrand* strand;
+        unsigned long seq;
+        void* job;
+    };
+    static void runJob(void* clientData);
+    static void deliverCompletions(void* clientData);
+    static void wakeupHandler(void* clientData, int mask);
+
+private:
+    FrameWorkerPool& fPool;
+    TaskScheduler& fScheduler;
+    FrameWorkerPool::JobFunc* fWork;
+    CompletionFunc* fCompletion;
+    void* fClientData;
+    EventTriggerId fTrigger;
+    int fWakeupPipe[2];
+
+    std::mutex fMutex;
+    std::condition_variable fIdleCond;
+    std::map<unsigned long, void*> fDone;
+    unsigned long fNextSeq;
+    unsigned long fNextToDeliver;
+    unsigned fRunning;
+};
+
+#endif // _FRAME_WORKER_POOL_HH
@@ -0,0 +1,318 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// H.264 re-encoding of the webcam's MJPEG frames (built with WITH_H264)
+// Implementation
+
+#include "H264EncoderSource.hh"
+
+#include <string.h>
+
+H264EncoderSource*
+H264EncoderSource::createNew(UsageEnvironment& env,
+                             WebcamJPEGDeviceSource* input,
+                             unsigned bitrate, FrameWorkerPool* pool)
+{
+    H264EncoderSource* source = new H264EncoderSource(env, input, bitrate, pool);
+    if(source->fEncoder == NULL) {
+        env.setResultMsg("Failed to set up H.264 encoding: ", source->fError);
+        Medium::close(source);
+        return NULL;
+    }
+    return source;
+}
+
+H264EncoderSource
+::H264EncoderSource(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+                    unsigned bitrate, FrameWorkerPool* pool)
+  : FramedSource(env), fInput(input), fBitrate(bitrate), fOwnPool(NULL),
+    fStrand(NULL),
+    fDecompressor(NULL), fEncoder(NULL), fEncoderWidth(0), fEncoderHeight(0),
+    fEncoderTimePerFrame(0), fNextPts(0), fBusy(false), fFailing(false),
+    fDroppedFrames(0), fJpegTimePerFrame(0), fError(NULL)
+{
+    fJpegTime.tv_sec = fJpegTime.tv_usec = 0;
+    fDecompressor = tjInitDecompress();
+    if(fDecompressor == NULL) {
+        fError = "tjInitDecompress failed";
+        return;
+    }
+    // the parameter sets have to be known before the first frame, for
+    // the SDP description
+    if(openEncoder(fInput->captureWidth(), fInput->captureHeight(),
+                   fInput->timePerFrame()) != 0)
+        return;
+    fSps.swap(fNewSps);
+    fPps.swap(fNewPps);
+
+    // a frame takes tens of milliseconds to decode and encode: not on the
+    // event loop, which the other streams need
+    if(pool == NULL)
+        pool = fOwnPool = new FrameWorkerPool(1);
+    fStrand = new FrameStrand(*pool, env.taskScheduler(), encodeJob,
+                              encodeCompletion, this);
+    fInput->addFrameConsumer(this);
+}
+
+H264EncoderSource::~H264EncoderSource()
+{
+    fInput->removeFrameConsumer(this);
+    delete fStrand; // waits for a frame still being encoded
+    delete fOwnPool;
+    if(fEncoder != NULL)
+        x264_encoder_close(fEncoder);
+    if(fDecompressor != NULL)
+        tjDestroy(fDecompressor);
+}
+
+u_int8_t const* H264EncoderSource::sps(unsigned& size) const
+{
+    size = fSps.size();
+    return fSps.empty() ? NULL : &fSps[0];
+}
+
+u_int8_t const* H264EncoderSource::pps(unsigned& size) const
+{
+    size = fPps.size();
+    return fPps.empty() ? NULL : &fPps[0];
+}
+
+void H264EncoderSource::consumeJpegFrame(JpegFrameParser& parser,
+                                         struct timeval presentationTime)
+{
+    // Keep the latency at one frame: skip this one while the previous
+    // frame is still being encoded or sent.
+    if(fBusy || !fNals.empty()) {
+        fDroppedFrames++;
+        return;
+    }
+    unsigned length;
+    unsigned char const* frame = parser.frame(length);
+    fJpeg.assign(frame, frame + length);
+    fJpegTime = presentationTime;
+    fJpegTimePerFrame = fInput->timePerFrame();
+    fBusy = true;
+    fStrand->submit(this);
+}
+
+void H264EncoderSource::doGetNextFrame()
+{
+    if(!fNals.empty())
+        deliver();
+    // else the next encoded frame gets delivered by finishEncode()
+}
+
+void H264EncoderSource::encodeJob(void* job)
+{
+    ((H264EncoderSource*)job)->encode();
+}
+
+void H264EncoderSource::encodeCompletion(void* /*clientData*/, void* job)
+{
+    ((H264EncoderSource*)job)->finishEncode();
+}
+
+static void appendNal(std::vector<std::vector<u_int8_t> >& out, x264_nal_t const& nal)
+{
+    int startCode = nal.b_long_startcode ? 4 : 3;
+    out.push_back(std::vector<u_int8_t>(nal.p_payload + startCode,
+                                        nal.p_payload + nal.i_payload));
+}
+
+// Runs on the pool; touches nothing but the encoder state and
+// the fJpeg ... fError members, which the event loop leaves alone while
+// fBusy is set.
+void H264EncoderSource::encode()
+{
+    fEncoded.clear();
+    fError = NULL;
+
+    int width, height, subsamp, colorspace;
+    if(tjDecompressHeader3(fDecompressor, &fJpeg[0], fJpeg.size(),
+                           &width, &height, &subsamp, &colorspace) != 0) {
+        fError = tjGetErrorStr2(fDecompressor);
+        return;
+    }
+    if(subsamp != TJSAMP_422 && subsamp != TJSAMP_420) {
+        fError = "only 4:2:2 and 4:2:0 frames can be re-encoded";
+        return;
+    }
+    if((unsigned)width != fEncoderWidth || (unsigned)height != fEncoderHeight
+       || fJpegTimePerFrame != fEncoderTimePerFrame) {
+        // reconfigured; the new parameter sets go out in-band
+        if(openEncoder(width, height, fJpegTimePerFrame) != 0)
+            return;
+    }
+
+    int chromaWidth = tjPlaneWidth(1, width, subsamp);
+    int chromaHeight = tjPlaneHeight(1, height, subsamp);
+    unsigned char* planes[3];
+    int strides[3] = { width, chromaWidth, chromaWidth };
+    for(int i = 0; i < 3; i++) {
+        fPlanes[i].resize(i == 0 ? width*height : chromaWidth*chromaHeight);
+        planes[i] = &fPlanes[i][0];
+    }
+    if(tjDecompressToYUVPlanes(fDecompressor, &fJpeg[0], fJpeg.size(), planes,
+                               width, strides, height, TJFLAG_FASTDCT) != 0) {
+        fError = tjGetErrorStr2(fDecompressor);
+        return;
+    }
+    if(subsamp == TJSAMP_422) {
+        // x264 takes 4:2:0: average vertically adjacent chroma rows
+        for(int i = 1; i < 3; i++) {
+            for(int y = 0; y < (height + 1)/2; y++) {
+                unsigned char* out = planes[i] + y*chromaWidth;
+                unsigned char const* a = planes[i] + 2*y*chromaWidth;
+                unsigned char const* b = 2*y + 1 < chromaHeight ? a + chromaWidth : a;
+                for(int x = 0; x < chromaWidth; x++)
+                    out[x] = (unsigned char)((a[x] + b[x] + 1) >> 1);
+            }
+        }
+    }
+
+    x264_picture_t picture, encoded;
+    x264_picture_init(&picture);
+    picture.img.i_csp = X264_CSP_I420;
+    picture.img.i_plane = 3;
+    for(int i = 0; i < 3; i++) {
+        picture.img.plane[i] = planes[i];
+        picture.img.i_stride[i] = strides[i];
+    }
+    picture.i_pts = fNextPts++;
+
+    x264_nal_t* nals;
+    int numNals;
+    if(x264_encoder_encode(fEncoder, &nals, &numNals, &picture, &encoded) < 0) {
+        fError = "x264_encoder_encode failed";
+        return;
+    }
+    for(int i = 0; i < numNals; i++)
+        appendNal(fEncoded, nals[i]);
+}
+
+int H264EncoderSource::openEncoder(unsigned width, unsigned height,
+                                   unsigned timePerFrame)
+{
+    if(fEncoder != NULL) {
+        x264_encoder_close(fEncoder);
+        fEncoder = NULL;
+    }
+
+    // "zerolatency": no lookahead, no frame threads (slice threads
+    // instead), no B-frames
+    x264_param_t param;
+    if(x264_param_default_preset(&param, "veryfast", "zerolatency") != 0) {
+        fError = "x264_param_default_preset failed";
+        return -1;
+    }
+    unsigned fps = 1000000/timePerFrame;
+    param.i_width = width;
+    param.i_height = height;
+    param.i_csp = X264_CSP_I420;
+    param.i_fps_num = 1000000;
+    param.i_fps_den = timePerFrame;
+    param.b_vfr_input = 0;
+    param.i_keyint_max = (fps != 0 ? fps : 1)*H264_KEYFRAME_INTERVAL;
+    param.i_bframe = 0;
+    param.b_repeat_headers = 1; // for clients joining the shared stream
+    param.b_annexb = 1;
+    // constant bit rate, with room for about two frames in the VBV
+    param.rc.i_rc_method = X264_RC_ABR;
+    param.rc.i_bitrate = fBitrate;
+    param.rc.i_vbv_max_bitrate = fBitrate;
+    param.rc.i_vbv_buffer_size = fBitrate*2/(fps != 0 ? fps : 1) + 1;
+    param.i_log_level = X264_LOG_WARNING;
+    if(x264_param_apply_profile(&param, "main") != 0) {
+        fError = "x264_param_apply_profile failed";
+        return -1;
+    }
+
+    fEncoder = x264_encoder_open(&param);
+    if(fEncoder == NULL) {
+        fError = "x264_encoder_open failed";
+        return -1;
+    }
+    fEncoderWidth = width;
+    fEncoderHeight = height;
+    fEncoderTimePerFrame = timePerFrame;
+    fNextPts = 0;
+
+    x264_nal_t* nals;
+    int numNals;
+    if(x264_encoder_headers(fEncoder, &nals, &numNals) < 0) {
+        fError = "x264_encoder_headers failed";
+        return -1;
+    }
+    for(int i = 0; i < numNals; i++) {
+        int startCode = nals[i].b_long_startcode ? 4 : 3;
+        u_int8_t const* begin = nals[i].p_payload + startCode;
+        u_int8_t const* end = nals[i].p_payload + nals[i].i_payload;
+        if(nals[i].i_type == NAL_SPS)
+            fNewSps.assign(begin, end);
+        else if(nals[i].i_type == NAL_PPS)
+            fNewPps.assign(begin, end);
+    }
+    return 0;
+}
+
+// On the event loop, once encode() is done
+void H264EncoderSource::finishEncode()
+{
+    fBusy = false;
+    if(fError != NULL) {
+        if(!fFailing)
+            envir() << "H.264 encoding failed: " << fError << "\n";
+        fFailing = true;
+        return;
+    }
+    fFailing = false;
+    if(!fNewSps.empty()) {
+        fSps.swap(fNewSps);
+        fNewSps.clear();
+    }
+    if(!fNewPps.empty()) {
+        fPps.swap(fNewPps);
+        fNewPps.clear();
+    }
+    for(size_t i = 0; i < fEncoded.size(); i++) {
+        fNals.push_back(std::vector<u_int8_t>());
+        fNals.back().swap(fEncoded[i]);
+        fNalTimes.push_back(fJpegTime);
+    }
+    fEncoded.clear();
+    if(!fNals.empty() && isCurrentlyAwaitingData())
+        deliver();
+}
+
+void H264EncoderSource::deliver()
+{
+    std::vector<u_int8_t>& nal = fNals.front();
+    unsigned size = nal.size();
+    fNumTruncatedBytes = 0;
+    if(size > fMaxSize) {
+        fNumTruncatedBytes = size - fMaxSize;
+        size = fMaxSize;
+    }
+    memcpy(fTo, &nal[0], size);
+    fFrameSize = size;
+    fPresentationTime = fNalTimes.front();
+    fDurationInMicroseconds = 0;
+    fNals.pop_front();
+    fNalTimes.pop_front();
+
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                    (TaskFunc*)FramedSource::afterGetting, this);
+}
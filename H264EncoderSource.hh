@@ -0,0 +1,110 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// H.264 re-encoding of the webcam's MJPEG frames (built with WITH_H264)
+// C++ header
+
+#ifndef _H264_ENCODER_SOURCE_HH
+#define _H264_ENCODER_SOURCE_HH
+
+#include "FramedSource.hh"
+#include "FrameWorkerPool.hh"
+#include "WebcamJPEGDeviceSource.hh"
+
+#include <deque>
+#include <vector>
+
+#include <stdint.h>
+#include <turbojpeg.h>
+#include <x264.h>
+
+#define H264_KEYFRAME_INTERVAL 2 // seconds
+
+// Decodes every frame with libjpeg-turbo and encodes it with x264, tuned
+// for latency: no B-frames, no lookahead, one frame in, one frame out,
+// the encoder's own threads working on slices of the same frame.  The
+// output is one NAL unit per delivery, without start codes, as
+// H264VideoStreamDiscreteFramer expects.  A frame arriving while the
+// previous one is still being encoded is dropped rather than queued.
+class H264EncoderSource: public FramedSource, public JpegFrameConsumer {
+public:
+    static H264EncoderSource* createNew(UsageEnvironment& env,
+                                        WebcamJPEGDeviceSource* input,
+                                        unsigned bitrate,
+                                        FrameWorkerPool* pool = NULL);
+    // "bitrate" is in kbps.  Frames are encoded on "pool", or on a thread
+    // of the source's own if it is NULL, never on the event loop.
+
+    // The current parameter sets, for the SDP description
+    u_int8_t const* sps(unsigned& size) const;
+    u_int8_t const* pps(unsigned& size) const;
+    unsigned long droppedFrames() const { return fDroppedFrames; }
+
+    virtual void consumeJpegFrame(JpegFrameParser& parser,
+                                  struct timeval presentationTime);
+
+protected:
+    H264EncoderSource(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+                      unsigned bitrate, FrameWorkerPool* pool);
+    // called only by createNew()
+    virtual ~H264EncoderSource();
+
+private:
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    static void encodeJob(void* job);
+    static void encodeCompletion(void* clientData, void* job);
+    void encode();
+    void finishEncode();
+    int openEncoder(unsigned width, unsigned height, unsigned timePerFrame);
+    void deliver();
+
+private:
+    WebcamJPEGDeviceSource* fInput;
+    unsigned fBitrate;
+    FrameWorkerPool* fOwnPool; // without a shared one
+    FrameStrand* fStrand;
+    tjhandle fDecompressor;
+    x264_t* fEncoder;
+    unsigned fEncoderWidth;
+    unsigned fEncoderHeight;
+    unsigned fEncoderTimePerFrame;
+    int64_t fNextPts;
+    bool fBusy;
+    bool fFailing;
+    unsigned long fDroppedFrames;
+
+    // the frame being encoded and its result; owned by the worker while
+    // fBusy is set
+    std::vector<unsigned char> fJpeg;
+    unsigned fJpegTimePerFrame;
+    struct timeval fJpegTime;
+    std::vector<unsigned char> fPlanes[3];
+    std::vector<std::vector<u_int8_t> > fEncoded;
+    std::vector<u_int8_t> fNewSps;
+    std::vector<u_int8_t> fNewPps;
+    char const* fError;
+
+    // NAL units waiting for the framer, and the parameter sets in use
+    std::deque<std::vector<u_int8_t> > fNals;
+    std::deque<struct timeval> fNalTimes;
+    std::vector<u_int8_t> fSps;
+    std::vector<u_int8_t> fPps;
+};
+
+#endif // _H264_ENCODER_SOURCE_HH
@@ -0,0 +1,75 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-demand RTSP subsession serving the webcam re-encoded as H.264
+// (built with WITH_H264)
+// Implementation
+
+#include "H264ServerMediaSubsession.hh"
+#include "H264EncoderSource.hh"
+#include "H264VideoRTPSink.hh"
+#include "H264VideoStreamDiscreteFramer.hh"
+
+H264ServerMediaSubsession*
+H264ServerMediaSubsession::createNew(UsageEnvironment& env,
+                                     WebcamJPEGDeviceSource* input,
+                                     unsigned bitrate, FrameWorkerPool* pool)
+{
+    return new H264ServerMediaSubsession(env, input, bitrate, pool);
+}
+
+// All H.264 clients share one encoder, which exists (and decodes and
+// encodes anything) only while at least one of them is connected.
+H264ServerMediaSubsession
+::H264ServerMediaSubsession(UsageEnvironment& env,
+                            WebcamJPEGDeviceSource* input,
+                            unsigned bitrate, FrameWorkerPool* pool)
+  : OnDemandServerMediaSubsession(env, True /*reuse the first source*/),
+    fInput(input), fBitrate(bitrate), fPool(pool)
+{
+}
+
+H264ServerMediaSubsession::~H264ServerMediaSubsession()
+{
+}
+
+FramedSource* H264ServerMediaSubsession
+::createNewStreamSource(unsigned /*clientSessionId*/, unsigned& estBitrate)
+{
+    estBitrate = fBitrate; // kbps
+    H264EncoderSource* source
+        = H264EncoderSource::createNew(envir(), fInput, fBitrate, fPool);
+    if(source == NULL)
+        return NULL;
+    return H264VideoStreamDiscreteFramer::createNew(envir(), source);
+}
+
+RTPSink* H264ServerMediaSubsession
+::createNewRTPSink(Groupsock* rtpGroupsock,
+                   unsigned char rtpPayloadTypeIfDynamic,
+                   FramedSource* inputSource)
+{
+    // the encoder knows its parameter sets up front, so the SDP
+    // description needn't wait for the first frame
+    H264EncoderSource* source = (H264EncoderSource*)
+        ((H264VideoStreamDiscreteFramer*)inputSource)->inputSource();
+    unsigned spsSize, ppsSize;
+    u_int8_t const* sps = source->sps(spsSize);
+    u_int8_t const* pps = source->pps(ppsSize);
+    return H264VideoRTPSink::createNew(envir(), rtpGroupsock,
+                                       rtpPayloadTypeIfDynamic,
+                                       sps, spsSize, pps, ppsSize);
+}
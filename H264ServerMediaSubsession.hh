@@ -0,0 +1,57 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-demand RTSP subsession serving the webcam re-encoded as H.264
+// (built with WITH_H264)
+// C++ header
+
+#ifndef _H264_SERVER_MEDIA_SUBSESSION_HH
+#define _H264_SERVER_MEDIA_SUBSESSION_HH
+
+#include "OnDemandServerMediaSubsession.hh"
+#include "FrameWorkerPool.hh"
+#include "WebcamJPEGDeviceSource.hh"
+
+class H264ServerMediaSubsession: public OnDemandServerMediaSubsession {
+public:
+    static H264ServerMediaSubsession*
+    createNew(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+              unsigned bitrate, FrameWorkerPool* pool = NULL);
+    // "bitrate" is in kbps; frames are encoded on "pool" if there is one,
+    // else on a thread of the source's own
+
+protected:
+    H264ServerMediaSubsession(UsageEnvironment& env,
+                              WebcamJPEGDeviceSource* input,
+                              unsigned bitrate, FrameWorkerPool* pool);
+    // called only by createNew()
+    virtual ~H264ServerMediaSubsession();
+
+private:
+    // redefined virtual functions:
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId,
+                                                unsigned& estBitrate);
+    virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,
+                                      unsigned char rtpPayloadTypeIfDynamic,
+                                      FramedSource* inputSource);
+
+private:
+    WebcamJPEGDeviceSource* fInput;
+    unsigned fBitrate;
+    FrameWorkerPool* fPool;
+};
+
+#endif // _H264_SERVER_MEDIA_SUBSESSION_HH
@@ -0,0 +1,197 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// 1/8-scale JPEG preview built from the DC coefficients of the webcam frames
+// Implementation
+//
+// The DC coefficient of a block is 8 times the block's mean sample value,
+// so Huffman-decoding just the DCs of a frame yields a 1/8-scale image
+// without any IDCT.  That image is then encoded as a small JPEG with the
+// same chroma subsampling.
+
+#include "JPEGPreviewSource.hh"
+
+#include <string.h>
+
+JPEGPreviewSource*
+JPEGPreviewSource::createNew(UsageEnvironment& env,
+                             WebcamJPEGDeviceSource* input,
+                             unsigned timePerFrame, int quality,
+                             FrameWorkerPool* pool)
+{
+    return new JPEGPreviewSource(env, input, timePerFrame, quality, pool);
+}
+
+JPEGPreviewSource
+::JPEGPreviewSource(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+                    unsigned timePerFrame, int quality,
+                    FrameWorkerPool* pool)
+  : JPEGVideoSource(env), fInput(input), fTimePerFrame(timePerFrame),
+    fType(0), fWidth(0), fHeight(0), fStrand(NULL), fJobInFlight(false)
+{
+    fLastPreviewTime.tv_sec = fLastPreviewTime.tv_usec = 0;
+    fEncoder.setQuality(quality);
+    fJob.source = this;
+    fJob.result = -1;
+    if(pool != NULL)
+        fStrand = new FrameStrand(*pool, envir().taskScheduler(),
+                                  previewJob, previewJobDone, this);
+    fInput->addFrameConsumer(this);
+}
+
+JPEGPreviewSource::~JPEGPreviewSource()
+{
+    fInput->removeFrameConsumer(this);
+    delete fStrand; // waits for a frame still on the pool
+}
+
+void JPEGPreviewSource::doGetNextFrame()
+{
+    // Nothing to do here: the next captured frame that is due for a
+    // preview gets delivered by consumeJpegFrame().
+}
+
+void JPEGPreviewSource::consumeJpegFrame(JpegFrameParser& parser,
+                                         struct timeval presentationTime)
+{
+    // No work at all unless a client is reading and a preview is due
+    if(!isCurrentlyAwaitingData())
+        return;
+    long elapsed = (presentationTime.tv_sec - fLastPreviewTime.tv_sec)*1000000
+        + (presentationTime.tv_usec - fLastPreviewTime.tv_usec);
+    if(elapsed >= 0 && elapsed < (long)fTimePerFrame)
+        return;
+
+    if(fStrand != NULL) {
+        if(fJobInFlight)
+            return; // the pool is still on the previous preview
+        unsigned length;
+        unsigned char const* frame = parser.frame(length);
+        fJob.frame.assign(frame, frame + length);
+        fJob.presentationTime = presentationTime;
+        fJobInFlight = true;
+        fStrand->submit(&fJob);
+        return;
+    }
+    if(buildPreview(parser) != 0)
+        return;
+    fLastPreviewTime = presentationTime;
+    deliverPreview(presentationTime);
+}
+
+// Hands the preview in fJpeg to the reader
+void JPEGPreviewSource::deliverPreview(struct timeval presentationTime)
+{
+    unsigned scanLength = fJpeg.size() - fEncoder.scanDataOffset();
+    if(scanLength > fMaxSize) {
+        fNumTruncatedBytes = scanLength - fMaxSize;
+        scanLength = fMaxSize;
+    }
+    memcpy(fTo, &fJpeg[fEncoder.scanDataOffset()], scanLength);
+    fFrameSize = scanLength;
+    fPresentationTime = presentationTime;
+
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                    (TaskFunc*)FramedSource::afterGetting, this);
+}
+
+// On a pool thread: the job has the decoder, encoder and buffers to itself
+void JPEGPreviewSource::previewJob(void* job)
+{
+    PreviewJob* previewJob = (PreviewJob*)job;
+    if(previewJob->parser.parse(&previewJob->frame[0],
+                                previewJob->frame.size()) != 0)
+        previewJob->result = -1;
+    else
+        previewJob->result = previewJob->source->buildPreview(previewJob->parser);
+}
+
+void JPEGPreviewSource::previewJobDone(void* clientData, void* job)
+{
+    JPEGPreviewSource* source = (JPEGPreviewSource*)clientData;
+    PreviewJob* previewJob = (PreviewJob*)job;
+    source->fJobInFlight = false;
+    if(previewJob->result != 0)
+        return;
+    source->fLastPreviewTime = previewJob->presentationTime;
+    if(!source->isCurrentlyAwaitingData())
+        return; // the reader stopped while the frame was on the pool
+    source->deliverPreview(previewJob->presentationTime);
+}
+
+int JPEGPreviewSource::buildPreview(JpegFrameParser& parser)
+{
+    if(fDecoder.init(parser) != 0)
+        return -1;
+
+    JpegComponent const* comps = parser.components();
+    unsigned mcusPerRow = fDecoder.mcusPerRow();
+    unsigned mcuRows = fDecoder.mcuRows();
+    unsigned strides[3];
+    unsigned short q[3];
+    for(int c = 0; c < 3; c++) {
+        strides[c] = mcusPerRow*comps[c].h;
+        fPlanes[c].resize(strides[c]*mcuRows*comps[c].v);
+        q[c] = parser.quantizer(comps[c].tq, 0);
+    }
+
+    short dc[MAX_BLOCKS_IN_MCU];
+    for(unsigned my = 0; my < mcuRows; my++) {
+        for(unsigned mx = 0; mx < mcusPerRow; mx++) {
+            if(fDecoder.decodeMCUDC(dc) != 0)
+                return -1;
+            for(unsigned b = 0; b < fDecoder.blocksPerMcu(); b++) {
+                int c = fDecoder.blockComponent(b);
+                unsigned x = mx*comps[c].h + fDecoder.blockX(b);
+                unsigned y = my*comps[c].v + fDecoder.blockY(b);
+                // block mean = DC / 8, level shifted
+                int v = (dc[b]*q[c] + (dc[b] < 0 ? -4 : 4))/8 + 128;
+                fPlanes[c][y*strides[c] + x] = v < 0 ? 0 : (v > 255 ? 255 : v);
+            }
+        }
+    }
+
+    unsigned previewWidth = (parser.frameWidth() + 7)/8;
+    unsigned previewHeight = (parser.frameHeight() + 7)/8;
+    unsigned char const* planes[3] = { &fPlanes[0][0], &fPlanes[1][0], &fPlanes[2][0] };
+    fType = parser.type() & 1; // type + 64 only signals restart markers
+    if(fEncoder.encode(fType, previewWidth, previewHeight, planes, strides, fJpeg) != 0)
+        return -1;
+    fWidth = (previewWidth + 7)/8;
+    fHeight = (previewHeight + 7)/8;
+    return 0;
+}
+
+u_int8_t JPEGPreviewSource::type()
+{
+    return fType;
+}
+
+u_int8_t JPEGPreviewSource::qFactor()
+{
+    // < 128: receivers derive the RFC 2435 tables the encoder used
+    return fEncoder.quality();
+}
+
+u_int8_t JPEGPreviewSource::width()
+{
+    return fWidth;
+}
+
+u_int8_t JPEGPreviewSource::height()
+{
+    return fHeight;
+}
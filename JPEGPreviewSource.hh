@@ -0,0 +1,94 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// 1/8-scale JPEG preview built from the DC coefficients of the webcam frames
+// C++ header
+
+#ifndef _JPEG_PREVIEW_SOURCE_HH
+#define _JPEG_PREVIEW_SOURCE_HH
+
+#include "JPEGVideoSource.hh"
+#include "WebcamJPEGDeviceSource.hh"
+#include "JpegScanDecoder.hh"
+#include "JpegEncoder.hh"
+#include "FrameWorkerPool.hh"
+
+#include <vector>
+
+#define DEFAULT_PREVIEW_QUALITY 50
+
+class JPEGPreviewSource: public JPEGVideoSource, public JpegFrameConsumer {
+public:
+    static JPEGPreviewSource* createNew(UsageEnvironment& env,
+                                        WebcamJPEGDeviceSource* input,
+                                        unsigned timePerFrame,
+                                        int quality = DEFAULT_PREVIEW_QUALITY,
+                                        FrameWorkerPool* pool = NULL);
+    // "timePerFrame" is the preview frame interval, in microseconds.
+    // Previews are built on "pool" if there is one, on the event loop
+    // otherwise.
+
+    virtual void consumeJpegFrame(JpegFrameParser& parser,
+                                  struct timeval presentationTime);
+
+protected:
+    JPEGPreviewSource(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+                      unsigned timePerFrame, int quality,
+                      FrameWorkerPool* pool);
+    // called only by createNew()
+    virtual ~JPEGPreviewSource();
+
+private:
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+    virtual u_int8_t type();
+    virtual u_int8_t qFactor();
+    virtual u_int8_t width();
+    virtual u_int8_t height();
+
+private:
+    // A frame on its way through the pool, with a copy of its data: the
+    // input's parser moves on to the next frame meanwhile
+    struct PreviewJob {
+        JPEGPreviewSource* source;
+        std::vector<unsigned char> frame;
+        JpegFrameParser parser;
+        struct timeval presentationTime;
+        int result;
+    };
+
+    int buildPreview(JpegFrameParser& parser);
+    void deliverPreview(struct timeval presentationTime);
+    static void previewJob(void* job);
+    static void previewJobDone(void* clientData, void* job);
+
+private:
+    WebcamJPEGDeviceSource* fInput;
+    unsigned fTimePerFrame;
+    struct timeval fLastPreviewTime;
+    JpegScanDecoder fDecoder;
+    JpegEncoder fEncoder;
+    std::vector<unsigned char> fPlanes[3];
+    std::vector<unsigned char> fJpeg;
+    u_int8_t fType;
+    u_int8_t fWidth;
+    u_int8_t fHeight;
+    FrameStrand* fStrand;
+    PreviewJob fJob;   // owns the fields above while in flight
+    bool fJobInFlight;
+};
+
+#endif // _JPEG_PREVIEW_SOURCE_HH
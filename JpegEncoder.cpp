@@ -0,0 +1,295 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Baseline JPEG encoder for planar YCbCr images
+// Implementation
+
+#include <string.h>
+
+#include "JpegEncoder.hh"
+
+static float const aanScale[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+    1.0f, 0.785694958f, 0.541196100f, 0.275899379f
+};
+
+// Eight floats, operated on in parallel through the compiler's generic
+// vector extension: SSE or AVX on x86, NEON on ARM
+typedef float float8 __attribute__((vector_size(32)));
+
+/* Arai, Agui & Nakajima floating point forward DCT (as in libjpeg's
+ * jfdctflt.c) of d[0..7]; the outputs are scaled by aanScale[row] *
+ * aanScale[col] * 8, which the quantization divisors undo.  With T = float8
+ * this transforms eight independent vectors at once. */
+template <typename T>
+static inline void fdct8(T* d)
+{
+    T tmp0 = d[0] + d[7];
+    T tmp7 = d[0] - d[7];
+    T tmp1 = d[1] + d[6];
+    T tmp6 = d[1] - d[6];
+    T tmp2 = d[2] + d[5];
+    T tmp5 = d[2] - d[5];
+    T tmp3 = d[3] + d[4];
+    T tmp4 = d[3] - d[4];
+
+    /* even part */
+    T tmp10 = tmp0 + tmp3;
+    T tmp13 = tmp0 - tmp3;
+    T tmp11 = tmp1 + tmp2;
+    T tmp12 = tmp1 - tmp2;
+
+    d[0] = tmp10 + tmp11;
+    d[4] = tmp10 - tmp11;
+
+    T z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2] = tmp13 + z1;
+    d[6] = tmp13 - z1;
+
+    /* odd part */
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+
+    T z5 = (tmp10 - tmp12) * 0.382683433f;
+    T z2 = 0.541196100f * tmp10 + z5;
+    T z4 = 1.306562965f * tmp12 + z5;
+    T z3 = tmp11 * 0.707106781f;
+
+    T z11 = tmp7 + z3;
+    T z13 = tmp7 - z3;
+
+    d[5] = z13 + z2;
+    d[3] = z13 - z2;
+    d[1] = z11 + z4;
+    d[7] = z11 - z4;
+}
+
+JpegEncoder::JpegEncoder() :
+    _quality(0), _restartInterval(0), _scanDataOffset(0)
+{
+    for (int i = 0; i < 2; i++) {
+        _dc[i].build(jpegStandardHuffmanTable(HUFFMAN_DC, i));
+        _ac[i].build(jpegStandardHuffmanTable(HUFFMAN_AC, i));
+    }
+    setQuality(75);
+}
+
+JpegEncoder::~JpegEncoder()
+{
+}
+
+void JpegEncoder::setQuality(int q)
+{
+    if (q < 1) q = 1;
+    if (q > 99) q = 99;
+    if (q == _quality)
+        return;
+    _quality = q;
+    jpegMakeQuantizationTables(q, _qTables);
+
+    for (int t = 0; t < 2; t++) {
+        for (int k = 0; k < 64; k++) {
+            int n = jpegZigzagToNatural[k];
+            _divisors[t][n] = 1.0f / (_qTables[t * 64 + k]
+                                      * aanScale[n >> 3] * aanScale[n & 7] * 8.0f);
+        }
+    }
+}
+
+static void putMarker(std::vector<unsigned char>& out, unsigned char marker,
+                      unsigned int length)
+{
+    out.push_back(0xFF);
+    out.push_back(marker);
+    out.push_back(length >> 8);
+    out.push_back(length & 0xFF);
+}
+
+void JpegEncoder::writeHeaders(int type, unsigned int width,
+                               unsigned int height,
+                               std::vector<unsigned char>& out)
+{
+    out.push_back(0xFF);
+    out.push_back(0xD8); /* SOI */
+
+    putMarker(out, 0xDB, 2 + 2 * 65); /* DQT */
+    for (int t = 0; t < 2; t++) {
+        out.push_back(t);
+        out.insert(out.end(), _qTables + t * 64, _qTables + t * 64 + 64);
+    }
+
+    putMarker(out, 0xC0, 17); /* SOF0 */
+    out.push_back(8);
+    out.push_back(height >> 8);
+    out.push_back(height & 0xFF);
+    out.push_back(width >> 8);
+    out.push_back(width & 0xFF);
+    out.push_back(3);
+    out.push_back(1); out.push_back(type == 1 ? 0x22 : 0x21); out.push_back(0);
+    out.push_back(2); out.push_back(0x11); out.push_back(1);
+    out.push_back(3); out.push_back(0x11); out.push_back(1);
+
+    for (int t = 0; t < 2; t++) {
+        jpegWriteDHT(out, HUFFMAN_DC, t, jpegStandardHuffmanTable(HUFFMAN_DC, t));
+        jpegWriteDHT(out, HUFFMAN_AC, t, jpegStandardHuffmanTable(HUFFMAN_AC, t));
+    }
+
+    if (_restartInterval != 0) {
+        putMarker(out, 0xDD, 4); /* DRI */
+        out.push_back(_restartInterval >> 8);
+        out.push_back(_restartInterval & 0xFF);
+    }
+
+    putMarker(out, 0xDA, 12); /* SOS */
+    out.push_back(3);
+    out.push_back(1); out.push_back(0x00);
+    out.push_back(2); out.push_back(0x11);
+    out.push_back(3); out.push_back(0x11);
+    out.push_back(0);
+    out.push_back(63);
+    out.push_back(0);
+}
+
+// Transforms, quantizes and entropy codes the 8x8 block at (x, y) of a
+// plane; samples beyond the plane's edge repeat the last row/column.
+void JpegEncoder::encodeBlock(JpegBitWriter& writer,
+                              unsigned char const* plane, unsigned int stride,
+                              unsigned int step, unsigned int planeWidth,
+                              unsigned int planeHeight,
+                              unsigned int x, unsigned int y,
+                              int table, int& dcPred) const
+{
+    union {
+        float8 v[8];
+        float f[64];
+    } block;
+    short coef[64];
+
+    // The rows are transformed one at a time as they are loaded; then,
+    // with one vector per row, a single pass does all eight columns.
+    for (unsigned int r = 0; r < 8; r++) {
+        unsigned int sy = y + r < planeHeight ? y + r : planeHeight - 1;
+        unsigned char const* row = plane + sy * stride;
+        float* d = block.f + r * 8;
+        if (x + 8 <= planeWidth) {
+            for (unsigned int c = 0; c < 8; c++)
+                d[c] = row[(x + c) * step] - 128.0f;
+        } else {
+            for (unsigned int c = 0; c < 8; c++) {
+                unsigned int sx = x + c < planeWidth ? x + c : planeWidth - 1;
+                d[c] = row[sx * step] - 128.0f;
+            }
+        }
+        fdct8(d);
+    }
+    fdct8(block.v);
+
+    float const* div = _divisors[table];
+    for (int i = 0; i < 8; i++) {
+        float8 q;
+        memcpy(&q, div + i * 8, sizeof(q));
+        block.v[i] = block.v[i] * q + 16384.5f;
+    }
+    for (int k = 0; k < 64; k++)
+        coef[k] = (short)((int)block.f[jpegZigzagToNatural[k]] - 16384);
+    jpegEncodeBlock(writer, _dc[table], _ac[table], coef, dcPred);
+}
+
+// Codes MCU (mx, my): two or four luma blocks, then one Cb and one Cr block
+void JpegEncoder::encodeMCU(JpegBitWriter& writer, int type,
+                            unsigned int width, unsigned int height,
+                            JpegSourceImage const& image,
+                            unsigned int mx, unsigned int my, int* pred) const
+{
+    unsigned int mcuHeight = type == 1 ? 16 : 8;
+    unsigned int chromaWidth = (width + 1) / 2;
+    unsigned int chromaHeight = type == 1 ? (height + 1) / 2 : height;
+
+    for (unsigned int by = 0; by < mcuHeight; by += 8) {
+        encodeBlock(writer, image.planes[0], image.strides[0], image.steps[0],
+                    width, height, mx * 16, my * mcuHeight + by, 0, pred[0]);
+        encodeBlock(writer, image.planes[0], image.strides[0], image.steps[0],
+                    width, height, mx * 16 + 8, my * mcuHeight + by, 0, pred[0]);
+    }
+    for (int c = 1; c < 3; c++) {
+        encodeBlock(writer, image.planes[c], image.strides[c], image.steps[c],
+                    chromaWidth, chromaHeight, mx * 8, my * 8, 1, pred[c]);
+    }
+}
+
+void JpegEncoder::encodeRows(int type, unsigned int width, unsigned int height,
+                             JpegSourceImage const& image,
+                             unsigned int firstRow, unsigned int numRows,
+                             std::vector<unsigned char>& out) const
+{
+    unsigned int mcus = mcusPerRow(width);
+    JpegBitWriter writer(out);
+    int pred[3] = { 0, 0, 0 };
+
+    for (unsigned int my = firstRow; my < firstRow + numRows; my++) {
+        for (unsigned int mx = 0; mx < mcus; mx++)
+            encodeMCU(writer, type, width, height, image, mx, my, pred);
+    }
+    writer.flush();
+}
+
+int JpegEncoder::encode(int type, unsigned int width, unsigned int height,
+                        unsigned char const* const planes[3],
+                        unsigned int const strides[3],
+                        std::vector<unsigned char>& out)
+{
+    if (width == 0 || height == 0 || width > 65535 || height > 65535
+        || (type != 0 && type != 1))
+        return -1;
+
+    JpegSourceImage image;
+    for (int c = 0; c < 3; c++) {
+        image.planes[c] = planes[c];
+        image.strides[c] = strides[c];
+        image.steps[c] = 1;
+    }
+    unsigned int mcus = mcusPerRow(width);
+    unsigned int rows = mcuRows(type, height);
+
+    out.clear();
+    writeHeaders(type, width, height, out);
+    _scanDataOffset = out.size();
+
+    JpegBitWriter writer(out);
+    int pred[3] = { 0, 0, 0 };
+    unsigned int mcusToGo = _restartInterval;
+    int restartNum = 0;
+
+    for (unsigned int my = 0; my < rows; my++) {
+        for (unsigned int mx = 0; mx < mcus; mx++) {
+            if (_restartInterval != 0) {
+                if (mcusToGo == 0) {
+                    writer.restart(restartNum++);
+                    memset(pred, 0, sizeof(pred));
+                    mcusToGo = _restartInterval;
+                }
+                mcusToGo--;
+            }
+            encodeMCU(writer, type, width, height, image, mx, my, pred);
+        }
+    }
+    writer.flush();
+
+    out.push_back(0xFF);
+    out.push_back(0xD9); /* EOI */
+    return 0;
+}
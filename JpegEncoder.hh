@@ -0,0 +1,103 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Baseline JPEG encoder for planar YCbCr images
+// C++ header
+
+#ifndef _JPEG_ENCODER_HH_INCLUDED
+#define _JPEG_ENCODER_HH_INCLUDED
+
+#include "JpegHuffman.hh"
+
+#include <vector>
+
+// Three sample planes in memory.  "steps" are the distances between
+// horizontally adjacent samples, so packed formats such as YUYV (step 2
+// for luma, 4 for chroma) can be encoded without unpacking them first.
+struct JpegSourceImage
+{
+    unsigned char const* planes[3];
+    unsigned int strides[3];
+    unsigned int steps[3];
+};
+
+class JpegEncoder
+{
+public:
+    JpegEncoder();
+    virtual ~JpegEncoder();
+
+    // RFC 2435 Q factor (1..99); the quantization tables are the ones an
+    // RTP/JPEG receiver derives from it
+    void setQuality(int q);
+    int quality() const { return _quality; }
+    unsigned char const* quantizationTables() const { return _qTables; }
+
+    // MCUs per restart interval, 0 for none
+    void setRestartInterval(unsigned int mcus) { _restartInterval = mcus; }
+    unsigned int restartInterval() const { return _restartInterval; }
+
+    // Encodes a complete JFIF-less baseline JPEG into "out".  "type" is the
+    // RTP/JPEG type of the result: 0 for 4:2:2, 1 for 4:2:0.  planes[0] is
+    // the width x height luma plane, planes[1] and planes[2] the Cb and Cr
+    // planes subsampled accordingly (odd sizes round up).
+    int encode(int type, unsigned int width, unsigned int height,
+               unsigned char const* const planes[3],
+               unsigned int const strides[3],
+               std::vector<unsigned char>& out);
+
+    // Offset of the entropy-coded data within the last encoded image
+    unsigned int scanDataOffset() const { return _scanDataOffset; }
+
+    // Building blocks for encoding an image in pieces, e.g. one restart
+    // interval per thread: writeHeaders() starts "out" with everything up
+    // to the SOS segment; encodeRows() appends the entropy-coded data of
+    // MCU rows [firstRow, firstRow + numRows) as one restart interval
+    // (fresh DC predictions, padded to a byte, no RSTn marker).  The
+    // caller joins the intervals with RSTn markers and appends the EOI.
+    // encodeRows() does not modify the encoder and may run concurrently.
+    static unsigned int mcuRows(int type, unsigned int height)
+    {
+        return (height + (type == 1 ? 15 : 7)) / (type == 1 ? 16 : 8);
+    }
+    static unsigned int mcusPerRow(unsigned int width) { return (width + 15) / 16; }
+    void writeHeaders(int type, unsigned int width, unsigned int height,
+                      std::vector<unsigned char>& out);
+    void encodeRows(int type, unsigned int width, unsigned int height,
+                    JpegSourceImage const& image, unsigned int firstRow,
+                    unsigned int numRows, std::vector<unsigned char>& out) const;
+
+private:
+    void encodeMCU(JpegBitWriter& writer, int type, unsigned int width,
+                   unsigned int height, JpegSourceImage const& image,
+                   unsigned int mx, unsigned int my, int* pred) const;
+    void encodeBlock(JpegBitWriter& writer, unsigned char const* plane,
+                     unsigned int stride, unsigned int step,
+                     unsigned int planeWidth, unsigned int planeHeight,
+                     unsigned int x, unsigned int y,
+                     int table, int& dcPred) const;
+
+private:
+    int _quality;
+    unsigned int _restartInterval;
+    unsigned int _scanDataOffset;
+    unsigned char _qTables[128];
+    float _divisors[2][64]; // natural order, with the AAN scale folded in
+    JpegHuffmanEncoder _dc[2];
+    JpegHuffmanEncoder _ac[2];
+};
+
+#endif // _JPEG_ENCODER_HH_INCLUDED
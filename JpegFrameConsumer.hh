@@ -0,0 +1,37 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Interface for objects fed with every frame the webcam captures
+// C++ header
+
+#ifndef _JPEG_FRAME_CONSUMER_HH
+#define _JPEG_FRAME_CONSUMER_HH
+
+#include "JpegFrameParser.hh"
+
+#include <sys/time.h>
+
+class JpegFrameConsumer {
+public:
+    virtual ~JpegFrameConsumer() {}
+
+    // Called from the capture path for every frame that parsed successfully.
+    // The scan data "parser" points to is only valid during the call.
+    virtual void consumeJpegFrame(JpegFrameParser& parser,
+                                  struct timeval presentationTime) = 0;
+};
+
+#endif // _JPEG_FRAME_CONSUMER_HH
@@ -18,6 +18,7 @@
 #include <string.h>
 
 #include "JpegFrameParser.hh"
+#include "WebcamTrace.hh"
 
 #ifndef NDEBUG
 #include <stdio.h>
@@ -54,8 +55,12 @@ JpegFrameParser::JpegFrameParser() :
     _precision(0), _qFactor(255),
     _qTables(NULL), _qTablesLength(0),
     _restartInterval(0),
-    _scandata(NULL), _scandataLength(0)
+    _frameWidth(0), _frameHeight(0),
+    _huffmanTableMask(0),
+    _scandata(NULL), _scandataLength(0),
+    _frame(NULL), _frameLength(0), _sosOffset(0)
 {
+    memset(_components, 0, sizeof(_components));
     _qTables = new unsigned char[128 * 2];
     memset(_qTables, 8, 128 * 2);
 }
@@ -123,6 +128,8 @@ int JpegFrameParser::readSOF(const unsigned char* data, unsigned int size,
     
     _width = width / 8;
     _height = height / 8;
+    _frameWidth = width;
+    _frameHeight = height;
     
     /* we only support 3 components */
     if (data[off++] != 3) goto bad_components;
@@ -133,6 +140,11 @@ int JpegFrameParser::readSOF(const unsigned char* data, unsigned int size,
         elem.samp = data[off++];
         elem.qt = data[off++];
         
+        _components[i].id = elem.id;
+        _components[i].h = elem.samp >> 4;
+        _components[i].v = elem.samp & 0x0f;
+        _components[i].tq = elem.qt & 0x03;
+        
         /* insertion sort from the last element to the first */
         for (j = infolen; j > 1; j--) {
             if (info[j - 1].id < elem.id) break;
@@ -288,6 +300,81 @@ wrong_length:
     return -1;
 }
 
+unsigned int JpegFrameParser::readDHT(const unsigned char* data,
+                unsigned int size, unsigned int offset)
+{
+    unsigned int dht_size, end, count, i;
+    unsigned char tc, th;
+    
+    if (offset + 2 > size)
+        goto too_small;
+    
+    dht_size = _jpegHeaderSize(data, offset);
+    end = offset + dht_size;
+    if (dht_size < 2 || end > size)
+        goto too_small;
+    offset += 2;
+    
+    while (offset + 17 <= end) {
+        tc = data[offset] >> 4;
+        th = data[offset] & 0x0f;
+        if (tc > 1 || th > 3)
+            goto invalid_id;
+        
+        count = 0;
+        for (i = 0; i < 16; i++)
+            count += data[offset + 1 + i];
+        if (count > 256 || offset + 17 + count > end)
+            goto invalid_id;
+        
+        JpegHuffmanTable& table = _huffmanTables[tc][th];
+        memcpy(table.bits, &data[offset + 1], 16);
+        memcpy(table.vals, &data[offset + 17], count);
+        _huffmanTableMask |= 1 << (tc * 4 + th);
+        offset += 17 + count;
+    }
+    return end;
+    
+    /* ERRORS */
+too_small:
+    LOGGY("DHT is too small\n");
+    return size;
+    
+invalid_id:
+    LOGGY("Invalid Huffman table\n");
+    return end;
+}
+
+int JpegFrameParser::readSOS(const unsigned char* data,
+                             unsigned int size, unsigned int offset)
+{
+    JpegComponent ordered[3];
+    unsigned int i, j, ns;
+    
+    /* length, component count and 2 bytes per component */
+    if (offset + 3 > size)
+        return -1;
+    ns = data[offset + 2];
+    if (ns != 3 || offset + 3 + 2 * ns > size)
+        return -1;
+    
+    for (i = 0; i < ns; i++) {
+        unsigned char cs = data[offset + 3 + 2 * i];
+        unsigned char tdta = data[offset + 4 + 2 * i];
+        for (j = 0; j < 3; j++) {
+            if (_components[j].id == cs)
+                break;
+        }
+        if (j == 3)
+            return -1;
+        ordered[i] = _components[j];
+        ordered[i].td = (tdta >> 4) & 0x03;
+        ordered[i].ta = tdta & 0x03;
+    }
+    memcpy(_components, ordered, sizeof(ordered));
+    return 0;
+}
+
 int JpegFrameParser::parse(unsigned char* data, unsigned int size)
 {
     _width  = 0;
@@ -296,9 +383,16 @@ int JpegFrameParser::parse(unsigned char* data, unsigned int size)
     _precision = 0;
     //_qFactor = 0;
     _restartInterval = 0,
+    _frameWidth = 0;
+    _frameHeight = 0;
+    _huffmanTableMask = 0;
     
     _scandata = NULL;
     _scandataLength = 0;
+    _frame = data;
+    _frameLength = size;
+    _sosOffset = 0;
+    WEBCAM_TRACE1(parse_start, size);
     
     unsigned int offset = 0;
     unsigned int dqtFound = 0;
@@ -311,9 +405,11 @@ int JpegFrameParser::parse(unsigned char* data, unsigned int size)
         switch (scanJpegMarker(data, size, &offset)) {
             case JFIF_MARKER:
             case CMT_MARKER:
-            case DHT_MARKER:
                 offset += _jpegHeaderSize(data, offset);
                 break;
+            case DHT_MARKER:
+                offset = readDHT(data, size, offset);
+                break;
             case SOF_MARKER:
                 if (readSOF(data, size, &offset) != 0) {
                     goto invalid_format;
@@ -326,6 +422,10 @@ int JpegFrameParser::parse(unsigned char* data, unsigned int size)
                 break;
             case SOS_MARKER:
                 sosFound = 1;
+                _sosOffset = offset - 2;
+                if (sofFound && readSOS(data, size, offset) != 0) {
+                    goto invalid_format;
+                }
                 jpeg_header_size = offset + _jpegHeaderSize(data, offset);
                 break;
             case EOI_MARKER:
@@ -360,15 +460,19 @@ int JpegFrameParser::parse(unsigned char* data, unsigned int size)
         _type += 64;
     }
     
+    WEBCAM_TRACE2(parse_end, 0, _scandataLength);
     return 0;
     
     /* ERRORS */
 unsupported_jpeg:
+    WEBCAM_TRACE2(parse_end, -1, 0);
     return -1;
     
 no_dimension:
+    WEBCAM_TRACE2(parse_end, -1, 0);
     return -1;
     
 invalid_format:
+    WEBCAM_TRACE2(parse_end, -1, 0);
     return -1;
 }
@@ -18,6 +18,17 @@
 #ifndef _JPEG_FRAME_PARSER_HH_INCLUDED
 #define _JPEG_FRAME_PARSER_HH_INCLUDED
 
+#include "JpegHuffman.hh"
+
+struct JpegComponent
+{
+    unsigned char id;
+    unsigned char h;   // horizontal sampling factor
+    unsigned char v;   // vertical sampling factor
+    unsigned char tq;  // quantization table selector
+    unsigned char td;  // DC Huffman table selector (from SOS)
+    unsigned char ta;  // AC Huffman table selector (from SOS)
+};
 
 class JpegFrameParser
 {
@@ -32,6 +43,29 @@ public:
     unsigned char qFactor()   { return _qFactor; }
     void setQ(unsigned char q) { _qFactor =q; }
     unsigned short restartInterval() { return _restartInterval; }
+    unsigned short frameWidth()  { return _frameWidth; }  // in pixels
+    unsigned short frameHeight() { return _frameHeight; } // in pixels
+    
+    // the 3 components, in scan order
+    JpegComponent const* components() { return _components; }
+    
+    // entry "k" (zigzag order) of quantization table "id"
+    unsigned short quantizer(unsigned char id, int k)
+    {
+        if (_qTablesLength > 128)
+            return _qTables[id * 128 + 2 * k] << 8 | _qTables[id * 128 + 2 * k + 1];
+        return _qTables[(id & 3) * 64 + k];
+    }
+    
+    // the table from the frame's DHT segment, or the standard one
+    // if the frame doesn't define it
+    JpegHuffmanTable const& huffmanTable(int tableClass, int id)
+    {
+        if (_huffmanTableMask & (1 << (tableClass * 4 + id)))
+            return _huffmanTables[tableClass][id];
+        return jpegStandardHuffmanTable(tableClass, id);
+    }
+    bool hasHuffmanTables() { return _huffmanTableMask != 0; }
     
     unsigned char const* quantizationTables(unsigned short& length)
     {
@@ -48,6 +82,15 @@ public:
         return _scandata;
     }
     
+    // the whole frame last passed to parse()
+    unsigned char const* frame(unsigned int& length)
+    {
+        length = _frameLength;
+        return _frame;
+    }
+    // offset of the SOS marker within frame(), the end of the tables
+    unsigned int sosOffset() { return _sosOffset; }
+    
 private:
     unsigned int scanJpegMarker(const unsigned char* data,
                                 unsigned int size,
@@ -58,6 +101,10 @@ private:
                          unsigned int size, unsigned int offset);
     int readDRI(const unsigned char* data,
                 unsigned int size, unsigned int* offset);
+    unsigned int readDHT(const unsigned char* data,
+                         unsigned int size, unsigned int offset);
+    int readSOS(const unsigned char* data,
+                unsigned int size, unsigned int offset);
     
 private:
     unsigned char _width;
@@ -70,9 +117,18 @@ private:
     unsigned short _qTablesLength;
     
     unsigned short _restartInterval;
+    unsigned short _frameWidth;
+    unsigned short _frameHeight;
+    
+    JpegComponent _components[3];
+    JpegHuffmanTable _huffmanTables[2][4];
+    unsigned int _huffmanTableMask;
     
     unsigned char* _scandata;
     unsigned int   _scandataLength;
+    unsigned char* _frame;
+    unsigned int   _frameLength;
+    unsigned int   _sosOffset;
 };
 
 #endif // _JPEG_FRAME_PARSER_HH_INCLUDED
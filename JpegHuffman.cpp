@@ -0,0 +1,367 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Baseline JPEG entropy coding: Huffman tables and bit-level I/O
+// Implementation
+
+#include <string.h>
+
+#include "JpegHuffman.hh"
+
+static JpegHuffmanTable const standardTables[2][2] = {
+    {
+        /* DC luminance */
+        { { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+          { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 } },
+        /* DC chrominance */
+        { { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+          { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 } }
+    },
+    {
+        /* AC luminance */
+        { { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+          { 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+            0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+            0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+            0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+            0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+            0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+            0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+            0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+            0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+            0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+            0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+            0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+            0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+            0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+            0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+            0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+            0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+            0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+            0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+            0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+            0xf9, 0xfa } },
+        /* AC chrominance */
+        { { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+          { 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+            0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+            0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+            0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+            0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+            0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+            0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+            0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+            0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+            0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+            0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+            0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+            0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+            0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+            0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+            0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+            0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+            0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+            0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+            0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+            0xf9, 0xfa } }
+    }
+};
+
+JpegHuffmanTable const& jpegStandardHuffmanTable(int tableClass, int id)
+{
+    return standardTables[tableClass ? 1 : 0][id ? 1 : 0];
+}
+
+unsigned char const jpegZigzagToNatural[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/* ITU-T T.81 Annex K.1, natural order */
+static unsigned char const lumaQuantizer[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static unsigned char const chromaQuantizer[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+/* RFC 2435 Appendix A */
+void jpegMakeQuantizationTables(int q, unsigned char* tables)
+{
+    int factor = q;
+    if (q < 1) factor = 1;
+    if (q > 99) factor = 99;
+    if (factor < 50)
+        q = 5000 / factor;
+    else
+        q = 200 - factor * 2;
+
+    for (int i = 0; i < 64; i++) {
+        int lq = (lumaQuantizer[jpegZigzagToNatural[i]] * q + 50) / 100;
+        int cq = (chromaQuantizer[jpegZigzagToNatural[i]] * q + 50) / 100;
+        tables[i] = lq < 1 ? 1 : (lq > 255 ? 255 : lq);
+        tables[64 + i] = cq < 1 ? 1 : (cq > 255 ? 255 : cq);
+    }
+}
+
+JpegBitReader::JpegBitReader(unsigned char const* data, unsigned int size) :
+    _data(data), _size(size), _pos(0), _bits(0), _bitCount(0),
+    _markerHit(false)
+{
+}
+
+void JpegBitReader::reset(unsigned char const* data, unsigned int size)
+{
+    _data = data;
+    _size = size;
+    _pos = 0;
+    _bits = 0;
+    _bitCount = 0;
+    _markerHit = false;
+}
+
+void JpegBitReader::fill()
+{
+    while (_bitCount <= 56) {
+        unsigned int b = 0;
+        if (!_markerHit) {
+            if (_pos >= _size) {
+                _markerHit = true;
+            } else if (_data[_pos] != 0xFF) {
+                b = _data[_pos++];
+            } else if (_pos + 1 < _size && _data[_pos + 1] == 0x00) {
+                b = 0xFF;
+                _pos += 2;
+            } else {
+                /* a marker: feed zeros until restart() */
+                _markerHit = true;
+            }
+        }
+        _bits = (_bits << 8) | b;
+        _bitCount += 8;
+    }
+}
+
+int JpegBitReader::restart()
+{
+    _bits = 0;
+    _bitCount = 0;
+    /* fill() stops right in front of the next marker */
+    while (_pos + 1 < _size) {
+        if (_data[_pos] == 0xFF && _data[_pos + 1] >= 0xD0
+            && _data[_pos + 1] <= 0xD7) {
+            _pos += 2;
+            _markerHit = false;
+            return 0;
+        }
+        if (_data[_pos] == 0xFF && _data[_pos + 1] != 0x00
+            && _data[_pos + 1] != 0xFF)
+            break; /* some other marker, e.g. EOI */
+        _pos++;
+    }
+    _markerHit = true;
+    return -1;
+}
+
+int JpegHuffmanDecoder::build(JpegHuffmanTable const& table)
+{
+    unsigned int code = 0, k = 0;
+
+    memset(_lookup, 0, sizeof(_lookup));
+    for (int len = 1; len <= 16; len++) {
+        _valOffset[len] = (int)k - (int)code;
+        for (int i = 0; i < table.bits[len - 1]; i++) {
+            if (k >= 256)
+                return -1;
+            _vals[k] = table.vals[k];
+            if (len <= LOOKAHEAD) {
+                int shift = LOOKAHEAD - len;
+                for (int j = 0; j < (1 << shift); j++)
+                    _lookup[(code << shift) | j] = (len << 8) | table.vals[k];
+            }
+            code++;
+            k++;
+        }
+        /* largest code of this length, -1 if none */
+        _maxCode[len] = table.bits[len - 1] ? (int)code - 1 : -1;
+        if (code > (1u << len))
+            return -1;
+        code <<= 1;
+    }
+    _maxCode[17] = 0x7fffffff; /* sentinel */
+    return 0;
+}
+
+int JpegHuffmanDecoder::decodeSlow(JpegBitReader& reader)
+{
+    int bits = reader.peekBits(16);
+    for (int len = LOOKAHEAD + 1; len <= 16; len++) {
+        int code = bits >> (16 - len);
+        if (_maxCode[len] >= 0 && code <= _maxCode[len]) {
+            reader.skipBits(len);
+            return _vals[(_valOffset[len] + code) & 0xFF];
+        }
+    }
+    /* corrupt data: consume a bit so that callers always make progress */
+    reader.skipBits(1);
+    return 0;
+}
+
+int JpegHuffmanEncoder::build(JpegHuffmanTable const& table)
+{
+    unsigned int code = 0, k = 0;
+
+    memset(_size, 0, sizeof(_size));
+    memset(_code, 0, sizeof(_code));
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < table.bits[len - 1]; i++) {
+            if (k >= 256)
+                return -1;
+            _code[table.vals[k]] = code;
+            _size[table.vals[k]] = len;
+            code++;
+            k++;
+        }
+        if (code > (1u << len))
+            return -1;
+        code <<= 1;
+    }
+    return 0;
+}
+
+int jpegDecodeBlock(JpegBitReader& reader, JpegHuffmanDecoder& dc,
+                    JpegHuffmanDecoder& ac, short* coef, int& dcPred)
+{
+    memset(coef, 0, 64 * sizeof(short));
+
+    int s = dc.decode(reader);
+    if (s > 11)
+        return -1;
+    dcPred += reader.receiveExtend(s);
+    coef[0] = (short)dcPred;
+
+    for (int k = 1; k < 64; k++) {
+        int rs = ac.decode(reader);
+        int r = rs >> 4;
+        s = rs & 15;
+        if (s == 0) {
+            if (r != 15)
+                break; /* EOB */
+            k += 15;
+            continue;
+        }
+        k += r;
+        if (k > 63)
+            return -1;
+        coef[k] = (short)reader.receiveExtend(s);
+    }
+    return 0;
+}
+
+int jpegDecodeBlockDC(JpegBitReader& reader, JpegHuffmanDecoder& dc,
+                      JpegHuffmanDecoder& ac, int& dcPred)
+{
+    int s = dc.decode(reader);
+    if (s > 11)
+        return -1;
+    dcPred += reader.receiveExtend(s);
+
+    for (int k = 1; k < 64; k++) {
+        int rs = ac.decode(reader);
+        s = rs & 15;
+        if (s == 0) {
+            if ((rs >> 4) != 15)
+                break;
+            k += 15;
+            continue;
+        }
+        k += rs >> 4;
+        reader.skipBits(s);
+    }
+    return 0;
+}
+
+static inline int magnitudeBits(int v)
+{
+    if (v < 0) v = -v;
+    return v ? 32 - __builtin_clz((unsigned int)v) : 0;
+}
+
+void jpegEncodeBlock(JpegBitWriter& writer, JpegHuffmanEncoder const& dc,
+                     JpegHuffmanEncoder const& ac, short const* coef,
+                     int& dcPred)
+{
+    int diff = coef[0] - dcPred;
+    dcPred = coef[0];
+    int s = magnitudeBits(diff);
+    dc.put(writer, s, diff < 0 ? diff - 1 : diff, s);
+
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+        int v = coef[k];
+        if (v == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            ac.put(writer, 0xF0); /* ZRL */
+            run -= 16;
+        }
+        s = magnitudeBits(v);
+        ac.put(writer, (run << 4) | s, v < 0 ? v - 1 : v, s);
+        run = 0;
+    }
+    if (run > 0)
+        ac.put(writer, 0x00); /* EOB */
+}
+
+void jpegWriteDHT(std::vector<unsigned char>& out, int tableClass, int id,
+                  JpegHuffmanTable const& table)
+{
+    unsigned int count = 0;
+    for (int i = 0; i < 16; i++)
+        count += table.bits[i];
+    unsigned int length = 2 + 1 + 16 + count;
+
+    out.push_back(0xFF);
+    out.push_back(0xC4);
+    out.push_back(length >> 8);
+    out.push_back(length & 0xFF);
+    out.push_back((tableClass << 4) | id);
+    out.insert(out.end(), table.bits, table.bits + 16);
+    out.insert(out.end(), table.vals, table.vals + count);
+}
@@ -0,0 +1,198 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Baseline JPEG entropy coding: Huffman tables and bit-level I/O
+// C++ header
+
+#ifndef _JPEG_HUFFMAN_HH_INCLUDED
+#define _JPEG_HUFFMAN_HH_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+
+// A Huffman table as carried in a DHT segment
+struct JpegHuffmanTable
+{
+    unsigned char bits[16];   // number of codes of length 1..16
+    unsigned char vals[256];  // symbols in order of increasing code length
+};
+
+enum {
+    HUFFMAN_DC = 0,
+    HUFFMAN_AC = 1
+};
+
+// The tables from ITU-T T.81 Annex K.3, which RFC 2435 receivers assume
+// for every frame (MJPEG webcams usually leave out the DHT segment)
+JpegHuffmanTable const& jpegStandardHuffmanTable(int tableClass, int id);
+
+// Natural-order index of the k-th coefficient in zigzag order
+extern unsigned char const jpegZigzagToNatural[64];
+
+// Fills "tables" (2 x 64 bytes, zigzag order) with the luminance and
+// chrominance quantization tables RFC 2435 receivers derive from "q" (1..99)
+void jpegMakeQuantizationTables(int q, unsigned char* tables);
+
+class JpegBitReader
+{
+public:
+    JpegBitReader(unsigned char const* data = 0, unsigned int size = 0);
+    void reset(unsigned char const* data, unsigned int size);
+
+    int getBits(int n)
+    {
+        if (_bitCount < n) fill();
+        _bitCount -= n;
+        return (int)((_bits >> _bitCount) & ((1u << n) - 1));
+    }
+    int peekBits(int n)
+    {
+        if (_bitCount < n) fill();
+        return (int)((_bits >> (_bitCount - n)) & ((1u << n) - 1));
+    }
+    void skipBits(int n)
+    {
+        if (_bitCount < n) fill();
+        _bitCount -= n;
+    }
+    // Reads an "s"-bit magnitude and sign-extends it (T.81 F.2.2.1)
+    int receiveExtend(int s)
+    {
+        if (s == 0) return 0;
+        int v = getBits(s);
+        return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+    }
+
+    // Drops the padding bits at the end of a restart interval and steps
+    // past the following RSTn marker.  Returns -1 if there is none.
+    int restart();
+    // Offset of the first byte not yet loaded into the bit buffer
+    unsigned int position() const { return _pos; }
+    // True once the reader ran into a marker or the end of the data
+    bool exhausted() const { return _markerHit; }
+
+private:
+    void fill();
+
+private:
+    unsigned char const* _data;
+    unsigned int _size;
+    unsigned int _pos;
+    uint64_t _bits;
+    int _bitCount;
+    bool _markerHit;
+};
+
+class JpegBitWriter
+{
+public:
+    JpegBitWriter(std::vector<unsigned char>& out) : _out(out), _bits(0), _bitCount(0) {}
+
+    void putBits(unsigned int code, int size)
+    {
+        _bits = (_bits << size) | (code & ((1u << size) - 1));
+        _bitCount += size;
+        while (_bitCount >= 8) {
+            _bitCount -= 8;
+            unsigned char b = (unsigned char)(_bits >> _bitCount);
+            _out.push_back(b);
+            if (b == 0xFF) _out.push_back(0x00); // byte stuffing
+        }
+    }
+    // Pads the last byte with 1-bits
+    void flush()
+    {
+        if (_bitCount > 0) putBits(0x7F, 8 - _bitCount);
+        _bits = 0;
+    }
+    // Ends the current restart interval with marker RSTn (n = 0..7)
+    void restart(int n)
+    {
+        flush();
+        _out.push_back(0xFF);
+        _out.push_back((unsigned char)(0xD0 + (n & 7)));
+    }
+
+private:
+    std::vector<unsigned char>& _out;
+    uint64_t _bits;
+    int _bitCount;
+};
+
+class JpegHuffmanDecoder
+{
+public:
+    int build(JpegHuffmanTable const& table);
+    int decode(JpegBitReader& reader)
+    {
+        int look = _lookup[reader.peekBits(LOOKAHEAD)];
+        if (look != 0) {
+            reader.skipBits(look >> 8);
+            return look & 0xFF;
+        }
+        return decodeSlow(reader);
+    }
+
+private:
+    int decodeSlow(JpegBitReader& reader);
+
+private:
+    enum { LOOKAHEAD = 9 };
+    unsigned short _lookup[1 << LOOKAHEAD]; // (length << 8) | symbol
+    int _maxCode[18];
+    int _valOffset[17];
+    unsigned char _vals[256];
+};
+
+class JpegHuffmanEncoder
+{
+public:
+    int build(JpegHuffmanTable const& table);
+    void put(JpegBitWriter& writer, int symbol) const
+    {
+        writer.putBits(_code[symbol], _size[symbol]);
+    }
+    // The code for "symbol" followed by the "s" low bits of "bits", in a
+    // single putBits() (at most 16 + 11 bits)
+    void put(JpegBitWriter& writer, int symbol, unsigned int bits, int s) const
+    {
+        writer.putBits((_code[symbol] << s) | (bits & ((1u << s) - 1)),
+                       _size[symbol] + s);
+    }
+    bool hasSymbol(int symbol) const { return _size[symbol] != 0; }
+
+private:
+    unsigned short _code[256];
+    unsigned char _size[256];
+};
+
+// Block coding; "coef" holds the 64 quantized coefficients in zigzag
+// order and "dcPred" the previous DC value of the same component.
+int jpegDecodeBlock(JpegBitReader& reader, JpegHuffmanDecoder& dc,
+                    JpegHuffmanDecoder& ac, short* coef, int& dcPred);
+// Like jpegDecodeBlock(), but only the DC coefficient is kept; the AC
+// symbols are decoded just far enough to skip them.
+int jpegDecodeBlockDC(JpegBitReader& reader, JpegHuffmanDecoder& dc,
+                      JpegHuffmanDecoder& ac, int& dcPred);
+void jpegEncodeBlock(JpegBitWriter& writer, JpegHuffmanEncoder const& dc,
+                     JpegHuffmanEncoder const& ac, short const* coef,
+                     int& dcPred);
+
+// Appends a DHT segment holding "table" to "out"
+void jpegWriteDHT(std::vector<unsigned char>& out, int tableClass, int id,
+                  JpegHuffmanTable const& table);
+
+#endif // _JPEG_HUFFMAN_HH_INCLUDED
@@ -0,0 +1,155 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// MCU-by-MCU entropy decoding of a parsed baseline JPEG scan
+// Implementation
+
+#include <string.h>
+
+#include "JpegScanDecoder.hh"
+
+JpegScanDecoder::JpegScanDecoder() :
+    _scandata(NULL), _scandataLength(0),
+    _mcusPerRow(0), _mcuRows(0), _blocksPerMcu(0),
+    _restartInterval(0), _mcusToGo(0), _seekInterval(0), _seekOffset(0)
+{
+    memset(_pred, 0, sizeof(_pred));
+}
+
+int JpegScanDecoder::init(JpegFrameParser& parser)
+{
+    JpegComponent const* comps = parser.components();
+    unsigned int hmax = 1, vmax = 1;
+    unsigned int built = 0;
+    int c;
+
+    _scandata = parser.scandata(_scandataLength);
+    if (_scandata == NULL || parser.frameWidth() == 0 || parser.frameHeight() == 0)
+        return -1;
+
+    for (c = 0; c < 3; c++) {
+        if (comps[c].h == 0 || comps[c].v == 0)
+            return -1;
+        if (comps[c].h > hmax) hmax = comps[c].h;
+        if (comps[c].v > vmax) vmax = comps[c].v;
+    }
+    _mcusPerRow = (parser.frameWidth() + 8 * hmax - 1) / (8 * hmax);
+    _mcuRows = (parser.frameHeight() + 8 * vmax - 1) / (8 * vmax);
+
+    _blocksPerMcu = 0;
+    for (c = 0; c < 3; c++) {
+        for (unsigned int y = 0; y < comps[c].v; y++) {
+            for (unsigned int x = 0; x < comps[c].h; x++) {
+                if (_blocksPerMcu == MAX_BLOCKS_IN_MCU)
+                    return -1;
+                _blockComp[_blocksPerMcu] = c;
+                _blockX[_blocksPerMcu] = x;
+                _blockY[_blocksPerMcu] = y;
+                _blocksPerMcu++;
+            }
+        }
+        _td[c] = comps[c].td;
+        _ta[c] = comps[c].ta;
+        /* build each referenced table once */
+        if (!(built & (1 << _td[c]))) {
+            if (_dc[_td[c]].build(parser.huffmanTable(HUFFMAN_DC, _td[c])) != 0)
+                return -1;
+            built |= 1 << _td[c];
+        }
+        if (!(built & (16 << _ta[c]))) {
+            if (_ac[_ta[c]].build(parser.huffmanTable(HUFFMAN_AC, _ta[c])) != 0)
+                return -1;
+            built |= 16 << _ta[c];
+        }
+    }
+
+    _reader.reset(_scandata, _scandataLength);
+    memset(_pred, 0, sizeof(_pred));
+    _restartInterval = parser.restartInterval();
+    _mcusToGo = _restartInterval;
+    _seekInterval = 0;
+    _seekOffset = 0;
+    return 0;
+}
+
+int JpegScanDecoder::seekRestartInterval(unsigned int n)
+{
+    if (_restartInterval == 0)
+        return -1;
+    if (n < _seekInterval) {
+        _seekInterval = 0;
+        _seekOffset = 0;
+    }
+    unsigned int pos = _seekOffset;
+    while (_seekInterval < n) {
+        /* 0xFF in entropy-coded data is always stuffed, so the next
+         * FF Dn is the next interval's start */
+        unsigned char const* p = (unsigned char const*)
+            memchr(_scandata + pos, 0xFF, _scandataLength - pos);
+        if (p == NULL || p + 1 >= _scandata + _scandataLength)
+            return -1;
+        pos = p - _scandata + 1;
+        if (*(p + 1) >= 0xD0 && *(p + 1) <= 0xD7) {
+            pos++;
+            _seekInterval++;
+        }
+    }
+    _seekOffset = pos;
+    _reader.reset(_scandata + pos, _scandataLength - pos);
+    memset(_pred, 0, sizeof(_pred));
+    _mcusToGo = _restartInterval;
+    return 0;
+}
+
+int JpegScanDecoder::startMCU()
+{
+    if (_restartInterval == 0)
+        return 0;
+    if (_mcusToGo == 0) {
+        if (_reader.restart() != 0)
+            return -1;
+        memset(_pred, 0, sizeof(_pred));
+        _mcusToGo = _restartInterval;
+    }
+    _mcusToGo--;
+    return 0;
+}
+
+int JpegScanDecoder::decodeMCU(short* coef)
+{
+    if (startMCU() != 0)
+        return -1;
+    for (unsigned int b = 0; b < _blocksPerMcu; b++) {
+        int c = _blockComp[b];
+        if (jpegDecodeBlock(_reader, _dc[_td[c]], _ac[_ta[c]],
+                            coef + 64 * b, _pred[c]) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int JpegScanDecoder::decodeMCUDC(short* dc)
+{
+    if (startMCU() != 0)
+        return -1;
+    for (unsigned int b = 0; b < _blocksPerMcu; b++) {
+        int c = _blockComp[b];
+        if (jpegDecodeBlockDC(_reader, _dc[_td[c]], _ac[_ta[c]], _pred[c]) != 0)
+            return -1;
+        dc[b] = (short)_pred[c];
+    }
+    return 0;
+}
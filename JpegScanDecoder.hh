@@ -0,0 +1,84 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// MCU-by-MCU entropy decoding of a parsed baseline JPEG scan
+// C++ header
+
+#ifndef _JPEG_SCAN_DECODER_HH_INCLUDED
+#define _JPEG_SCAN_DECODER_HH_INCLUDED
+
+#include "JpegFrameParser.hh"
+#include "JpegHuffman.hh"
+
+#define MAX_BLOCKS_IN_MCU 10
+
+class JpegScanDecoder
+{
+public:
+    JpegScanDecoder();
+
+    // Prepares decoding of the scan "parser" has just parsed; the scan data
+    // must stay valid until the last decodeMCU() call.
+    int init(JpegFrameParser& parser);
+
+    unsigned int mcusPerRow() const   { return _mcusPerRow; }
+    unsigned int mcuRows() const      { return _mcuRows; }
+    unsigned int blocksPerMcu() const { return _blocksPerMcu; }
+    // component (scan order) of the b-th block of an MCU, and the block's
+    // position inside the MCU in units of that component's blocks
+    int blockComponent(int b) const   { return _blockComp[b]; }
+    int blockX(int b) const           { return _blockX[b]; }
+    int blockY(int b) const           { return _blockY[b]; }
+
+    // Decodes the next MCU into "coef" (blocksPerMcu() x 64 coefficients,
+    // zigzag order, DC as absolute value).  Restart markers are handled
+    // transparently.
+    int decodeMCU(short* coef);
+    // Decodes the next MCU but keeps only the DC values (blocksPerMcu()
+    // entries), skipping over the AC coefficients.
+    int decodeMCUDC(short* dc);
+    // Continues at the start of restart interval "n" (counted from 0),
+    // stepping over the data in between by its RSTn markers alone.  Only
+    // for scans with restart intervals; cheapest when seeking forward.
+    int seekRestartInterval(unsigned int n);
+
+private:
+    int startMCU();
+
+private:
+    JpegBitReader _reader;
+    JpegHuffmanDecoder _dc[4];
+    JpegHuffmanDecoder _ac[4];
+    unsigned char _td[3];
+    unsigned char _ta[3];
+    int _pred[3];
+
+    unsigned char const* _scandata;
+    unsigned int _scandataLength;
+    unsigned int _mcusPerRow;
+    unsigned int _mcuRows;
+    unsigned int _blocksPerMcu;
+    unsigned char _blockComp[MAX_BLOCKS_IN_MCU];
+    unsigned char _blockX[MAX_BLOCKS_IN_MCU];
+    unsigned char _blockY[MAX_BLOCKS_IN_MCU];
+
+    unsigned int _restartInterval;
+    unsigned int _mcusToGo;
+    unsigned int _seekInterval; // the interval starting at _seekOffset
+    unsigned int _seekOffset;
+};
+
+#endif // _JPEG_SCAN_DECODER_HH_INCLUDED
@@ -0,0 +1,177 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Compressed-domain requantization and cropping of baseline JPEG scans
+// Implementation
+
+#include <string.h>
+
+#include "JpegTranscoder.hh"
+
+JpegTranscoder::JpegTranscoder() :
+    _quality(0), _cropX(0), _cropY(0), _cropWidth(0), _cropHeight(0),
+    _type(0), _width(0), _height(0), _restartInterval(0)
+{
+    for (int i = 0; i < 2; i++) {
+        _dc[i].build(jpegStandardHuffmanTable(HUFFMAN_DC, i));
+        _ac[i].build(jpegStandardHuffmanTable(HUFFMAN_AC, i));
+    }
+    memset(_qTables, 0, sizeof(_qTables));
+    setQuality(50);
+}
+
+void JpegTranscoder::setQuality(int q)
+{
+    if (q <= 0) {
+        /* the frame's own tables win everywhere */
+        _quality = 0;
+        memset(_targetTables, 1, sizeof(_targetTables));
+        return;
+    }
+    if (q > 99) q = 99;
+    _quality = q;
+    jpegMakeQuantizationTables(q, _targetTables);
+}
+
+void JpegTranscoder::setCrop(unsigned int x, unsigned int y,
+                             unsigned int width, unsigned int height)
+{
+    _cropX = x;
+    _cropY = y;
+    _cropWidth = width;
+    _cropHeight = height;
+}
+
+int JpegTranscoder::transcode(JpegFrameParser& parser, std::vector<unsigned char>& out)
+{
+    JpegComponent const* comps = parser.components();
+    bool coarser = false;
+    int c, k;
+
+    /* RTP/JPEG carries one table for Y and one shared by Cb and Cr, so the
+     * chrominance table has to cover both of the frame's */
+    for (k = 0; k < 64; k++) {
+        unsigned int luma = _targetTables[k];
+        unsigned int chroma = _targetTables[64 + k];
+        for (c = 0; c < 3; c++) {
+            unsigned int q = parser.quantizer(comps[c].tq, k);
+            if (q == 0 || q > 255)
+                return -1;
+            _from[c][k] = q;
+            if (c == 0 && q > luma) luma = q;
+            if (c != 0 && q > chroma) chroma = q;
+        }
+        _qTables[k] = luma;
+        _qTables[64 + k] = chroma;
+        for (c = 0; c < 3; c++) {
+            _to[c][k] = c == 0 ? luma : chroma;
+            _reciprocal[c][k] = 0;
+            if (_to[c][k] != _from[c][k]) {
+                _reciprocal[c][k] = (uint32_t)((1u << 30) / (2 * _to[c][k]) + 1);
+                coarser = true;
+            }
+        }
+    }
+    if (!coarser && !cropping())
+        return 1;
+
+    if (_decoder.init(parser) != 0)
+        return -1;
+
+    /* the MCUs to keep: columns [x0, x1) of rows [y0, y1) */
+    unsigned int mcuWidth = 8, mcuHeight = 8;
+    for (c = 0; c < 3; c++) {
+        if (8u * comps[c].h > mcuWidth) mcuWidth = 8 * comps[c].h;
+        if (8u * comps[c].v > mcuHeight) mcuHeight = 8 * comps[c].v;
+    }
+    unsigned int mcusPerRow = _decoder.mcusPerRow();
+    unsigned int x0 = 0, x1 = mcusPerRow, y0 = 0, y1 = _decoder.mcuRows();
+    if (cropping()) {
+        x0 = _cropX / mcuWidth;
+        y0 = _cropY / mcuHeight;
+        if ((_cropX + _cropWidth + mcuWidth - 1) / mcuWidth < x1)
+            x1 = (_cropX + _cropWidth + mcuWidth - 1) / mcuWidth;
+        if ((_cropY + _cropHeight + mcuHeight - 1) / mcuHeight < y1)
+            y1 = (_cropY + _cropHeight + mcuHeight - 1) / mcuHeight;
+        if (x0 >= x1 || y0 >= y1)
+            return -1; /* the rectangle is outside the frame */
+    }
+    unsigned int frameInterval = parser.restartInterval();
+    unsigned int restartInterval = cropping() ? x1 - x0 : frameInterval;
+    unsigned int right = x1 * mcuWidth < parser.frameWidth()
+        ? x1 * mcuWidth : parser.frameWidth();
+    unsigned int bottom = y1 * mcuHeight < parser.frameHeight()
+        ? y1 * mcuHeight : parser.frameHeight();
+    _width = (right - x0 * mcuWidth + 7) / 8;
+    _height = (bottom - y0 * mcuHeight + 7) / 8;
+    _type = (parser.type() & 63) | (restartInterval != 0 ? 64 : 0);
+    _restartInterval = restartInterval;
+
+    unsigned int length;
+    parser.scandata(length);
+    out.clear();
+    out.reserve(length);
+    JpegBitWriter writer(out);
+
+    short coef[MAX_BLOCKS_IN_MCU * 64];
+    int pred[3] = { 0, 0, 0 };
+    unsigned int next = 0; /* the MCU the decoder reads next */
+    unsigned int written = 0;
+    int marker = 0;
+
+    for (unsigned int row = y0; row < y1; row++) {
+        unsigned int first = row * mcusPerRow + x0;
+        if (frameInterval != 0 && first / frameInterval * frameInterval > next) {
+            if (_decoder.seekRestartInterval(first / frameInterval) != 0)
+                return -1;
+            next = first / frameInterval * frameInterval;
+        }
+        /* the MCUs left of the rectangle only carry DC predictions */
+        for (; next < first; next++) {
+            if (_decoder.decodeMCUDC(coef) != 0)
+                return -1;
+        }
+        for (unsigned int m = x0; m < x1; m++, next++) {
+            if (restartInterval != 0 && written != 0
+                && written % restartInterval == 0) {
+                writer.restart(marker++);
+                memset(pred, 0, sizeof(pred));
+            }
+            written++;
+            if (_decoder.decodeMCU(coef) != 0)
+                return -1;
+            for (unsigned int b = 0; b < _decoder.blocksPerMcu(); b++) {
+                c = _decoder.blockComponent(b);
+                short* block = coef + 64 * b;
+                for (k = 0; k < 64; k++) {
+                    int v = block[k];
+                    if (v == 0 || _reciprocal[c][k] == 0)
+                        continue;
+                    /* v * from / to, rounded to nearest with halves away
+                     * from zero: (2|v| from + to) / (2 to).  The numerator
+                     * stays below 2^21 and the divisor below 2^9, so
+                     * multiplying by ceil(2^30 / (2 to)) divides exactly. */
+                    uint64_t num = 2 * (uint64_t)(v < 0 ? -v : v) * _from[c][k] + _to[c][k];
+                    int q = (int)((num * _reciprocal[c][k]) >> 30);
+                    block[k] = (short)(v < 0 ? -q : q);
+                }
+                jpegEncodeBlock(writer, _dc[c != 0], _ac[c != 0], block, pred[c]);
+            }
+        }
+    }
+    writer.flush();
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Compressed-domain requantization and cropping of baseline JPEG scans
+// C++ header
+
+#ifndef _JPEG_TRANSCODER_HH_INCLUDED
+#define _JPEG_TRANSCODER_HH_INCLUDED
+
+#include "JpegFrameParser.hh"
+#include "JpegScanDecoder.hh"
+
+#include <vector>
+
+// Lowers the bit rate of a frame by Huffman-decoding its coefficients,
+// dividing them down to coarser quantization tables and Huffman-coding
+// them again, and/or cuts out the MCUs covering a rectangle; there is no
+// IDCT and no pixel data involved.
+class JpegTranscoder
+{
+public:
+    JpegTranscoder();
+
+    // RFC 2435 Q factor (1..99) to requantize towards, 0 to keep the
+    // frame's tables.  No coefficient is quantized finer than in the
+    // source frame: each table entry becomes the larger of the frame's
+    // and the target's.
+    void setQuality(int q);
+    int quality() const { return _quality; }
+
+    // Keeps only the MCUs covering this rectangle (in pixels), which
+    // thereby grows to MCU boundaries; a zero width or height disables
+    // cropping.  Every MCU row of a cropped frame is a restart interval
+    // of its own, so its DC predictions start afresh at the left edge.
+    // In frames with restart intervals, the intervals holding nothing of
+    // the rectangle are skipped without being decoded.
+    void setCrop(unsigned int x, unsigned int y,
+                 unsigned int width, unsigned int height);
+    bool cropping() const { return _cropWidth != 0 && _cropHeight != 0; }
+
+    // Transcodes the scan "parser" has just parsed into "out" (entropy-
+    // coded data only, standard Huffman tables).  Returns 1, leaving "out"
+    // alone, if there is nothing to do: no cropping, and the frame is
+    // already quantized at least as coarsely as the target; -1 on error.
+    int transcode(JpegFrameParser& parser, std::vector<unsigned char>& out);
+
+    // RTP/JPEG header fields of the last transcoded frame: the luminance
+    // and chrominance tables (2 x 64 bytes, zigzag order), the size in
+    // units of 8 pixels and so on
+    unsigned char const* quantizationTables() const { return _qTables; }
+    unsigned char type() const { return _type; }
+    unsigned char width() const { return _width; }
+    unsigned char height() const { return _height; }
+    unsigned short restartInterval() const { return _restartInterval; }
+
+private:
+    int _quality;
+    unsigned char _targetTables[128];
+    unsigned char _qTables[128];
+    // per component, zigzag order: the frame's quantizer, the new one and
+    // the reciprocal of twice the new one (0: unchanged), see transcode()
+    unsigned short _from[3][64];
+    unsigned short _to[3][64];
+    uint32_t _reciprocal[3][64];
+    unsigned int _cropX;
+    unsigned int _cropY;
+    unsigned int _cropWidth;
+    unsigned int _cropHeight;
+    unsigned char _type;
+    unsigned char _width;
+    unsigned char _height;
+    unsigned short _restartInterval;
+    JpegScanDecoder _decoder;
+    JpegHuffmanEncoder _dc[2];
+    JpegHuffmanEncoder _ac[2];
+};
+
+#endif // _JPEG_TRANSCODER_HH_INCLUDED
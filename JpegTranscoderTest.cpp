@@ -0,0 +1,254 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// A test program that requantizes and crops JPEG frames with JpegTranscoder
+// and checks every coefficient of the result against the source frame's
+// main program
+
+#include "JpegEncoder.hh"
+#include "JpegFrameParser.hh"
+#include "JpegScanDecoder.hh"
+#include "JpegTranscoder.hh"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+char* progName;
+char const* fileName = "test.jpg";
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [-f <jpeg-file>]\n", progName);
+    exit(1);
+}
+
+struct Frame
+{
+    char const* name;
+    std::vector<unsigned char> jpeg;
+    JpegFrameParser parser;
+    std::vector<short> coefficients; // all MCUs, as JpegScanDecoder gives them
+    unsigned int mcusPerRow;
+    unsigned int mcuRows;
+    unsigned int blocksPerMcu;
+    int blockComponent[MAX_BLOCKS_IN_MCU];
+};
+
+// Parses the frame and decodes the coefficients of all its MCUs
+static int loadFrame(Frame& frame)
+{
+    if (frame.parser.parse(&frame.jpeg[0], frame.jpeg.size()) != 0)
+        return -1;
+    JpegScanDecoder decoder;
+    if (decoder.init(frame.parser) != 0)
+        return -1;
+    frame.mcusPerRow = decoder.mcusPerRow();
+    frame.mcuRows = decoder.mcuRows();
+    frame.blocksPerMcu = decoder.blocksPerMcu();
+    for (unsigned b = 0; b < frame.blocksPerMcu; b++)
+        frame.blockComponent[b] = decoder.blockComponent(b);
+    unsigned mcuSize = frame.blocksPerMcu*64;
+    frame.coefficients.resize(frame.mcusPerRow*frame.mcuRows*mcuSize);
+    for (unsigned m = 0; m < frame.mcusPerRow*frame.mcuRows; m++) {
+        if (decoder.decodeMCU(&frame.coefficients[m*mcuSize]) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// A busy synthetic picture: a smooth pattern with noise on it
+static void encodeFrame(Frame& frame, int type, unsigned width, unsigned height,
+                        unsigned restartInterval)
+{
+    std::vector<unsigned char> y(width*height), cb(width*height), cr(width*height);
+    srand(1);
+    for (unsigned j = 0; j < height; j++) {
+        for (unsigned i = 0; i < width; i++) {
+            y[j*width + i] = (unsigned char)(128 + 60*sin(i*0.05)*cos(j*0.03) + rand() % 20);
+            cb[j*width + i] = 100 + rand() % 30;
+            cr[j*width + i] = 150 + rand() % 30;
+        }
+    }
+    unsigned char const* planes[3] = { &y[0], &cb[0], &cr[0] };
+    unsigned chromaWidth = (width + 1)/2;
+    unsigned strides[3] = { width, chromaWidth, chromaWidth };
+    JpegEncoder encoder;
+    encoder.setQuality(90);
+    encoder.setRestartInterval(restartInterval);
+    encoder.encode(type, width, height, planes, strides, frame.jpeg);
+}
+
+// Transcodes "frame" and compares the result, MCU by MCU, with the source
+// coefficients divided down to the new tables.  Returns the number of
+// mismatches, or -1 if the result does not decode.
+static long check(Frame& frame, int quality, unsigned cropX, unsigned cropY,
+                  unsigned cropWidth, unsigned cropHeight)
+{
+    JpegTranscoder transcoder;
+    transcoder.setQuality(quality);
+    transcoder.setCrop(cropX, cropY, cropWidth, cropHeight);
+    std::vector<unsigned char> scan;
+    int result = transcoder.transcode(frame.parser, scan);
+    if (result != 0) {
+        printf("  transcode() returned %d\n", result);
+        return -1;
+    }
+
+    // the expected rectangle of MCUs
+    JpegComponent const* comps = frame.parser.components();
+    unsigned mcuWidth = 8*comps[0].h, mcuHeight = 8*comps[0].v;
+    unsigned x0 = 0, y0 = 0, x1 = frame.mcusPerRow, y1 = frame.mcuRows;
+    if (transcoder.cropping()) {
+        x0 = cropX/mcuWidth;
+        y0 = cropY/mcuHeight;
+        x1 = (cropX + cropWidth + mcuWidth - 1)/mcuWidth;
+        y1 = (cropY + cropHeight + mcuHeight - 1)/mcuHeight;
+        if (x0 >= frame.mcusPerRow) x0 = frame.mcusPerRow - 1;
+        if (y0 >= frame.mcuRows) y0 = frame.mcuRows - 1;
+        if (x1 > frame.mcusPerRow) x1 = frame.mcusPerRow;
+        if (y1 > frame.mcuRows) y1 = frame.mcuRows;
+    }
+
+    // frame the scan with headers of the same layout to decode it
+    JpegEncoder encoder;
+    encoder.setRestartInterval(transcoder.restartInterval());
+    std::vector<unsigned char> jpeg;
+    encoder.writeHeaders(transcoder.type() & 1, transcoder.width()*8,
+                         transcoder.height()*8, jpeg);
+    jpeg.insert(jpeg.end(), scan.begin(), scan.end());
+    jpeg.push_back(0xFF);
+    jpeg.push_back(0xD9);
+    JpegFrameParser parser;
+    JpegScanDecoder decoder;
+    if (parser.parse(&jpeg[0], jpeg.size()) != 0 || decoder.init(parser) != 0) {
+        printf("  the result does not parse\n");
+        return -1;
+    }
+    if (decoder.mcusPerRow() != x1 - x0 || decoder.mcuRows() != y1 - y0) {
+        printf("  %ux%u MCUs, expected %ux%u\n", decoder.mcusPerRow(),
+               decoder.mcuRows(), x1 - x0, y1 - y0);
+        return -1;
+    }
+
+    unsigned char const* tables = transcoder.quantizationTables();
+    unsigned mcuSize = frame.blocksPerMcu*64;
+    std::vector<short> coef(mcuSize);
+    long mismatches = 0;
+    for (unsigned my = y0; my < y1; my++) {
+        for (unsigned mx = x0; mx < x1; mx++) {
+            if (decoder.decodeMCU(&coef[0]) != 0) {
+                printf("  MCU %u,%u does not decode\n", mx, my);
+                return -1;
+            }
+            short const* from = &frame.coefficients[(my*frame.mcusPerRow + mx)*mcuSize];
+            for (unsigned b = 0; b < frame.blocksPerMcu; b++) {
+                int c = frame.blockComponent[b];
+                for (int k = 0; k < 64; k++) {
+                    unsigned q = frame.parser.quantizer(comps[c].tq, k);
+                    unsigned newQ = tables[(c == 0 ? 0 : 64) + k];
+                    long expected = lround((double)from[b*64 + k]*q/newQ);
+                    if (coef[b*64 + k] != expected)
+                        mismatches++;
+                }
+            }
+        }
+    }
+    return mismatches;
+}
+
+int main(int argc, char** argv)
+{
+    progName = argv[0];
+    int opt;
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        switch (opt) {
+            case 'f':
+                fileName = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    // the camera frame, and synthetic ones of both types, with and without
+    // restart intervals, in sizes that are not a whole number of MCUs
+    Frame frames[5];
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL) {
+        perror(fileName);
+        return 1;
+    }
+    frames[0].name = fileName;
+    frames[0].jpeg.resize(1 << 22);
+    frames[0].jpeg.resize(fread(&frames[0].jpeg[0], 1, frames[0].jpeg.size(), file));
+    fclose(file);
+    frames[1].name = "4:2:2";
+    encodeFrame(frames[1], 0, 650, 490, 0);
+    frames[2].name = "4:2:2, restart interval 7";
+    encodeFrame(frames[2], 0, 650, 490, 7);
+    frames[3].name = "4:2:0";
+    encodeFrame(frames[3], 1, 650, 490, 0);
+    frames[4].name = "4:2:0, restart interval 41";
+    encodeFrame(frames[4], 1, 650, 490, 41);
+
+    // quality, then x, y, width, height of the crop (0: none)
+    static unsigned const cases[][5] = {
+        { 30,   0,   0,    0,    0 }, // requantization alone
+        {  0, 100, 100,  300,  200 },
+        {  0,   0,   0,   16,   16 }, // top left MCU
+        {  0, 600, 450,  500,  500 }, // over the bottom right edge
+        {  0,   0,   0, 4000, 4000 }, // all of it
+        {  0,  33,  17,    1,    1 }, // one pixel
+        { 40, 320, 240,  160,  120 }, // both
+    };
+    int failures = 0;
+    for (unsigned f = 0; f < sizeof(frames)/sizeof(frames[0]); f++) {
+        Frame& frame = frames[f];
+        if (loadFrame(frame) != 0) {
+            printf("FAILED: %s does not decode\n", frame.name);
+            return 1;
+        }
+        printf("%s: %ux%u, %ux%u MCUs\n", frame.name, frame.parser.frameWidth(),
+               frame.parser.frameHeight(), frame.mcusPerRow, frame.mcuRows);
+        for (unsigned c = 0; c < sizeof(cases)/sizeof(cases[0]); c++) {
+            unsigned const* t = cases[c];
+            long mismatches = check(frame, t[0], t[1], t[2], t[3], t[4]);
+            printf("  quality %2u, crop %u,%u %ux%u: %ld mismatches\n",
+                   t[0], t[1], t[2], t[3], t[4], mismatches);
+            if (mismatches != 0)
+                failures++;
+        }
+        // a target finer than the frame leaves nothing to do (the camera
+        // frame's tables may be finer still)
+        JpegTranscoder transcoder;
+        transcoder.setQuality(99);
+        std::vector<unsigned char> scan;
+        if (f != 0 && transcoder.transcode(frame.parser, scan) != 1) {
+            printf("  FAILED: requantizing to quality 99 did not leave the frame alone\n");
+            failures++;
+        }
+    }
+    if (failures != 0) {
+        printf("FAILED: %d cases\n", failures);
+        return 1;
+    }
+    return 0;
+}
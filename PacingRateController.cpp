@@ -0,0 +1,132 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Kernel pacing of the RTP socket, following the measured frame sizes
+// Implementation
+
+#include "PacingRateController.hh"
+#include "GroupsockHelper.hh"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <errno.h>
+
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE 47
+#endif
+
+#define PACING_UPDATE_INTERVAL 1000000 // microseconds
+// per packet: IPv4, UDP, RTP and RTP/JPEG main headers
+#define PACKET_OVERHEAD (20 + 8 + 12 + 8)
+#define TYPICAL_PAYLOAD 1400
+// per packet in the send buffer: the headers and the kernel's own
+// bookkeeping (the skb), which counts against SO_SNDBUF too
+#define PACKET_BUFFER_OVERHEAD 1024
+
+PacingRateController*
+PacingRateController::createNew(UsageEnvironment& env, int socketNum,
+                                WebcamJPEGDeviceSource* source,
+                                unsigned spreadPercent)
+{
+    if(spreadPercent == 0 || spreadPercent > 100) {
+        env.setResultMsg("The pacing spread must be 1..100 percent");
+        return NULL;
+    }
+    return new PacingRateController(env, socketNum, source, spreadPercent);
+}
+
+PacingRateController::PacingRateController(UsageEnvironment& env, int socketNum,
+                                           WebcamJPEGDeviceSource* source,
+                                           unsigned spreadPercent)
+  : Medium(env), fSocketNum(socketNum), fSource(source),
+    fSpreadPercent(spreadPercent), fRate(0), fUpdateTask(NULL),
+    fWindowIndex(0), fWarnedFlowLimit(false)
+{
+    memset(fLargestFrames, 0, sizeof(fLargestFrames));
+
+    // room for a frame waiting in fq and the next one behind it
+    unsigned limit = fSource->frameSizeLimit();
+    unsigned wanted = 2*(limit + (limit/TYPICAL_PAYLOAD + 1)*PACKET_BUFFER_OVERHEAD);
+    unsigned got = increaseSendBufferTo(env, socketNum, wanted);
+    if(got < wanted)
+        env << "Pacing: the RTP send buffer is only " << got << " bytes, "
+            << wanted << " wanted; raise net.core.wmem_max, or large frames"
+            << " will lose packets\n";
+    update();
+}
+
+PacingRateController::~PacingRateController()
+{
+    envir().taskScheduler().unscheduleDelayedTask(fUpdateTask);
+    setRate(0);
+}
+
+void PacingRateController::updateTask(void* clientData)
+{
+    ((PacingRateController*)clientData)->update();
+}
+
+void PacingRateController::update()
+{
+    fUpdateTask = NULL;
+    fLargestFrames[fWindowIndex] = fSource->takeLargestFrameSize();
+    fWindowIndex = (fWindowIndex + 1) % PACING_WINDOW;
+    unsigned frameSize = 0;
+    for(unsigned i = 0; i < PACING_WINDOW; i++) {
+        if(fLargestFrames[i] > frameSize)
+            frameSize = fLargestFrames[i];
+    }
+    if(frameSize == 0) // nothing delivered yet
+        frameSize = fSource->averageFrameSize();
+    if(frameSize/TYPICAL_PAYLOAD + 1 > FQ_FLOW_LIMIT && !fWarnedFlowLimit) {
+        fWarnedFlowLimit = true;
+        envir() << "Pacing: frames of " << frameSize/TYPICAL_PAYLOAD + 1
+                << " packets exceed fq's default flow_limit of " << FQ_FLOW_LIMIT
+                << "; unless it was raised (tc qdisc change dev <if> root fq"
+                << " flow_limit <packets>), fq drops the rest of each frame\n";
+    }
+    if(frameSize != 0) {
+        unsigned long long wireSize = frameSize
+            + (frameSize/TYPICAL_PAYLOAD + 1)*PACKET_OVERHEAD;
+        unsigned long long rate = wireSize*1000000ULL*100
+            / ((unsigned long long)fSource->timePerFrame()*fSpreadPercent);
+        if(rate > 0xffffffffULL)
+            rate = 0xffffffffULL;
+
+        // follow increases right away, decreases only past some jitter
+        if(fRate == 0 || rate > fRate || rate < fRate - fRate/20) {
+            if(setRate((unsigned)rate) != 0) {
+                envir() << "Pacing disabled: " << envir().getResultMsg() << "\n";
+                return;
+            }
+        }
+    }
+    fUpdateTask = envir().taskScheduler().scheduleDelayedTask(PACING_UPDATE_INTERVAL,
+                                                              updateTask, this);
+}
+
+int PacingRateController::setRate(unsigned rate)
+{
+    // ~0U is the kernel's "unlimited"
+    unsigned value = rate != 0 ? rate : ~0U;
+    if(setsockopt(fSocketNum, SOL_SOCKET, SO_MAX_PACING_RATE,
+                  &value, sizeof(value)) != 0) {
+        envir().setResultErrMsg("SO_MAX_PACING_RATE failed: ");
+        return -1;
+    }
+    fRate = rate;
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Kernel pacing of the RTP socket, following the measured frame sizes
+// C++ header
+
+#ifndef _PACING_RATE_CONTROLLER_HH
+#define _PACING_RATE_CONTROLLER_HH
+
+#include "Media.hh"
+#include "WebcamJPEGDeviceSource.hh"
+
+#define PACING_WINDOW 5     // update intervals the largest frame is taken from
+#define FQ_FLOW_LIMIT 100   // fq's default flow_limit, in packets
+
+// Caps the RTP socket's send rate (SO_MAX_PACING_RATE) so that a frame
+// takes at most "spreadPercent" of the frame interval to go out, instead
+// of leaving in one burst.  The rate follows the largest frame of the last
+// few seconds, so the frames near that size don't overrun their interval
+// and pile up in the queue.
+// A whole frame is handed to the socket at once and waits in fq, counted
+// against the socket's send buffer, which is raised here to two of the
+// largest possible frames: the socket is non-blocking, and a full buffer
+// loses packets.  fq also drops the packets of a flow beyond its
+// "flow_limit" (100 by default, about 140 KB), so that must be raised
+// above the packets of the largest frame, e.g.
+//   tc qdisc add dev <if> root fq flow_limit 1000
+// A warning is logged when a frame has more packets than the default.
+// The kernel only paces UDP sockets under fq; elsewhere the setting has no
+// effect.
+class PacingRateController: public Medium {
+public:
+    static PacingRateController* createNew(UsageEnvironment& env, int socketNum,
+                                           WebcamJPEGDeviceSource* source,
+                                           unsigned spreadPercent);
+
+    unsigned pacingRate() const { return fRate; }
+    // bytes per second, 0 while unpaced
+
+protected:
+    PacingRateController(UsageEnvironment& env, int socketNum,
+                         WebcamJPEGDeviceSource* source,
+                         unsigned spreadPercent);
+    // called only by createNew()
+    virtual ~PacingRateController();
+
+private:
+    static void updateTask(void* clientData);
+    void update();
+    int setRate(unsigned rate);
+
+private:
+    int fSocketNum;
+    WebcamJPEGDeviceSource* fSource;
+    unsigned fSpreadPercent;
+    unsigned fRate;
+    TaskToken fUpdateTask;
+    unsigned fLargestFrames[PACING_WINDOW]; // per update interval
+    unsigned fWindowIndex;
+    bool fWarnedFlowLimit;
+};
+
+#endif // _PACING_RATE_CONTROLLER_HH
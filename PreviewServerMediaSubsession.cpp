@@ -0,0 +1,63 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-demand RTSP subsession serving the webcam's low-resolution preview
+// Implementation
+
+#include "PreviewServerMediaSubsession.hh"
+#include "JPEGPreviewSource.hh"
+#include "JPEGVideoRTPSink.hh"
+
+PreviewServerMediaSubsession*
+PreviewServerMediaSubsession::createNew(UsageEnvironment& env,
+                                        WebcamJPEGDeviceSource* input,
+                                        unsigned timePerFrame,
+                                        FrameWorkerPool* pool)
+{
+    return new PreviewServerMediaSubsession(env, input, timePerFrame, pool);
+}
+
+// All preview clients share one source, which exists (and decodes
+// anything) only while at least one of them is connected.
+PreviewServerMediaSubsession
+::PreviewServerMediaSubsession(UsageEnvironment& env,
+                               WebcamJPEGDeviceSource* input,
+                               unsigned timePerFrame,
+                               FrameWorkerPool* pool)
+  : OnDemandServerMediaSubsession(env, True /*reuse the first source*/),
+    fInput(input), fTimePerFrame(timePerFrame), fPool(pool)
+{
+}
+
+PreviewServerMediaSubsession::~PreviewServerMediaSubsession()
+{
+}
+
+FramedSource* PreviewServerMediaSubsession
+::createNewStreamSource(unsigned /*clientSessionId*/, unsigned& estBitrate)
+{
+    estBitrate = 8*4000/(fTimePerFrame/1000 + 1) + 1; // kbps, ~4 kB frames
+    return JPEGPreviewSource::createNew(envir(), fInput, fTimePerFrame,
+                                        DEFAULT_PREVIEW_QUALITY, fPool);
+}
+
+RTPSink* PreviewServerMediaSubsession
+::createNewRTPSink(Groupsock* rtpGroupsock,
+                   unsigned char /*rtpPayloadTypeIfDynamic*/,
+                   FramedSource* /*inputSource*/)
+{
+    return JPEGVideoRTPSink::createNew(envir(), rtpGroupsock);
+}
@@ -0,0 +1,57 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-demand RTSP subsession serving the webcam's low-resolution preview
+// C++ header
+
+#ifndef _PREVIEW_SERVER_MEDIA_SUBSESSION_HH
+#define _PREVIEW_SERVER_MEDIA_SUBSESSION_HH
+
+#include "OnDemandServerMediaSubsession.hh"
+#include "WebcamJPEGDeviceSource.hh"
+#include "FrameWorkerPool.hh"
+
+class PreviewServerMediaSubsession: public OnDemandServerMediaSubsession {
+public:
+    static PreviewServerMediaSubsession*
+    createNew(UsageEnvironment& env, WebcamJPEGDeviceSource* input,
+              unsigned timePerFrame, FrameWorkerPool* pool = NULL);
+    // "timePerFrame" is the preview frame interval, in microseconds;
+    // previews are built on "pool" if there is one
+
+protected:
+    PreviewServerMediaSubsession(UsageEnvironment& env,
+                                 WebcamJPEGDeviceSource* input,
+                                 unsigned timePerFrame,
+                                 FrameWorkerPool* pool);
+    // called only by createNew()
+    virtual ~PreviewServerMediaSubsession();
+
+private:
+    // redefined virtual functions:
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId,
+                                                unsigned& estBitrate);
+    virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,
+                                      unsigned char rtpPayloadTypeIfDynamic,
+                                      FramedSource* inputSource);
+
+private:
+    WebcamJPEGDeviceSource* fInput;
+    unsigned fTimePerFrame;
+    FrameWorkerPool* fPool;
+};
+
+#endif // _PREVIEW_SERVER_MEDIA_SUBSESSION_HH
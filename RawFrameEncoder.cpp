@@ -0,0 +1,184 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Baseline JPEG encoding of raw (YUYV, NV12) webcam frames, in restart
+// interval slices spread over a FrameWorkerPool
+// Implementation
+//
+// Restart intervals are independent: each starts with fresh DC
+// predictions and ends on a byte boundary.  A frame cut into intervals of
+// whole MCU rows can therefore be encoded slice by slice on any number of
+// threads, and the slices joined with RST0..RST7 markers.  The caller
+// encodes slices too, and only waits for the slices other threads have
+// already started, so a busy pool cannot stall it.
+
+#include "RawFrameEncoder.hh"
+
+#include <linux/videodev2.h>
+#include <algorithm>
+
+RawFrameEncoder::RawFrameEncoder()
+  : fPool(NULL), fType(0), fWidth(0), fHeight(0), fMcuRows(0),
+    fRowsPerSlice(0), fNumSlices(0), fNextSlice(0), fSlicesDone(0),
+    fQueuedJobs(0)
+{
+}
+
+RawFrameEncoder::~RawFrameEncoder()
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    while(fQueuedJobs > 0)
+        fCond.wait(lock);
+}
+
+bool RawFrameEncoder::supportsFormat(unsigned pixelFormat)
+{
+    return pixelFormat == V4L2_PIX_FMT_YUYV || pixelFormat == V4L2_PIX_FMT_NV12;
+}
+
+void RawFrameEncoder::setWorkerPool(FrameWorkerPool* pool)
+{
+    fPool = pool;
+}
+
+void RawFrameEncoder::setQuality(int quality)
+{
+    fEncoder.setQuality(quality);
+}
+
+int RawFrameEncoder::encode(unsigned pixelFormat, unsigned width,
+                            unsigned height, unsigned bytesPerLine,
+                            unsigned char const* data, size_t length,
+                            std::vector<unsigned char>& out)
+{
+    // both formats share one chroma sample between two columns
+    if(width == 0 || height == 0 || (width & 1) != 0)
+        return -1;
+
+    JpegSourceImage image;
+    int type;
+    if(pixelFormat == V4L2_PIX_FMT_YUYV) {
+        // Y0 Cb Y1 Cr
+        if(bytesPerLine < 2*width || length < (size_t)bytesPerLine*height)
+            return -1;
+        type = 0;
+        image.planes[0] = data;
+        image.planes[1] = data + 1;
+        image.planes[2] = data + 3;
+        image.steps[0] = 2;
+        image.steps[1] = image.steps[2] = 4;
+    } else if(pixelFormat == V4L2_PIX_FMT_NV12) {
+        // the Y plane, then half as many rows of interleaved Cb Cr
+        if((height & 1) != 0 || bytesPerLine < width
+           || length < (size_t)bytesPerLine*height*3/2)
+            return -1;
+        type = 1;
+        image.planes[0] = data;
+        image.planes[1] = data + bytesPerLine*height;
+        image.planes[2] = image.planes[1] + 1;
+        image.steps[0] = 1;
+        image.steps[1] = image.steps[2] = 2;
+    } else {
+        return -1;
+    }
+    image.strides[0] = image.strides[1] = image.strides[2] = bytesPerLine;
+
+    unsigned mcuRows = JpegEncoder::mcuRows(type, height);
+    unsigned mcusPerRow = JpegEncoder::mcusPerRow(width);
+    unsigned numSlices = 1;
+    if(fPool != NULL && fPool->numThreads() > 1)
+        numSlices = std::min(mcuRows, fPool->numThreads()*RAW_SLICES_PER_THREAD);
+    unsigned rowsPerSlice = (mcuRows + numSlices - 1)/numSlices;
+    if(rowsPerSlice*mcusPerRow > 0xFFFF) // DRI is 16 bits
+        rowsPerSlice = mcuRows;
+    numSlices = (mcuRows + rowsPerSlice - 1)/rowsPerSlice;
+    fEncoder.setRestartInterval(numSlices > 1 ? rowsPerSlice*mcusPerRow : 0);
+
+    out.clear();
+    fEncoder.writeHeaders(type, width, height, out);
+    if(fSlices.size() < numSlices)
+        fSlices.resize(numSlices);
+    for(unsigned i = 0; i < numSlices; i++)
+        fSlices[i].clear();
+
+    unsigned helpers = 0;
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fType = type;
+        fWidth = width;
+        fHeight = height;
+        fImage = image;
+        fMcuRows = mcuRows;
+        fRowsPerSlice = rowsPerSlice;
+        fNumSlices = numSlices;
+        fNextSlice = 0;
+        fSlicesDone = 0;
+        if(numSlices > 1)
+            helpers = std::min(numSlices, fPool->numThreads()) - 1;
+        fQueuedJobs += helpers;
+    }
+    for(unsigned i = 0; i < helpers; i++)
+        fPool->submit(sliceJob, this);
+    encodeSlices();
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+        while(fSlicesDone < fNumSlices)
+            fCond.wait(lock);
+    }
+
+    size_t total = out.size() + 2*numSlices;
+    for(unsigned i = 0; i < numSlices; i++)
+        total += fSlices[i].size();
+    out.reserve(total);
+    for(unsigned i = 0; i < numSlices; i++) {
+        out.insert(out.end(), fSlices[i].begin(), fSlices[i].end());
+        if(i + 1 < numSlices) {
+            out.push_back(0xFF);
+            out.push_back(0xD0 + (i & 7)); // RSTn
+        }
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9); // EOI
+    return 0;
+}
+
+// Encodes unclaimed slices of the current frame until there are none left
+void RawFrameEncoder::encodeSlices()
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    while(fNextSlice < fNumSlices) {
+        unsigned i = fNextSlice++;
+        lock.unlock();
+        unsigned firstRow = i*fRowsPerSlice;
+        fEncoder.encodeRows(fType, fWidth, fHeight, fImage, firstRow,
+                            std::min(fRowsPerSlice, fMcuRows - firstRow),
+                            fSlices[i]);
+        lock.lock();
+        if(++fSlicesDone == fNumSlices)
+            fCond.notify_all();
+    }
+}
+
+// A pool job: helps with whatever frame is current when it gets to run,
+// which may be none if the caller already did all the slices.
+void RawFrameEncoder::sliceJob(void* clientData)
+{
+    RawFrameEncoder* encoder = (RawFrameEncoder*)clientData;
+    encoder->encodeSlices();
+    std::lock_guard<std::mutex> lock(encoder->fMutex);
+    encoder->fQueuedJobs--;
+    encoder->fCond.notify_all();
+}
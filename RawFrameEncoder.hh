@@ -0,0 +1,84 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Baseline JPEG encoding of raw (YUYV, NV12) webcam frames, in restart
+// interval slices spread over a FrameWorkerPool
+// C++ header
+
+#ifndef _RAW_FRAME_ENCODER_HH
+#define _RAW_FRAME_ENCODER_HH
+
+#include "JpegEncoder.hh"
+#include "FrameWorkerPool.hh"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// slices per pool thread, so that a thread that got a slow slice does not
+// hold up the whole frame
+#define RAW_SLICES_PER_THREAD 4
+
+class RawFrameEncoder {
+public:
+    RawFrameEncoder();
+    virtual ~RawFrameEncoder();
+    // waits for slice jobs still queued on the pool
+
+    static bool supportsFormat(unsigned pixelFormat);
+    // V4L2_PIX_FMT_YUYV, encoded as 4:2:2 (RTP/JPEG type 0), and
+    // V4L2_PIX_FMT_NV12, encoded as 4:2:0 (type 1)
+
+    void setWorkerPool(FrameWorkerPool* pool);
+    // NULL (the default) encodes each frame in one piece on the caller's
+    // thread; otherwise the frame is cut into restart intervals of whole
+    // MCU rows, which the pool threads and the caller encode in parallel.
+    void setQuality(int quality); // 1..99, as for JpegEncoder
+    int quality() const { return fEncoder.quality(); }
+
+    int encode(unsigned pixelFormat, unsigned width, unsigned height,
+               unsigned bytesPerLine, unsigned char const* data,
+               size_t length, std::vector<unsigned char>& out);
+    // Encodes one frame into a complete JPEG in "out"; the samples are
+    // read in place.  Returns -1 for an unsupported format or a short
+    // frame.  Not reentrant: one frame at a time.
+
+private:
+    static void sliceJob(void* clientData);
+    void encodeSlices();
+
+private:
+    JpegEncoder fEncoder;
+    FrameWorkerPool* fPool;
+
+    // the frame being encoded; fixed until all its slices are done
+    int fType;
+    unsigned fWidth;
+    unsigned fHeight;
+    JpegSourceImage fImage;
+    unsigned fMcuRows;
+    unsigned fRowsPerSlice;
+    std::vector<std::vector<unsigned char> > fSlices;
+
+    std::mutex fMutex;
+    std::condition_variable fCond;
+    unsigned fNumSlices;
+    unsigned fNextSlice;
+    unsigned fSlicesDone;
+    unsigned fQueuedJobs; // slice jobs submitted but not yet finished
+};
+
+#endif // _RAW_FRAME_ENCODER_HH
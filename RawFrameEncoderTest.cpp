@@ -0,0 +1,217 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// A test program that encodes synthetic YUYV and NV12 frames with
+// RawFrameEncoder, in one piece and in slices on a worker pool, and checks
+// the results against each other and against JpegEncoder
+// main program
+
+#include "JpegFrameParser.hh"
+#include "JpegScanDecoder.hh"
+#include "RawFrameEncoder.hh"
+
+#include <linux/videodev2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+char* progName;
+unsigned numThreads = 4;
+unsigned width = 1280;
+unsigned height = 720;
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [-t <pool-threads>] [-s <width>x<height>]\n",
+            progName);
+    exit(1);
+}
+
+// A busy synthetic picture, with padding at the end of each line
+static void makeFrame(unsigned pixelFormat, unsigned& bytesPerLine,
+                      std::vector<unsigned char>& frame)
+{
+    srand(1);
+    if (pixelFormat == V4L2_PIX_FMT_YUYV) {
+        bytesPerLine = 2*width + 64;
+        frame.assign(bytesPerLine*height, 0);
+        for (unsigned y = 0; y < height; y++) {
+            for (unsigned x = 0; x < width; x++) {
+                frame[y*bytesPerLine + 2*x] = (x/8 + y/5 + rand() % 40) & 255;
+                frame[y*bytesPerLine + 2*x + 1] = (x & 1) ? 150 + x/60 : 100 + rand() % 20;
+            }
+        }
+    } else {
+        bytesPerLine = width + 32;
+        frame.assign(bytesPerLine*height*3/2, 0);
+        for (unsigned y = 0; y < height; y++) {
+            for (unsigned x = 0; x < width; x++)
+                frame[y*bytesPerLine + x] = (x/8 + y/5 + rand() % 40) & 255;
+        }
+        for (unsigned y = 0; y < height/2; y++) {
+            for (unsigned x = 0; x < width; x++)
+                frame[(height + y)*bytesPerLine + x] = (x & 1) ? 150 + x/60 : 100 + rand() % 20;
+        }
+    }
+}
+
+// The frame as separate planes, for JpegEncoder
+static void makePlanes(unsigned pixelFormat, unsigned bytesPerLine,
+                       std::vector<unsigned char> const& frame,
+                       std::vector<unsigned char> planes[3])
+{
+    unsigned chromaWidth = width/2;
+    unsigned chromaHeight = pixelFormat == V4L2_PIX_FMT_YUYV ? height : height/2;
+    planes[0].resize(width*height);
+    planes[1].resize(chromaWidth*chromaHeight);
+    planes[2].resize(chromaWidth*chromaHeight);
+    for (unsigned y = 0; y < height; y++) {
+        for (unsigned x = 0; x < width; x++)
+            planes[0][y*width + x] = pixelFormat == V4L2_PIX_FMT_YUYV
+                ? frame[y*bytesPerLine + 2*x] : frame[y*bytesPerLine + x];
+    }
+    for (unsigned y = 0; y < chromaHeight; y++) {
+        for (unsigned x = 0; x < chromaWidth; x++) {
+            unsigned char const* cbcr = pixelFormat == V4L2_PIX_FMT_YUYV
+                ? &frame[y*bytesPerLine + 4*x + 1]
+                : &frame[(height + y)*bytesPerLine + 2*x];
+            planes[1][y*chromaWidth + x] = cbcr[0];
+            planes[2][y*chromaWidth + x] = cbcr[pixelFormat == V4L2_PIX_FMT_YUYV ? 2 : 1];
+        }
+    }
+}
+
+// Decodes all coefficients of a JPEG; restart markers make no difference
+static int decode(std::vector<unsigned char>& jpeg, JpegFrameParser& parser,
+                  std::vector<short>& coefficients)
+{
+    JpegScanDecoder decoder;
+    if (parser.parse(&jpeg[0], jpeg.size()) != 0 || decoder.init(parser) != 0)
+        return -1;
+    unsigned mcus = decoder.mcusPerRow()*decoder.mcuRows();
+    unsigned mcuSize = decoder.blocksPerMcu()*64;
+    coefficients.resize(mcus*mcuSize);
+    for (unsigned m = 0; m < mcus; m++) {
+        if (decoder.decodeMCU(&coefficients[m*mcuSize]) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int check(unsigned pixelFormat, char const* name)
+{
+    unsigned bytesPerLine;
+    std::vector<unsigned char> frame;
+    makeFrame(pixelFormat, bytesPerLine, frame);
+    int type = pixelFormat == V4L2_PIX_FMT_YUYV ? 0 : 1;
+
+    // in one piece on this thread, on a pool of one, and in slices
+    FrameWorkerPool onePool(1), pool(numThreads);
+    FrameWorkerPool* pools[3] = { NULL, &onePool, &pool };
+    std::vector<unsigned char> jpegs[3];
+    for (int i = 0; i < 3; i++) {
+        RawFrameEncoder encoder;
+        encoder.setWorkerPool(pools[i]);
+        encoder.setQuality(80);
+        // twice: the second frame reuses the slice buffers
+        for (int n = 0; n < 2; n++) {
+            if (encoder.encode(pixelFormat, width, height, bytesPerLine,
+                               &frame[0], frame.size(), jpegs[i]) != 0) {
+                printf("FAILED: %s: encoding with %u threads\n", name,
+                       pools[i] ? pools[i]->numThreads() : 0);
+                return -1;
+            }
+        }
+    }
+    int failures = 0;
+    if (jpegs[0] != jpegs[1]) {
+        printf("FAILED: %s: a pool of one thread changes the result\n", name);
+        failures++;
+    }
+
+    JpegFrameParser parsers[2];
+    std::vector<short> coefficients[2];
+    for (int i = 0; i < 2; i++) {
+        JpegFrameParser& parser = parsers[i];
+        if (decode(jpegs[i + 1], parser, coefficients[i]) != 0) {
+            printf("FAILED: %s: the result with %u threads does not decode\n",
+                   name, pools[i + 1]->numThreads());
+            return -1;
+        }
+        if (parser.type() % 64 != type || parser.frameWidth() != width
+            || parser.frameHeight() != height) {
+            printf("FAILED: %s: type %u, %ux%u\n", name, parser.type(),
+                   parser.frameWidth(), parser.frameHeight());
+            failures++;
+        }
+    }
+    printf("%s %ux%u: %zu bytes in one piece, %zu bytes in slices of %u MCUs"
+           " on %u threads\n", name, width, height, jpegs[1].size(),
+           jpegs[2].size(), parsers[1].restartInterval(), numThreads);
+    if (coefficients[0] != coefficients[1]) {
+        printf("FAILED: %s: the slices do not add up to the whole picture\n", name);
+        failures++;
+    }
+
+    // the same bytes as JpegEncoder gives with that restart interval
+    std::vector<unsigned char> planes[3];
+    makePlanes(pixelFormat, bytesPerLine, frame, planes);
+    unsigned char const* planePointers[3] = { &planes[0][0], &planes[1][0], &planes[2][0] };
+    unsigned strides[3] = { width, width/2, width/2 };
+    JpegEncoder reference;
+    reference.setQuality(80);
+    reference.setRestartInterval(parsers[1].restartInterval());
+    std::vector<unsigned char> jpeg;
+    reference.encode(type, width, height, planePointers, strides, jpeg);
+    if (jpeg != jpegs[2]) {
+        printf("FAILED: %s: the slices differ from JpegEncoder's result\n", name);
+        failures++;
+    }
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    progName = argv[0];
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+        switch (opt) {
+            case 't':
+                if (sscanf(optarg, "%u", &numThreads) != 1
+                    || numThreads < 2 || numThreads > 64)
+                    usage();
+                break;
+            case 's':
+                if (sscanf(optarg, "%ux%u", &width, &height) != 2
+                    || width == 0 || height == 0 || (width & 1) || (height & 1)
+                    || width > 4096 || height > 4096)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+
+    int failures = check(V4L2_PIX_FMT_YUYV, "YUYV");
+    failures += check(V4L2_PIX_FMT_NV12, "NV12");
+    if (failures != 0) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Cutting RTP/JPEG packets at restart interval boundaries (RFC 2435,
+// section 3.1.7)
+// Implementation
+
+#include "RtpJpegRestart.hh"
+
+#include <string.h>
+
+RtpJpegRestartAligner::RtpJpegRestartAligner() :
+    _nextPacketStartsInterval(true), _nextRestartCount(0)
+{
+}
+
+// Entropy-coded data only has 0xFF bytes followed by 0x00 (stuffing),
+// 0xFF (fill) or a marker.
+unsigned int RtpJpegRestartAligner::nextRestartMarker(unsigned char const* data,
+                                                     unsigned int size)
+{
+    unsigned char const* p = data;
+    unsigned char const* end = data + size;
+    while (p + 1 < end
+           && (p = (unsigned char const*)memchr(p, 0xFF, end - 1 - p)) != NULL) {
+        if ((p[1] & 0xF8) == 0xD0)
+            return p + 2 - data;
+        p++;
+    }
+    return 0;
+}
+
+unsigned int RtpJpegRestartAligner::overflow(unsigned char const* data,
+                                             unsigned int size,
+                                             unsigned int room,
+                                             bool frameStart) const
+{
+    if (room >= size)
+        return 0;
+    if (room <= 1)
+        return size - room;
+
+    bool startsInterval = frameStart || _nextPacketStartsInterval;
+    unsigned int cut = 0;
+    unsigned int next;
+    while ((next = nextRestartMarker(data + cut, room - cut)) != 0) {
+        cut += next;
+        if (!startsInterval)
+            break;
+    }
+    if (cut != 0)
+        return size - cut;
+    // No boundary within reach: the interval spans packets.  Keep a
+    // marker's 0xFF with the rest of it, so every marker ends a packet.
+    return data[room - 1] == 0xFF ? size - room + 1 : size - room;
+}
+
+void RtpJpegRestartAligner::packetHeader(unsigned char const* payload,
+                                         unsigned int size,
+                                         unsigned int fragmentationOffset,
+                                         unsigned int remaining,
+                                         unsigned char header[2])
+{
+    if (fragmentationOffset == 0) {
+        _nextPacketStartsInterval = true;
+        _nextRestartCount = 0;
+    }
+    // count the markers in the payload, and see if it ends with one
+    unsigned int markers = 0, end = 0, next;
+    while ((next = nextRestartMarker(payload + end, size - end)) != 0) {
+        end += next;
+        markers++;
+    }
+    bool first = _nextPacketStartsInterval;
+    bool last = remaining == 0 || (markers > 0 && end == size);
+    unsigned int count = _nextRestartCount % 0x3FFF; // 0x3FFF means "not aligned"
+    header[0] = (first ? 0x80 : 0) | (last ? 0x40 : 0) | (count >> 8);
+    header[1] = count & 0xFF;
+    _nextPacketStartsInterval = last;
+    _nextRestartCount += markers;
+}
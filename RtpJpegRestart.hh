@@ -0,0 +1,57 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Cutting RTP/JPEG packets at restart interval boundaries (RFC 2435,
+// section 3.1.7)
+// C++ header
+
+#ifndef _RTP_JPEG_RESTART_HH_INCLUDED
+#define _RTP_JPEG_RESTART_HH_INCLUDED
+
+// Decides where the packets of a frame with restart markers end, and
+// fills in their restart marker headers, for one stream.  It knows
+// nothing of live555: WebcamJPEGRTPSink feeds it the scan data as the
+// packets are built.
+class RtpJpegRestartAligner
+{
+public:
+    RtpJpegRestartAligner();
+
+    // Offset just past the first RSTn marker in data[0..size), 0 if none
+    static unsigned int nextRestartMarker(unsigned char const* data,
+                                          unsigned int size);
+
+    // Of the "size" bytes of scan data at "data", of which only "room" fit
+    // in the packet, returns how many to leave for the next packets.  A
+    // packet starting an interval ends after the last whole interval that
+    // fits; one continuing an interval ends with that interval.
+    unsigned int overflow(unsigned char const* data, unsigned int size,
+                          unsigned int room, bool frameStart) const;
+
+    // The F/L/count bytes of the restart marker header of the packet
+    // carrying "size" bytes of scan data at "payload", with "remaining"
+    // bytes of the frame after them
+    void packetHeader(unsigned char const* payload, unsigned int size,
+                      unsigned int fragmentationOffset, unsigned int remaining,
+                      unsigned char header[2]);
+
+private:
+    // where the next packet of the current frame starts
+    bool _nextPacketStartsInterval;
+    unsigned int _nextRestartCount;
+};
+
+#endif // _RTP_JPEG_RESTART_HH_INCLUDED
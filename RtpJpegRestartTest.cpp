@@ -0,0 +1,189 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// A test program that cuts synthetic JPEG frames into RTP/JPEG packets the
+// way WebcamJPEGRTPSink does, and checks that the packets end at restart
+// interval boundaries and carry the right F, L and restart count
+// main program
+
+#include "JpegEncoder.hh"
+#include "JpegFrameParser.hh"
+#include "RtpJpegRestart.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#define RTP_HEADER_SIZE 12
+#define JPEG_HEADER_SIZE 8         // RFC 2435 main header
+#define RESTART_HEADER_SIZE 4
+#define QUANTIZATION_HEADER_SIZE 132 // with two 64-byte tables, first packet only
+
+char* progName;
+unsigned maxPacketSize = 1456; // live555's default
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [-m <max-packet-size>]\n", progName);
+    exit(1);
+}
+
+// Whether scan[0..end) ends with a restart marker
+static bool endsWithRestart(unsigned char const* scan, unsigned end)
+{
+    return end >= 2 && scan[end - 2] == 0xFF && (scan[end - 1] & 0xF8) == 0xD0;
+}
+
+static unsigned checkMarkerSearch()
+{
+    unsigned errors = 0;
+    unsigned char const none[] = { 0x12, 0xFF, 0x00, 0xFF, 0xFF, 0x34 };
+    unsigned char const one[] = { 0x12, 0xFF, 0x00, 0xFF, 0xD3, 0x34 };
+    unsigned char const split[] = { 0x12, 0x34, 0xFF };
+    if (RtpJpegRestartAligner::nextRestartMarker(none, sizeof(none)) != 0)
+        errors++;
+    if (RtpJpegRestartAligner::nextRestartMarker(one, sizeof(one)) != 5)
+        errors++;
+    if (RtpJpegRestartAligner::nextRestartMarker(split, sizeof(split)) != 0)
+        errors++;
+    if (errors != 0)
+        printf("FAILED: restart marker search\n");
+    return errors;
+}
+
+// Packetizes the scan data as MultiFramedRTPSink does with
+// WebcamJPEGRTPSink's overflow rule, and checks every packet's restart
+// marker header against the markers around it.
+static unsigned packetize(RtpJpegRestartAligner& aligner,
+                          unsigned char const* scan, unsigned length,
+                          unsigned& packets, unsigned& spanning)
+{
+    unsigned errors = 0;
+    unsigned markersBefore = 0;
+    packets = spanning = 0;
+    for (unsigned offset = 0; offset < length; packets++) {
+        unsigned room = maxPacketSize - RTP_HEADER_SIZE - JPEG_HEADER_SIZE
+            - RESTART_HEADER_SIZE - (offset == 0 ? QUANTIZATION_HEADER_SIZE : 0);
+        unsigned remaining = length - offset;
+        unsigned overflow = remaining > room
+            ? aligner.overflow(scan + offset, remaining, room, offset == 0) : 0;
+        unsigned size = remaining - overflow;
+        if (size == 0 || size > room) {
+            printf("FAILED: packet at %u carries %u of %u bytes\n",
+                   offset, size, room);
+            return errors + 1;
+        }
+        unsigned char header[2];
+        aligner.packetHeader(scan + offset, size, offset, overflow, header);
+
+        bool first = header[0] & 0x80;
+        bool last = header[0] & 0x40;
+        unsigned count = (header[0] & 0x3F) << 8 | header[1];
+        unsigned markersInside = 0;
+        for (unsigned i = offset + 2; i <= offset + size; i++)
+            markersInside += endsWithRestart(scan, i);
+        bool startsInterval = offset == 0 || endsWithRestart(scan, offset);
+        bool endsInterval = offset + size == length || endsWithRestart(scan, offset + size);
+        if (first != startsInterval || last != endsInterval
+            || count != markersBefore % 0x3FFF) {
+            printf("FAILED: packet at %u (%u bytes): F %d L %d count %u,"
+                   " expected F %d L %d count %u\n", offset, size, first, last,
+                   count, startsInterval, endsInterval, markersBefore);
+            errors++;
+        }
+        // a packet holds whole intervals, or a piece of one
+        if ((!first || !last) && markersInside > (last ? 1 : 0)) {
+            printf("FAILED: packet at %u splits %u intervals\n", offset,
+                   markersInside);
+            errors++;
+        }
+        if (!first || !last)
+            spanning++;
+        markersBefore += markersInside;
+        offset += size;
+    }
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    progName = argv[0];
+    int opt;
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (sscanf(optarg, "%u", &maxPacketSize) != 1
+                    || maxPacketSize < 256 || maxPacketSize > 65536)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+
+    unsigned errors = checkMarkerSearch();
+    unsigned const sizes[][2] = { { 640, 480 }, { 1280, 720 } };
+    unsigned const restartIntervals[] = { 1, 3, 40, 200 };
+    for (int type = 0; type <= 1; type++) {
+        for (unsigned s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+            unsigned width = sizes[s][0], height = sizes[s][1];
+            // busy enough that some intervals outgrow a packet
+            std::vector<unsigned char> y(width*height), cb(width*height), cr(width*height);
+            for (unsigned i = 0; i < width*height; i++) {
+                y[i] = (i*7 % width) ^ (i/width*3) ^ (i % 13);
+                cb[i] = i*31;
+                cr[i] = i/7;
+            }
+            unsigned char const* planes[3] = { &y[0], &cb[0], &cr[0] };
+            unsigned chromaWidth = (width + 1)/2;
+            unsigned strides[3] = { width, chromaWidth, chromaWidth };
+
+            for (unsigned r = 0; r < sizeof(restartIntervals)/sizeof(restartIntervals[0]); r++) {
+                JpegEncoder encoder;
+                encoder.setQuality(90);
+                encoder.setRestartInterval(restartIntervals[r]);
+                std::vector<unsigned char> jpeg;
+                JpegFrameParser parser;
+                if (encoder.encode(type, width, height, planes, strides, jpeg) != 0
+                    || parser.parse(&jpeg[0], jpeg.size()) != 0) {
+                    printf("FAILED: encoding a %ux%u frame\n", width, height);
+                    return 1;
+                }
+                unsigned length;
+                unsigned char const* scan = parser.scandata(length);
+
+                // the second frame starts with whatever state the first
+                // one left behind
+                RtpJpegRestartAligner aligner;
+                unsigned packets = 0, spanning = 0;
+                for (int frame = 0; frame < 2; frame++)
+                    errors += packetize(aligner, scan, length, packets, spanning);
+                printf("type %d, %ux%u, restart interval %3u: %u bytes,"
+                       " %u packets, %u of them spanning an interval\n",
+                       parser.type(), width, height, restartIntervals[r],
+                       length, packets, spanning);
+            }
+        }
+    }
+    if (errors != 0) {
+        printf("FAILED: %u errors\n", errors);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// RFC 5109 XOR forward error correction for RTP packets
+// Implementation
+
+#include "RtpXorFec.hh"
+
+// media packets kept by the decoder, by sequence number distance
+#define FEC_DECODER_WINDOW 1024
+
+static uint16_t get16(unsigned char const* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(unsigned char const* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put16(unsigned char* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static void put32(unsigned char* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+RtpXorFecEncoder::RtpXorFecEncoder(unsigned char payloadType) :
+    _payloadType(payloadType & 0x7F), _groupSize(4), _nextGroupSize(4),
+    _count(0), _fecSeq(0), _snBase(0), _lastTimestamp(0), _ssrc(0),
+    _tsRecovery(0), _lengthRecovery(0)
+{
+}
+
+void RtpXorFecEncoder::setGroupSize(unsigned int packets)
+{
+    if (packets < 1) packets = 1;
+    if (packets > FEC_MAX_GROUP_SIZE) packets = FEC_MAX_GROUP_SIZE;
+    _nextGroupSize = packets;
+}
+
+bool RtpXorFecEncoder::addPacket(unsigned char const* packet,
+                                 unsigned int length,
+                                 std::vector<unsigned char>& fec)
+{
+    if (length < RTP_HEADER_SIZE)
+        return false;
+
+    if (_count == 0) {
+        _snBase = get16(packet + 2);
+        _bitsRecovery[0] = _bitsRecovery[1] = 0;
+        _tsRecovery = 0;
+        _lengthRecovery = 0;
+        _payloadRecovery.clear();
+    }
+    _bitsRecovery[0] ^= packet[0] & 0x3F;
+    _bitsRecovery[1] ^= packet[1];
+    _tsRecovery ^= get32(packet + 4);
+    _lastTimestamp = get32(packet + 4);
+    _ssrc = get32(packet + 8);
+
+    unsigned int payloadLength = length - RTP_HEADER_SIZE;
+    _lengthRecovery ^= payloadLength;
+    if (_payloadRecovery.size() < payloadLength)
+        _payloadRecovery.resize(payloadLength, 0);
+    unsigned char const* payload = packet + RTP_HEADER_SIZE;
+    for (unsigned int i = 0; i < payloadLength; i++)
+        _payloadRecovery[i] ^= payload[i];
+    _count++;
+
+    bool endOfFrame = (packet[1] & 0x80) != 0;
+    if (_count < _groupSize && !endOfFrame)
+        return false;
+
+    buildFecPacket(fec);
+    _count = 0;
+    if (endOfFrame)
+        _groupSize = _nextGroupSize;
+    return true;
+}
+
+void RtpXorFecEncoder::buildFecPacket(std::vector<unsigned char>& fec)
+{
+    unsigned int protectionLength = _payloadRecovery.size();
+    fec.resize(RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_LEVEL_HEADER_SIZE
+               + protectionLength);
+    unsigned char* p = &fec[0];
+
+    p[0] = 0x80; // V = 2
+    p[1] = _payloadType;
+    put16(p + 2, _fecSeq++);
+    put32(p + 4, _lastTimestamp);
+    put32(p + 8, _ssrc);
+    p += RTP_HEADER_SIZE;
+
+    p[0] = _bitsRecovery[0]; // E = 0, L = 0
+    p[1] = _bitsRecovery[1];
+    put16(p + 2, _snBase);
+    put32(p + 4, _tsRecovery);
+    put16(p + 8, _lengthRecovery);
+    p += FEC_HEADER_SIZE;
+
+    put16(p, protectionLength);
+    put16(p + 2, (uint16_t)(0xFFFF0000u >> _count)); // packets _snBase.._snBase+_count-1
+    p += FEC_LEVEL_HEADER_SIZE;
+
+    for (unsigned int i = 0; i < protectionLength; i++)
+        p[i] = _payloadRecovery[i];
+}
+
+RtpXorFecDecoder::RtpXorFecDecoder() : _newestSeq(0)
+{
+}
+
+void RtpXorFecDecoder::addMediaPacket(unsigned char const* packet,
+                                      unsigned int length)
+{
+    if (length < RTP_HEADER_SIZE)
+        return;
+    uint16_t seq = get16(packet + 2);
+    _media[seq].assign(packet, packet + length);
+    if (_media.size() == 1 || (int16_t)(seq - _newestSeq) > 0)
+        _newestSeq = seq;
+
+    // forget packets that fell out of the window
+    std::map<uint16_t, std::vector<unsigned char> >::iterator it = _media.begin();
+    while (it != _media.end()) {
+        if ((uint16_t)(_newestSeq - it->first) >= FEC_DECODER_WINDOW)
+            _media.erase(it++);
+        else
+            ++it;
+    }
+}
+
+int RtpXorFecDecoder::addFecPacket(unsigned char const* packet,
+                                   unsigned int length,
+                                   std::vector<unsigned char>& recovered)
+{
+    unsigned int headers = RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_LEVEL_HEADER_SIZE;
+    if (length < headers)
+        return -1;
+    unsigned char const* fecHeader = packet + RTP_HEADER_SIZE;
+    unsigned char const* levelHeader = fecHeader + FEC_HEADER_SIZE;
+    if (fecHeader[0] & 0xC0) // E or L: extension or long mask, not produced by us
+        return -1;
+    uint16_t snBase = get16(fecHeader + 2);
+    unsigned int protectionLength = get16(levelHeader);
+    uint16_t mask = get16(levelHeader + 2);
+    if (length < headers + protectionLength)
+        return -1;
+
+    int missing = -1;
+    for (int i = 0; i < 16; i++) {
+        if (!(mask & (0x8000 >> i)))
+            continue;
+        if (_media.find((uint16_t)(snBase + i)) == _media.end()) {
+            if (missing >= 0)
+                return -1;
+            missing = i;
+        }
+    }
+    if (missing < 0)
+        return 0;
+
+    unsigned char bits[2] = { fecHeader[0], fecHeader[1] };
+    uint32_t ts = get32(fecHeader + 4);
+    uint16_t payloadLength = get16(fecHeader + 8);
+    std::vector<unsigned char> payload(levelHeader + FEC_LEVEL_HEADER_SIZE,
+                                       levelHeader + FEC_LEVEL_HEADER_SIZE
+                                       + protectionLength);
+    for (int i = 0; i < 16; i++) {
+        if (!(mask & (0x8000 >> i)) || i == missing)
+            continue;
+        std::vector<unsigned char> const& m = _media[(uint16_t)(snBase + i)];
+        bits[0] ^= m[0] & 0x3F;
+        bits[1] ^= m[1];
+        ts ^= get32(&m[4]);
+        payloadLength ^= m.size() - RTP_HEADER_SIZE;
+        for (unsigned int k = RTP_HEADER_SIZE; k < m.size()
+                 && k - RTP_HEADER_SIZE < protectionLength; k++)
+            payload[k - RTP_HEADER_SIZE] ^= m[k];
+    }
+    if (payloadLength > protectionLength)
+        return -1;
+
+    recovered.resize(RTP_HEADER_SIZE + payloadLength);
+    recovered[0] = 0x80 | (bits[0] & 0x3F);
+    recovered[1] = bits[1];
+    put16(&recovered[2], (uint16_t)(snBase + missing));
+    put32(&recovered[4], ts);
+    for (int i = 0; i < 4; i++)
+        recovered[8 + i] = packet[8 + i]; // same SSRC as the media
+    for (unsigned int k = 0; k < payloadLength; k++)
+        recovered[RTP_HEADER_SIZE + k] = payload[k];
+
+    addMediaPacket(&recovered[0], recovered.size());
+    return 1;
+}
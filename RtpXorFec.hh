@@ -0,0 +1,89 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// RFC 5109 XOR forward error correction for RTP packets
+// C++ header
+
+#ifndef _RTP_XOR_FEC_HH_INCLUDED
+#define _RTP_XOR_FEC_HH_INCLUDED
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#define RTP_HEADER_SIZE 12
+#define FEC_HEADER_SIZE 10       // RFC 5109 section 7.3
+#define FEC_LEVEL_HEADER_SIZE 4  // level 0 with a 16-bit mask (L = 0)
+#define FEC_MAX_GROUP_SIZE 16
+#define DEFAULT_FEC_PAYLOAD_TYPE 127
+
+// Builds one FEC packet per group of media packets.  A group never spans
+// two frames: it is closed after groupSize() packets or at the packet
+// carrying the marker bit, whichever comes first.  FEC packets use the
+// media SSRC with their own sequence numbers, as on a separate session.
+class RtpXorFecEncoder
+{
+public:
+    RtpXorFecEncoder(unsigned char payloadType = DEFAULT_FEC_PAYLOAD_TYPE);
+
+    // Media packets per FEC packet (1..FEC_MAX_GROUP_SIZE); a change takes
+    // effect at the start of the next frame.
+    void setGroupSize(unsigned int packets);
+    unsigned int groupSize() const { return _nextGroupSize; }
+
+    // Adds an outgoing media packet.  Returns true, with the FEC packet in
+    // "fec", when the packet completes a group.
+    bool addPacket(unsigned char const* packet, unsigned int length,
+                   std::vector<unsigned char>& fec);
+
+private:
+    void buildFecPacket(std::vector<unsigned char>& fec);
+
+private:
+    unsigned char _payloadType;
+    unsigned int _groupSize;
+    unsigned int _nextGroupSize;
+    unsigned int _count;
+    uint16_t _fecSeq;
+    uint16_t _snBase;
+    uint32_t _lastTimestamp;
+    uint32_t _ssrc;
+    unsigned char _bitsRecovery[2];  // P, X, CC, M and PT of the packets
+    uint32_t _tsRecovery;
+    uint16_t _lengthRecovery;
+    std::vector<unsigned char> _payloadRecovery;
+};
+
+// Receiver side: keeps the recent media packets and rebuilds the one
+// missing packet of a group when its FEC packet arrives.
+class RtpXorFecDecoder
+{
+public:
+    RtpXorFecDecoder();
+
+    void addMediaPacket(unsigned char const* packet, unsigned int length);
+    // Returns 1 with the rebuilt packet in "recovered", 0 if none of the
+    // protected packets is missing, -1 if more than one is missing or the
+    // FEC packet is malformed.
+    int addFecPacket(unsigned char const* packet, unsigned int length,
+                     std::vector<unsigned char>& recovered);
+
+private:
+    std::map<uint16_t, std::vector<unsigned char> > _media;
+    uint16_t _newestSeq;
+};
+
+#endif // _RTP_XOR_FEC_HH_INCLUDED
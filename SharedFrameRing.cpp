@@ -0,0 +1,270 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Ring of captured JPEG frames in POSIX shared memory, for local readers
+// Implementation
+
+#include "SharedFrameRing.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "the ring needs lock-free 64-bit atomics to be shared between processes"
+#endif
+
+#define CACHE_LINE 64
+
+static size_t alignUp(size_t n)
+{
+    return (n + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+}
+
+// shm_open() wants a single leading slash
+static char* shmName(char const* name)
+{
+    char* s = new char[strlen(name) + 2];
+    s[0] = '/';
+    strcpy(s + 1, name[0] == '/' ? name + 1 : name);
+    return s;
+}
+
+SharedFrameRing* SharedFrameRing::create(char const* name,
+                                         unsigned int slotCount,
+                                         unsigned int slotSize)
+{
+    if (slotCount == 0 || slotSize == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t headerSize = alignUp(sizeof(Header));
+    size_t stride = alignUp(sizeof(Slot) + slotSize);
+    size_t size = headerSize + stride * slotCount;
+
+    char* shm = shmName(name);
+    int fd = shm_open(shm, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        if (isStale(shm)) {
+            shm_unlink(shm); // readers of the old ring keep their mapping
+            fd = shm_open(shm, O_RDWR | O_CREAT | O_EXCL, 0644);
+        } else {
+            errno = EEXIST;
+        }
+    }
+    if (fd < 0) {
+        delete[] shm;
+        return NULL;
+    }
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(shm);
+        delete[] shm;
+        errno = err;
+        return NULL;
+    }
+
+    // ftruncate() zero-fills: every slot starts out empty (sequence 0)
+    Header* header = (Header*)base;
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->slotStride = stride;
+    header->writerPid = getpid();
+    header->version = SHARED_FRAME_RING_VERSION;
+    header->framesWritten.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHARED_FRAME_RING_MAGIC; // readers check this last
+
+    SharedFrameRing* ring = new SharedFrameRing(shm, base, size, true);
+    delete[] shm;
+    return ring;
+}
+
+// Whether the existing object "shm" is a ring whose writer has exited,
+// e.g. after a crash.  Anything that can't be told apart from a live
+// ring, such as one still being set up, is not.
+bool SharedFrameRing::isStale(char const* shm)
+{
+    int fd = shm_open(shm, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+        base = mmap(NULL, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+    Header const* header = (Header const*)base;
+    bool stale = header->magic == SHARED_FRAME_RING_MAGIC
+        && header->version == SHARED_FRAME_RING_VERSION
+        && header->writerPid > 0
+        && kill(header->writerPid, 0) != 0 && errno == ESRCH;
+    munmap(base, sizeof(Header));
+    return stale;
+}
+
+SharedFrameRing* SharedFrameRing::attach(char const* name)
+{
+    char* shm = shmName(name);
+    int fd = shm_open(shm, O_RDONLY, 0);
+    delete[] shm;
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    else
+        errno = EINVAL;
+    int err = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        errno = err;
+        return NULL;
+    }
+
+    Header const* header = (Header const*)base;
+    if (header->magic != SHARED_FRAME_RING_MAGIC
+        || header->version != SHARED_FRAME_RING_VERSION
+        || alignUp(sizeof(Header)) + header->slotStride * header->slotCount
+           > (size_t)st.st_size) {
+        munmap(base, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+    return new SharedFrameRing(NULL, base, st.st_size, false);
+}
+
+SharedFrameRing::SharedFrameRing(char const* name, void* base, size_t size,
+                                 bool writer) :
+    _name(NULL), _base(base), _size(size), _writer(writer),
+    _header((Header*)base), _droppedFrames(0)
+{
+    if (name != NULL) {
+        _name = new char[strlen(name) + 1];
+        strcpy(_name, name);
+    }
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+    munmap(_base, _size);
+    if (_writer)
+        shm_unlink(_name);
+    delete[] _name;
+}
+
+SharedFrameRing::Slot* SharedFrameRing::slot(uint64_t frameNumber) const
+{
+    return (Slot*)((char*)_base + alignUp(sizeof(Header))
+                   + _header->slotStride * (frameNumber % _header->slotCount));
+}
+
+int SharedFrameRing::write(JpegFrameParser& parser,
+                           struct timeval presentationTime)
+{
+    unsigned int length, scanLength;
+    unsigned char const* jpeg = parser.frame(length);
+    unsigned char const* scan = parser.scandata(scanLength);
+    if (jpeg == NULL || length > _header->slotSize) {
+        _droppedFrames++;
+        return -1;
+    }
+
+    uint64_t n = _header->framesWritten.load(std::memory_order_relaxed);
+    Slot* s = slot(n);
+    s->sequence.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    SharedFrameInfo& info = s->info;
+    info.frameNumber = n;
+    info.seconds = presentationTime.tv_sec;
+    info.microseconds = presentationTime.tv_usec;
+    info.length = length;
+    info.scanOffset = scan - jpeg;
+    info.width = parser.frameWidth();
+    info.height = parser.frameHeight();
+    info.restartInterval = parser.restartInterval();
+    info.type = parser.type();
+    info.qFactor = parser.qFactor();
+    info.precision = parser.precision();
+    info.hasHuffmanTables = parser.hasHuffmanTables();
+    unsigned short qTablesLength;
+    unsigned char const* qTables = parser.quantizationTables(qTablesLength);
+    if (qTablesLength > sizeof(info.qTables))
+        qTablesLength = sizeof(info.qTables);
+    info.qTablesLength = qTablesLength;
+    memcpy(info.qTables, qTables, qTablesLength);
+    memcpy((unsigned char*)(s + 1), jpeg, length);
+
+    s->sequence.store(2 * n + 2, std::memory_order_release);
+    _header->framesWritten.store(n + 1, std::memory_order_release);
+    return 0;
+}
+
+void SharedFrameRing::consumeJpegFrame(JpegFrameParser& parser,
+                                       struct timeval presentationTime)
+{
+    write(parser, presentationTime);
+}
+
+uint64_t SharedFrameRing::framesWritten() const
+{
+    return _header->framesWritten.load(std::memory_order_acquire);
+}
+
+unsigned int SharedFrameRing::slotCount() const
+{
+    return _header->slotCount;
+}
+
+unsigned int SharedFrameRing::slotSize() const
+{
+    return _header->slotSize;
+}
+
+int SharedFrameRing::read(uint64_t frameNumber,
+                          std::vector<unsigned char>& jpeg,
+                          SharedFrameInfo& info) const
+{
+    Slot const* s = slot(frameNumber);
+    uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+    if (sequence != 2 * frameNumber + 2)
+        return -1;
+
+    memcpy(&info, &s->info, sizeof(info));
+    unsigned int length = info.length <= _header->slotSize
+        ? info.length : _header->slotSize;
+    jpeg.resize(length);
+    if (length != 0)
+        memcpy(&jpeg[0], (unsigned char const*)(s + 1), length);
+
+    // the copy is only good if the writer didn't start on the slot meanwhile
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s->sequence.load(std::memory_order_relaxed) != sequence)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Ring of captured JPEG frames in POSIX shared memory, for local readers
+// C++ header
+
+#ifndef _SHARED_FRAME_RING_HH_INCLUDED
+#define _SHARED_FRAME_RING_HH_INCLUDED
+
+#include "JpegFrameConsumer.hh"
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHARED_FRAME_RING_MAGIC 0x474E524A // "JRNG"
+#define SHARED_FRAME_RING_VERSION 2
+#define DEFAULT_SHARED_FRAME_SLOTS 8
+
+// What JpegFrameParser found in a frame, stored next to it
+struct SharedFrameInfo
+{
+    uint64_t frameNumber;
+    int64_t  seconds;          // presentation time
+    uint32_t microseconds;
+    uint32_t length;           // bytes of JPEG data
+    uint32_t scanOffset;       // offset of the entropy-coded data
+    uint16_t width;            // pixels
+    uint16_t height;
+    uint16_t restartInterval;
+    uint16_t qTablesLength;
+    uint8_t  type;             // RTP/JPEG type, +64 with restart markers
+    uint8_t  qFactor;
+    uint8_t  precision;
+    uint8_t  hasHuffmanTables; // 0: no DHT, the standard tables apply
+    uint8_t  qTables[256];
+};
+
+// The object is laid out as a header followed by "slotCount" slots, frame
+// n going to slot n % slotCount.  Each slot is guarded by a seqlock: its
+// sequence is odd while the writer fills it and 2n + 2 once it holds frame
+// n.  Readers map the object read-only, so they can never hold up the
+// writer; a reader that falls behind finds its frame overwritten.
+class SharedFrameRing : public JpegFrameConsumer
+{
+public:
+    // Writer side: creates /dev/shm/<name>.  A ring left behind by a writer
+    // that is gone is replaced; one whose writer still runs (or anything
+    // else of that name) makes it fail with EEXIST.  Returns NULL with
+    // errno set on failure.
+    static SharedFrameRing* create(char const* name, unsigned int slotCount,
+                                   unsigned int slotSize);
+    // Reader side: maps an existing ring.
+    static SharedFrameRing* attach(char const* name);
+    virtual ~SharedFrameRing(); // the writer also removes the name
+
+    // Writer: publishes the frame "parser" has just parsed.  Frames larger
+    // than a slot are dropped.
+    int write(JpegFrameParser& parser, struct timeval presentationTime);
+    virtual void consumeJpegFrame(JpegFrameParser& parser,
+                                  struct timeval presentationTime);
+    unsigned long droppedFrames() const { return _droppedFrames; }
+
+    // Reader: number of the next frame to be written (the latest complete
+    // one is framesWritten() - 1)
+    uint64_t framesWritten() const;
+    unsigned int slotCount() const;
+    unsigned int slotSize() const;
+    // Copies frame "frameNumber" out of the ring.  Returns -1 if it hasn't
+    // been written yet or has already been (or is being) overwritten.
+    int read(uint64_t frameNumber, std::vector<unsigned char>& jpeg,
+             SharedFrameInfo& info) const;
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slotCount;
+        uint32_t slotSize;     // bytes of JPEG data per slot
+        uint64_t slotStride;   // bytes from one slot to the next
+        int32_t writerPid;
+        std::atomic<uint64_t> framesWritten;
+    };
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        SharedFrameInfo info;
+        // followed by slotSize bytes of JPEG data
+    };
+
+    SharedFrameRing(char const* name, void* base, size_t size, bool writer);
+    static bool isStale(char const* shm);
+    Slot* slot(uint64_t frameNumber) const;
+
+private:
+    char* _name;
+    void* _base;
+    size_t _size;
+    bool _writer;
+    Header* _header;
+    unsigned long _droppedFrames;
+};
+
+#endif // _SHARED_FRAME_RING_HH_INCLUDED
@@ -0,0 +1,279 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// HTTP endpoint returning the latest captured frame as a JPEG still
+// Implementation
+
+#include "SnapshotServer.hh"
+#include "JpegFrameParser.hh"
+#include "JpegHuffman.hh"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_REQUEST_SIZE 2048
+
+static long long monotonicMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000LL + now.tv_nsec/1000000;
+}
+
+// Waits until "client" is ready for "events" or "deadline" (monotonicMs())
+// has passed.  Returns -1 in the latter case.
+static int waitUntil(int client, short events, long long deadline)
+{
+    for (;;) {
+        long long left = deadline - monotonicMs();
+        if (left <= 0)
+            return -1;
+        struct pollfd pfd = { client, events, 0 };
+        int n = poll(&pfd, 1, (int)left);
+        if (n > 0)
+            return 0;
+        if (n < 0 && errno != EINTR)
+            return -1;
+    }
+}
+
+// Sends all of "iov" before "deadline".  sendmsg() is writev() that can be
+// told not to block or raise SIGPIPE.
+static int sendAll(int client, struct iovec* iov, int count, long long deadline)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(client, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno != EAGAIN && errno != EWOULDBLOCK)
+                || waitUntil(client, POLLOUT, deadline) != 0)
+                return -1;
+            continue;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static void sendStatus(int client, char const* response, long long deadline)
+{
+    struct iovec iov;
+    iov.iov_base = (void*)response;
+    iov.iov_len = strlen(response);
+    sendAll(client, &iov, 1, deadline);
+}
+
+SnapshotServer* SnapshotServer::create(unsigned short port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+        return NULL;
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(sock, 16) != 0) {
+        int e = errno;
+        ::close(sock);
+        errno = e;
+        return NULL;
+    }
+    return new SnapshotServer(sock);
+}
+
+SnapshotServer::SnapshotServer(int socket) :
+    _socket(socket), _wanted(false), _ready(false), _stopping(false),
+    _requestsServed(0)
+{
+    jpegWriteDHT(_huffmanTables, HUFFMAN_DC, 0, jpegStandardHuffmanTable(HUFFMAN_DC, 0));
+    jpegWriteDHT(_huffmanTables, HUFFMAN_AC, 0, jpegStandardHuffmanTable(HUFFMAN_AC, 0));
+    jpegWriteDHT(_huffmanTables, HUFFMAN_DC, 1, jpegStandardHuffmanTable(HUFFMAN_DC, 1));
+    jpegWriteDHT(_huffmanTables, HUFFMAN_AC, 1, jpegStandardHuffmanTable(HUFFMAN_AC, 1));
+    _thread = std::thread(&SnapshotServer::run, this);
+}
+
+SnapshotServer::~SnapshotServer()
+{
+    _stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _readyCond.notify_all();
+    }
+    // makes the blocked accept() fail
+    shutdown(_socket, SHUT_RDWR);
+    _thread.join();
+    ::close(_socket);
+}
+
+// On the event loop
+void SnapshotServer::consumeJpegFrame(JpegFrameParser& parser,
+                                      struct timeval /*presentationTime*/)
+{
+    if (!_wanted.load(std::memory_order_acquire))
+        return;
+    // the server thread stays off _snapshot until _ready: assign() reuses
+    // the buffer of the previous request
+    unsigned int length;
+    unsigned char const* frame = parser.frame(length);
+    _snapshot.jpeg.assign(frame, frame + length);
+    _snapshot.sosOffset = parser.sosOffset();
+    _snapshot.hasHuffmanTables = parser.hasHuffmanTables();
+    _wanted.store(false, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _ready = true;
+    _readyCond.notify_one();
+}
+
+// Asks the event loop for the next frame.  Returns false if none came
+// within SNAPSHOT_FRAME_WAIT (e.g. the capture is stalled) or "deadline".
+bool SnapshotServer::waitForFrame(long long deadline)
+{
+    long long now = monotonicMs();
+    if (deadline > now + SNAPSHOT_FRAME_WAIT*1000)
+        deadline = now + SNAPSHOT_FRAME_WAIT*1000;
+    std::unique_lock<std::mutex> lock(_mutex);
+    _ready = false;
+    _wanted.store(true, std::memory_order_release);
+    while (!_ready && !_stopping) {
+        now = monotonicMs();
+        if (now >= deadline)
+            return false; // a copy still under way is picked up next time
+        _readyCond.wait_for(lock, std::chrono::milliseconds(deadline - now));
+    }
+    return _ready;
+}
+
+void SnapshotServer::run()
+{
+    while (!_stopping) {
+        int client = accept(_socket, NULL, NULL);
+        if (client < 0) {
+            if (_stopping)
+                break;
+            if (errno != EINTR && errno != ECONNABORTED) {
+                // e.g. EMFILE or ENOBUFS, which pass as other programs
+                // release what they hold: try again a little later
+                perror("SnapshotServer: accept");
+                usleep(100000);
+            }
+            continue;
+        }
+        serve(client);
+        ::close(client);
+    }
+}
+
+// Reading the request and sending the response must be done within
+// SNAPSHOT_IO_TIMEOUT seconds altogether, so that a slow (or malicious)
+// client holds up the requests queued behind it for that long at most.
+void SnapshotServer::serve(int client)
+{
+    long long deadline = monotonicMs() + SNAPSHOT_IO_TIMEOUT*1000;
+    char request[MAX_REQUEST_SIZE + 1];
+    size_t length = 0;
+    while (length < MAX_REQUEST_SIZE) {
+        ssize_t n = recv(client, request + length, MAX_REQUEST_SIZE - length,
+                         MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno != EAGAIN && errno != EWOULDBLOCK)
+                || waitUntil(client, POLLIN, deadline) != 0)
+                return;
+            continue;
+        }
+        if (n == 0)
+            return;
+        length += n;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+    request[length] = '\0';
+
+    char method[8], path[256];
+    if (sscanf(request, "%7s %255s", method, path) != 2) {
+        sendStatus(client, "HTTP/1.0 400 Bad Request\r\nConnection: close\r\n\r\n",
+                   deadline);
+        return;
+    }
+    char* query = strchr(path, '?');
+    if (query != NULL)
+        *query = '\0';
+    if (strcmp(method, "GET") != 0
+        || (strcmp(path, "/") != 0 && strcmp(path, "/snapshot.jpg") != 0)) {
+        sendStatus(client, "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n",
+                   deadline);
+        return;
+    }
+
+    if (!waitForFrame(deadline)) {
+        sendStatus(client, "HTTP/1.0 503 Service Unavailable\r\nRetry-After: 1\r\n"
+                           "Connection: close\r\n\r\n", deadline);
+        return;
+    }
+
+    // header | tables up to SOS | [standard DHT] | SOS and scan
+    Snapshot const& s = _snapshot;
+    bool splice = !s.hasHuffmanTables && s.sosOffset != 0;
+    size_t split = splice ? s.sosOffset : s.jpeg.size();
+    size_t total = s.jpeg.size() + (splice ? _huffmanTables.size() : 0);
+    char header[160];
+    int headerLength = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: image/jpeg\r\n"
+        "Content-Length: %zu\r\nCache-Control: no-cache\r\n"
+        "Connection: close\r\n\r\n", total);
+
+    struct iovec iov[4];
+    int count = 0;
+    iov[count].iov_base = header;
+    iov[count++].iov_len = headerLength;
+    iov[count].iov_base = (void*)&s.jpeg[0];
+    iov[count++].iov_len = split;
+    if (splice) {
+        iov[count].iov_base = (void*)&_huffmanTables[0];
+        iov[count++].iov_len = _huffmanTables.size();
+        iov[count].iov_base = (void*)&s.jpeg[split];
+        iov[count++].iov_len = s.jpeg.size() - split;
+    }
+    if (sendAll(client, iov, count, deadline) == 0)
+        _requestsServed++;
+}
@@ -0,0 +1,85 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// HTTP endpoint returning the latest captured frame as a JPEG still
+// C++ header
+
+#ifndef _SNAPSHOT_SERVER_HH_INCLUDED
+#define _SNAPSHOT_SERVER_HH_INCLUDED
+
+#include "JpegFrameConsumer.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SNAPSHOT_IO_TIMEOUT 5 // seconds a client may take for a whole request
+#define SNAPSHOT_FRAME_WAIT 2 // seconds a request waits for the next frame
+
+// Answers "GET /" and "GET /snapshot.jpg" with the latest frame, e.g.
+//   curl -o still.jpg http://camera:8080/snapshot.jpg
+// Requests are served one after another by a thread of the server's own,
+// each within SNAPSHOT_IO_TIMEOUT.  A request raises a "wanted" flag and
+// is answered with the next frame, which the event loop copies into the
+// one snapshot buffer; every other frame costs the event loop an atomic
+// load, and no request ever holds up the capture.
+// The frame goes out as stored: a response is one writev() of the HTTP
+// header, the frame's tables, and its scan.  Frames without a DHT segment
+// (most MJPEG webcams) get the standard Huffman tables spliced in before
+// the SOS marker from a segment built once, so they open anywhere.
+class SnapshotServer : public JpegFrameConsumer
+{
+public:
+    // Listens on "port" of all interfaces.  Returns NULL with errno set on
+    // failure.
+    static SnapshotServer* create(unsigned short port);
+    virtual ~SnapshotServer(); // stops the thread
+
+    virtual void consumeJpegFrame(JpegFrameParser& parser,
+                                  struct timeval presentationTime);
+    unsigned long requestsServed() const { return _requestsServed.load(); }
+
+private:
+    struct Snapshot
+    {
+        std::vector<unsigned char> jpeg;
+        unsigned int sosOffset;
+        bool hasHuffmanTables;
+    };
+
+    SnapshotServer(int socket);
+    void run();
+    void serve(int client);
+    bool waitForFrame(long long deadline);
+
+private:
+    int _socket;
+    std::vector<unsigned char> _huffmanTables; // DHT segments to splice in
+    // _snapshot is written by the event loop only while _wanted is set,
+    // and read by the server thread only once _ready is
+    Snapshot _snapshot;
+    std::atomic<bool> _wanted;
+    bool _ready;                               // under _mutex
+    std::mutex _mutex;
+    std::condition_variable _readyCond;
+    std::atomic<bool> _stopping;
+    std::atomic<unsigned long> _requestsServed;
+    std::thread _thread;
+};
+
+#endif // _SNAPSHOT_SERVER_HH_INCLUDED
@@ -0,0 +1,219 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Local control socket for changing the capture mode at runtime
+// Implementation
+
+#include "WebcamControlServer.hh"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_COMMAND_SIZE 512
+
+WebcamControlServer*
+WebcamControlServer::createNew(UsageEnvironment& env,
+                               WebcamJPEGDeviceSource* source,
+                               unsigned short port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0) {
+        env.setResultErrMsg("Failed to create the control socket: ");
+        return NULL;
+    }
+    // loopback only: anyone who can reach the socket controls the camera
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        env.setResultErrMsg("Failed to bind the control socket: ");
+        ::close(sock);
+        return NULL;
+    }
+    return new WebcamControlServer(env, sock, source);
+}
+
+WebcamControlServer::WebcamControlServer(UsageEnvironment& env, int socket,
+                                         WebcamJPEGDeviceSource* source)
+  : Medium(env), fSocket(socket), fSource(source), fSink(NULL),
+    fUnicastSubsession(NULL), fQualityController(NULL)
+{
+    memset(&fPendingClient, 0, sizeof(fPendingClient));
+    env.taskScheduler().turnOnBackgroundReadHandling(fSocket,
+                            incomingCommandHandler, this);
+}
+
+WebcamControlServer::~WebcamControlServer()
+{
+    fSource->forgetReconfigureHandler(this);
+    envir().taskScheduler().turnOffBackgroundReadHandling(fSocket);
+    ::close(fSocket);
+}
+
+void WebcamControlServer::incomingCommandHandler(void* clientData, int /*mask*/)
+{
+    WebcamControlServer* server = (WebcamControlServer*)clientData;
+    char command[MAX_COMMAND_SIZE];
+    struct sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+
+    ssize_t len = recvfrom(server->fSocket, command, sizeof(command) - 1, 0,
+                           (struct sockaddr*)&from, &fromLen);
+    if(len < 0)
+        return;
+    command[len] = '\0';
+    while(len > 0 && (command[len - 1] == '\n' || command[len - 1] == '\r'))
+        command[--len] = '\0';
+
+    std::string reply;
+    server->handleCommand(command, from, reply);
+    reply += "\n";
+    sendto(server->fSocket, reply.data(), reply.size(), 0,
+           (struct sockaddr*)&from, fromLen);
+}
+
+void WebcamControlServer::handleCommand(char* command,
+                                        struct sockaddr_in const& from,
+                                        std::string& reply)
+{
+    char* args = command + strcspn(command, " \t");
+    if(*args != '\0')
+        *args++ = '\0';
+
+    if(strcmp(command, "set") == 0) {
+        handleSet(args, from, reply);
+    } else if(strcmp(command, "status") == 0) {
+        handleStatus(reply);
+    } else {
+        reply = "ERR unknown command \"";
+        reply += command;
+        reply += "\"";
+    }
+}
+
+void WebcamControlServer::handleSet(char* args, struct sockaddr_in const& from,
+                                    std::string& reply)
+{
+    unsigned width = 0, height = 0, fps = 0, q, fec = 0;
+    int quality = -1, unicastQuality = -1;
+
+    for(char* arg = strtok(args, " \t"); arg != NULL; arg = strtok(NULL, " \t")) {
+        if(sscanf(arg, "width=%u", &width) == 1
+           || sscanf(arg, "height=%u", &height) == 1) {
+            continue;
+        }
+        if(sscanf(arg, "quality=%u", &q) == 1) {
+            quality = (int)q;
+            continue;
+        }
+        if(sscanf(arg, "unicast_quality=%u", &q) == 1 && q <= 99) {
+            if(fUnicastSubsession == NULL) {
+                reply = "ERR no unicast streams";
+                return;
+            }
+            unicastQuality = (int)q;
+            continue;
+        }
+        if(sscanf(arg, "fps=%u", &fps) == 1 && fps != 0) {
+            continue;
+        }
+        if(sscanf(arg, "fec=%u", &fec) == 1 && fec != 0) {
+            if(fSink == NULL || fSink->fecGroupSize() == 0) {
+                reply = "ERR FEC is not enabled";
+                return;
+            }
+            continue;
+        }
+        reply = "ERR bad argument \"";
+        reply += arg;
+        reply += "\"";
+        return;
+    }
+
+    if(fec != 0)
+        fSink->setFecGroupSize(fec);
+    if(unicastQuality >= 0)
+        fUnicastSubsession->setQuality(unicastQuality);
+    if(width != 0 || height != 0 || fps != 0 || quality >= 0) {
+        unsigned timePerFrame = fps != 0 ? 1000000/fps : 0;
+        int result = fSource->reconfigure(width, height, timePerFrame, quality,
+                                          reconfigureDone, this);
+        if(result < 0) {
+            reply = "ERR ";
+            reply += envir().getResultMsg();
+            return;
+        }
+        if(result > 0) {
+            fPendingClient = from;
+            reply = "PENDING";
+            return;
+        }
+    }
+    reply = "OK";
+}
+
+// The outcome of a pending "set", to the client that sent it
+void WebcamControlServer::reconfigureDone(void* clientData, int result)
+{
+    WebcamControlServer* server = (WebcamControlServer*)clientData;
+    std::string reply = "OK\n";
+    if(result != 0) {
+        reply = "ERR ";
+        reply += server->envir().getResultMsg();
+        reply += "\n";
+    }
+    sendto(server->fSocket, reply.data(), reply.size(), 0,
+           (struct sockaddr*)&server->fPendingClient, sizeof(server->fPendingClient));
+}
+
+void WebcamControlServer::handleStatus(std::string& reply)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "OK width=%u height=%u fps=%u gap_ms=%u suppressed=%lu fec=%u"
+             " unicast_quality=%d",
+             fSource->captureWidth(), fSource->captureHeight(),
+             1000000/fSource->timePerFrame(),
+             fSource->lastReconfigureGap()/1000,
+             fSource->suppressedFrames(),
+             fSink ? fSink->fecGroupSize() : 0,
+             fUnicastSubsession ? fUnicastSubsession->quality() : 0);
+    reply = buf;
+    if(fQualityController != NULL) {
+        snprintf(buf, sizeof(buf), " quality=%d loss=%u adapt=%s changes=%lu",
+                 fSource->quality(), fQualityController->lastLossPercent(),
+                 fQualityController->lastAction(),
+                 fQualityController->numChanges());
+        reply += buf;
+    }
+    // last, as the message has spaces in it
+    char const* error = fSource->lastReconfigureError();
+    if(fSource->reconfigurePending()) {
+        reply += " reconfigure=pending";
+    } else if(error[0] != '\0') {
+        reply += " reconfigure=failed error=\"";
+        reply += error;
+        reply += "\"";
+    } else {
+        reply += " reconfigure=ok";
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Local control socket for changing the capture mode at runtime
+// C++ header
+
+#ifndef _WEBCAM_CONTROL_SERVER_HH
+#define _WEBCAM_CONTROL_SERVER_HH
+
+#include "Media.hh"
+#include "AdaptiveQualityController.hh"
+#include "WebcamJPEGDeviceSource.hh"
+#include "WebcamJPEGRTPSink.hh"
+#include "WebcamServerMediaSubsession.hh"
+
+#include <netinet/in.h>
+#include <string>
+
+// Answers one-line text datagrams sent to 127.0.0.1:<port>, e.g.
+//   echo "set width=1280 height=720 fps=15" | nc -u -w1 127.0.0.1 7071
+// Commands:
+//   set [width=<w>] [height=<h>] [fps=<f>] [quality=<0..100>]
+//       [fec=<group-size>] [unicast_quality=<0..99>]
+//   status
+// Every command gets a one-line reply starting with "OK" or "ERR", except a
+// "set" whose capture mode change has to wait for a frame on the worker
+// pool: that gets "PENDING" at once, then "OK" or "ERR" in a second
+// datagram once the change has been applied.  "status" reports the
+// outcome of the last change too.
+class WebcamControlServer: public Medium {
+public:
+    static WebcamControlServer* createNew(UsageEnvironment& env,
+                                          WebcamJPEGDeviceSource* source,
+                                          unsigned short port);
+
+    void setRTPSink(WebcamJPEGRTPSink* sink) { fSink = sink; }
+    // needed for the FEC settings
+    void setUnicastSubsession(WebcamServerMediaSubsession* subsession)
+    { fUnicastSubsession = subsession; }
+    // needed for the unicast streams' quality
+    void setQualityController(AdaptiveQualityController* controller)
+    { fQualityController = controller; }
+    // reported by "status"
+
+protected:
+    WebcamControlServer(UsageEnvironment& env, int socket,
+                        WebcamJPEGDeviceSource* source);
+    // called only by createNew()
+    virtual ~WebcamControlServer();
+
+private:
+    static void incomingCommandHandler(void* clientData, int mask);
+    void handleCommand(char* command, struct sockaddr_in const& from,
+                       std::string& reply);
+    void handleSet(char* args, struct sockaddr_in const& from,
+                   std::string& reply);
+    static void reconfigureDone(void* clientData, int result);
+    void handleStatus(std::string& reply);
+
+private:
+    int fSocket;
+    WebcamJPEGDeviceSource* fSource;
+    WebcamJPEGRTPSink* fSink;
+    WebcamServerMediaSubsession* fUnicastSubsession;
+    AdaptiveQualityController* fQualityController;
+    struct sockaddr_in fPendingClient; // of the pending "set"
+};
+
+#endif // _WEBCAM_CONTROL_SERVER_HH
@@ -31,8 +31,12 @@
 #endif
 
 #include "JpegFrameParser.hh"
+#include "FrameFingerprint.hh"
+#include "WebcamTrace.hh"
 #include <algorithm> 
 #include <iostream>
+#include <math.h>
+#include <string>
 
 #ifndef JPEG_TEST
 static int xioctl(int fh, int request, void *arg);
@@ -51,17 +55,20 @@ static int xioctl(int fh, int request, void *arg)
 
 WebcamJPEGDeviceSource*
 WebcamJPEGDeviceSource::createNew(UsageEnvironment& env,
-				  unsigned timePerFrame) {
+				  unsigned timePerFrame, char const* deviceName,
+				  unsigned width, unsigned height,
+				  char const* probeCacheFile) {
     int fd = -1;
 #ifndef JPEG_TEST
-    fd = open("/dev/video0", O_RDWR, 0); // TODO: use argv instead of hardcoded dev
+    fd = open(deviceName, O_RDWR, 0);
     if (fd == -1) {
         env.setResultErrMsg("Failed to open input device file");
         return NULL;
     }
 #endif
     try {
-        return new WebcamJPEGDeviceSource(env, fd, timePerFrame);
+        return new WebcamJPEGDeviceSource(env, fd, timePerFrame,
+                                          width, height, probeCacheFile);
     } catch (DeviceException) {
         return NULL;
     }
@@ -73,7 +80,6 @@ int WebcamJPEGDeviceSource::initDevice(UsageEnvironment& env, int fd)
     struct v4l2_capability cap;
     struct v4l2_cropcap cropcap;
     struct v4l2_crop crop;
-    struct v4l2_format fmt;
     if(-1 == xioctl(fd, VIDIOC_QUERYCAP, &cap)) {
         env.setResultErrMsg("QueryCap failed");
         return -1;
@@ -101,7 +107,104 @@ int WebcamJPEGDeviceSource::initDevice(UsageEnvironment& env, int fd)
             }
         }
     }
-    
+
+    CaptureMode mode;
+    if(fRequestedWidth != 0 && fRequestedHeight != 0) {
+        // explicit mode selection: go straight to S_FMT; a camera without
+        // MJPEG answers with a raw format, which startCapture() accepts
+        mode.pixelFormat = V4L2_PIX_FMT_MJPEG;
+        mode.width = fRequestedWidth;
+        mode.height = fRequestedHeight;
+        mode.intervalNum = fTimePerFrame;
+        mode.intervalDen = 1000000;
+        if(startCapture(env, fd, mode) != 0)
+            return -1;
+        // no probe: reconfigure() stays within this mode's frame size
+        fFrameSizeLimit = fSizeImage;
+        return 0;
+    }
+
+    // The probe results are cached per device; the key changes whenever
+    // a different camera (or driver) shows up on the same port.
+    char deviceKey[sizeof(cap.bus_info) + sizeof(cap.driver) + 16];
+    snprintf(deviceKey, sizeof(deviceKey), "%s/%s/%u",
+             cap.bus_info, cap.driver, cap.version);
+    for(char* c = deviceKey; *c; c++) {
+        if(*c == ' ' || *c == '\t' || *c == '\n')
+            *c = '_';
+    }
+
+    std::vector<CaptureMode> modes;
+    if(fProbeCache != NULL && fProbeCache->lookup(deviceKey, modes) == 0
+       && selectMode(modes, mode) == 0) {
+        if(startCapture(env, fd, mode) == 0) {
+            fFrameSizeLimit = largestFrameSize(fd, modes);
+            return 0;
+        }
+        stopCapture(fd);
+        // stale entry, e.g. after a firmware update: probe again
+        fProbeCache->invalidate(deviceKey);
+    }
+
+    if(probeModes(fd, modes) != 0) {
+        env.setResultErrMsg("This webcam supports neither MJPEG nor YUYV/NV12!");
+        return -1;
+    }
+    if(modes.empty()) {
+        env.setResultErrMsg("Failed to find an appropriate frame size!");
+        return -1;
+    }
+    if(selectMode(modes, mode) != 0) {
+        env.setResultErrMsg("Failed to find an appropriate frame rate!");
+        return -1;
+    }
+    if(startCapture(env, fd, mode) != 0)
+        return -1;
+    fFrameSizeLimit = largestFrameSize(fd, modes);
+    if(fProbeCache != NULL)
+        fProbeCache->store(deviceKey, modes);
+    return 0;
+}
+
+// The largest "sizeimage" among the sizes reconfigure() can switch to:
+// those of "modes" in the current pixel format, up to 2040x2040.  The
+// driver reports it for VIDIOC_TRY_FMT, which leaves the device alone.
+unsigned WebcamJPEGDeviceSource::largestFrameSize(int fd,
+                                                  std::vector<CaptureMode> const& modes)
+{
+    unsigned largest = fSizeImage;
+    for(size_t i = 0; i < modes.size(); i++) {
+        CaptureMode const& m = modes[i];
+        if(m.pixelFormat != fMode.pixelFormat || m.width > 2040 || m.height > 2040)
+            continue;
+        if(i > 0 && modes[i-1].pixelFormat == m.pixelFormat
+           && modes[i-1].width == m.width && modes[i-1].height == m.height)
+            continue; // another frame interval of the same size
+        struct v4l2_format fmt;
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = m.width;
+        fmt.fmt.pix.height = m.height;
+        fmt.fmt.pix.pixelformat = m.pixelFormat;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        if(-1==xioctl(fd, VIDIOC_TRY_FMT, &fmt))
+            continue;
+        unsigned size = fmt.fmt.pix.sizeimage;
+        if(size == 0) // what most drivers reserve for MJPEG and YUYV
+            size = 2*fmt.fmt.pix.width*fmt.fmt.pix.height;
+        largest = std::max(largest, size);
+    }
+    return largest;
+}
+
+// Walks VIDIOC_ENUM_FMT, VIDIOC_ENUM_FRAMESIZES and VIDIOC_ENUM_FRAMEINTERVALS
+// and records every size/interval combination the device offers in MJPEG
+// or in a raw format we can encode ourselves.
+int WebcamJPEGDeviceSource::probeModes(int fd, std::vector<CaptureMode>& modes)
+{
+    modes.clear();
+
+    std::vector<__u32> formats;
     struct v4l2_fmtdesc fmtdesc;
     memset(&fmtdesc, 0, sizeof(fmtdesc));
     fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -112,87 +215,163 @@ int WebcamJPEGDeviceSource::initDevice(UsageEnvironment& env, int fd)
             }
             continue;
         }
-        if(fmtdesc.pixelformat == V4L2_PIX_FMT_MJPEG) {
-            break;
+        if(fmtdesc.pixelformat == V4L2_PIX_FMT_MJPEG
+           || RawFrameEncoder::supportsFormat(fmtdesc.pixelformat)) {
+            formats.push_back(fmtdesc.pixelformat);
         }
     }
-    if(fmtdesc.pixelformat != V4L2_PIX_FMT_MJPEG) {
-        env.setResultErrMsg("This webcam does not support MJPEG!");
+    if(formats.empty()) {
         return -1;
     }
+    for(size_t i = 0; i < formats.size(); i++)
+        probeFormat(fd, formats[i], modes);
+    return 0;
+}
+
+int WebcamJPEGDeviceSource::probeFormat(int fd, unsigned pixelFormat,
+                                        std::vector<CaptureMode>& modes)
+{
+    std::vector<std::pair<__u32, __u32> > sizes;
     struct v4l2_frmsizeenum frmsize;
     memset(&frmsize, 0, sizeof(frmsize));
-    frmsize.pixel_format = V4L2_PIX_FMT_MJPEG;
-    __u32 best_width=0, best_height=0, best_diff=0xffffffff;
-    __u32 diff;
+    frmsize.pixel_format = pixelFormat;
     for(frmsize.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmsize) >= 0; frmsize.index++) {
         if(frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
-            diff = abs(frmsize.discrete.width-640) + abs(frmsize.discrete.height-480);
-            if(diff<best_diff) {
-                best_diff = diff;
-                best_width = frmsize.discrete.width;
-                best_height = frmsize.discrete.height;
-            }
+            sizes.push_back(std::make_pair(frmsize.discrete.width, frmsize.discrete.height));
         } else {
-            if(frmsize.stepwise.min_width >= 640) {
-                best_width = frmsize.stepwise.min_width;
-            } else if(frmsize.stepwise.max_width <= 640) {
-                best_width = frmsize.stepwise.max_width;
+            // stepwise/continuous: keep the size nearest the target only
+            __u32 target_width = 640, target_height = 480;
+            __u32 width, height;
+            if(frmsize.stepwise.min_width >= target_width) {
+                width = frmsize.stepwise.min_width;
+            } else if(frmsize.stepwise.max_width <= target_width) {
+                width = frmsize.stepwise.max_width;
             } else {
-                best_width = (640-frmsize.stepwise.min_width)/frmsize.stepwise.step_width*frmsize.stepwise.step_width + frmsize.stepwise.min_width;
+                width = (target_width-frmsize.stepwise.min_width)/frmsize.stepwise.step_width*frmsize.stepwise.step_width + frmsize.stepwise.min_width;
             }
-            if(frmsize.stepwise.min_height >= 480) {
-                best_height = frmsize.stepwise.min_height;
-            } else if(frmsize.stepwise.max_height <= 480) {
-                best_height = frmsize.stepwise.max_height;
+            if(frmsize.stepwise.min_height >= target_height) {
+                height = frmsize.stepwise.min_height;
+            } else if(frmsize.stepwise.max_height <= target_height) {
+                height = frmsize.stepwise.max_height;
             } else {
-                best_height = (480-frmsize.stepwise.min_height)/frmsize.stepwise.step_height*frmsize.stepwise.step_height + frmsize.stepwise.min_height;
+                height = (target_height-frmsize.stepwise.min_height)/frmsize.stepwise.step_height*frmsize.stepwise.step_height + frmsize.stepwise.min_height;
             }
-            best_diff = 0;
+            sizes.push_back(std::make_pair(width, height));
             break;
         }
     }
-    if(best_diff == 0xffffffff) {
-        env.setResultErrMsg("Failed to find an appropriate frame size!");
-        return -1;
-    }
-    
-    struct v4l2_frmivalenum frmival;
-    memset(&frmival, 0, sizeof(frmival));
-    frmival.index = 0;
-    frmival.pixel_format = V4L2_PIX_FMT_MJPEG;
-    frmival.width = best_width;
-    frmival.height = best_height;
-    __u32 best_ival_num=0, best_ival_den=0;
-    float best_ival_diff = 1e6, ival_diff;
-    for(frmival.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival)>=0; frmival.index++) {
-        if(frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
-            ival_diff = abs((float)frmival.discrete.numerator/frmival.discrete.denominator - 0.1);
-            if(ival_diff<best_ival_diff) {
-                best_ival_diff = ival_diff;
-                best_ival_num = frmival.discrete.numerator;
-                best_ival_den = frmival.discrete.denominator;
+
+    for(size_t i = 0; i < sizes.size(); i++) {
+        CaptureMode mode;
+        mode.pixelFormat = pixelFormat;
+        mode.width = sizes[i].first;
+        mode.height = sizes[i].second;
+
+        struct v4l2_frmivalenum frmival;
+        memset(&frmival, 0, sizeof(frmival));
+        frmival.pixel_format = pixelFormat;
+        frmival.width = mode.width;
+        frmival.height = mode.height;
+        for(frmival.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival)>=0; frmival.index++) {
+            if(frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+                mode.intervalNum = frmival.discrete.numerator;
+                mode.intervalDen = frmival.discrete.denominator;
+                if(mode.intervalNum != 0 && mode.intervalDen != 0)
+                    modes.push_back(mode);
+            } else {
+                // stepwise/continuous: the bounds are enough to choose from
+                mode.intervalNum = frmival.stepwise.min.numerator;
+                mode.intervalDen = frmival.stepwise.min.denominator;
+                if(mode.intervalNum != 0 && mode.intervalDen != 0)
+                    modes.push_back(mode);
+                mode.intervalNum = frmival.stepwise.max.numerator;
+                mode.intervalDen = frmival.stepwise.max.denominator;
+                if(mode.intervalNum != 0 && mode.intervalDen != 0)
+                    modes.push_back(mode);
+                break;
             }
-        } else {
-            break;
         }
     }
-    if(best_ival_diff > 1e5) {
-        env.setResultErrMsg("Failed to find an appropriate frame rate!");
-        return -1;
+    return 0;
+}
+
+// Picks the size nearest 640x480 and, for that size, the frame interval
+// nearest "fTimePerFrame".  MJPEG modes win over raw ones, which cost a
+// JPEG encode per frame; among raw formats, YUYV wins over NV12.
+int WebcamJPEGDeviceSource::selectMode(std::vector<CaptureMode> const& modes,
+                                       CaptureMode& best)
+{
+    int target_width = 640, target_height = 480;
+    float target_ival = fTimePerFrame/1000000.0;
+    __u32 best_diff = 0xffffffff, diff;
+    float best_ival_diff = 1e6, ival_diff;
+
+    __u32 format = V4L2_PIX_FMT_NV12;
+    for(size_t i = 0; i < modes.size(); i++) {
+        if(modes[i].pixelFormat == V4L2_PIX_FMT_MJPEG)
+            format = V4L2_PIX_FMT_MJPEG;
+        else if(modes[i].pixelFormat == V4L2_PIX_FMT_YUYV && format != V4L2_PIX_FMT_MJPEG)
+            format = V4L2_PIX_FMT_YUYV;
     }
-    
+    for(size_t i = 0; i < modes.size(); i++) {
+        CaptureMode const& m = modes[i];
+        if(m.pixelFormat != format)
+            continue;
+        if(format != V4L2_PIX_FMT_MJPEG && (m.width > 2040 || m.height > 2040))
+            continue; // too large for RTP/JPEG
+        diff = abs((int)m.width-target_width) + abs((int)m.height-target_height);
+        ival_diff = fabsf((float)m.intervalNum/m.intervalDen - target_ival);
+        if(diff<best_diff || (diff==best_diff && ival_diff<best_ival_diff)) {
+            best_diff = diff;
+            best_ival_diff = ival_diff;
+            best = m;
+        }
+    }
+    return best_diff == 0xffffffff ? -1 : 0;
+}
+
+int WebcamJPEGDeviceSource::startCapture(UsageEnvironment& env, int fd,
+                                         CaptureMode const& mode)
+{
+    struct v4l2_format fmt;
     memset(&fmt, 0, sizeof(fmt));
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = best_width;
-    fmt.fmt.pix.height = best_height;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+    fmt.fmt.pix.width = mode.width;
+    fmt.fmt.pix.height = mode.height;
+    fmt.fmt.pix.pixelformat = mode.pixelFormat;
     fmt.fmt.pix.field = V4L2_FIELD_NONE;
     if (-1==xioctl(fd, VIDIOC_S_FMT, &fmt)) {
-        env.setResultErrMsg("Set format MJPEG failed");
+        env.setResultErrMsg("Set format failed");
         return -1;
     }
-    
+    if(fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG
+       && !RawFrameEncoder::supportsFormat(fmt.fmt.pix.pixelformat)) {
+        env.setResultErrMsg("This webcam supports neither MJPEG nor YUYV/NV12!");
+        return -1;
+    }
+    // the driver may have adjusted the size, or the format
+    fMode = mode;
+    fMode.pixelFormat = fmt.fmt.pix.pixelformat;
+    fMode.width = fmt.fmt.pix.width;
+    fMode.height = fmt.fmt.pix.height;
+    fSizeImage = fmt.fmt.pix.sizeimage;
+    fBytesPerLine = fmt.fmt.pix.bytesperline;
+    if(fBytesPerLine == 0)
+        fBytesPerLine = fMode.pixelFormat == V4L2_PIX_FMT_YUYV ? 2*fMode.width : fMode.width;
+
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = mode.intervalNum;
+    parm.parm.capture.timeperframe.denominator = mode.intervalDen;
+    if(-1==xioctl(fd, VIDIOC_S_PARM, &parm)) {
+        // not fatal: the device keeps its default frame rate
+    } else if(parm.parm.capture.timeperframe.numerator != 0
+              && parm.parm.capture.timeperframe.denominator != 0) {
+        fMode.intervalNum = parm.parm.capture.timeperframe.numerator;
+        fMode.intervalDen = parm.parm.capture.timeperframe.denominator;
+    }
+
     struct v4l2_requestbuffers req;
     memset(&req, 0, sizeof(req));
     req.count = 4;
@@ -222,6 +401,8 @@ int WebcamJPEGDeviceSource::initDevice(UsageEnvironment& env, int fd)
             return -1;
         }
         fBuffers[fNbuffers].length = buf.length;
+        if(fSizeImage == 0 || fSizeImage > buf.length)
+            fSizeImage = buf.length; // some drivers leave sizeimage at 0
         fBuffers[fNbuffers].start = mmap(NULL, buf.length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
         if(MAP_FAILED == fBuffers[fNbuffers].start) {
             env.setResultErrMsg("mmap failed");
@@ -229,7 +410,7 @@ int WebcamJPEGDeviceSource::initDevice(UsageEnvironment& env, int fd)
         }
     }
     
-    for(int i=0;i<fNbuffers;i++) {
+    for(unsigned i=0;i<fNbuffers;i++) {
         struct v4l2_buffer buf;
         memset(&buf, 0, sizeof(buf));
         buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -248,12 +429,226 @@ int WebcamJPEGDeviceSource::initDevice(UsageEnvironment& env, int fd)
     }
     return 0;
 }
+
+void WebcamJPEGDeviceSource::stopCapture(int fd)
+{
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(-1==xioctl(fd, VIDIOC_STREAMOFF, &type)) {
+        
+    }
+    for(unsigned i=0; i< fNbuffers; i++) {
+        if(-1==munmap(fBuffers[i].start, fBuffers[i].length)) {
+            
+        }
+    }
+    free(fBuffers);
+    fBuffers = NULL;
+    fNbuffers = 0;
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if(-1==xioctl(fd, VIDIOC_REQBUFS, &req)) {
+        
+    }
+}
+
+int WebcamJPEGDeviceSource::setQuality(int quality)
+{
+    if(fMode.pixelFormat != V4L2_PIX_FMT_MJPEG) {
+        // we do the encoding; 0 is not a valid JPEG quality
+        fRawEncoder.setQuality(std::max(quality, 1));
+        return 0;
+    }
+    struct v4l2_control ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+    ctrl.value = quality;
+    if(-1==xioctl(fFd, VIDIOC_S_CTRL, &ctrl)) {
+        envir().setResultErrMsg("Setting the JPEG quality failed: ");
+        return -1;
+    }
+    return 0;
+}
 #endif // JPEG_TEST
 
+int WebcamJPEGDeviceSource::reconfigure(unsigned width, unsigned height,
+                                        unsigned timePerFrame, int quality,
+                                        ReconfigureHandler* handler,
+                                        void* handlerClientData)
+{
+    // RTP/JPEG carries the frame size in units of 8 pixels, in one byte
+    if(width > 2040 || height > 2040) {
+        envir().setResultMsg("RTP/JPEG frames are at most 2040x2040");
+        return -1;
+    }
+    if(quality > 100) {
+        envir().setResultMsg("The quality must be between 0 and 100");
+        return -1;
+    }
+    if(fReconfigurePending) {
+        envir().setResultMsg("Another reconfiguration is still pending");
+        return -1;
+    }
+    fNewWidth = width;
+    fNewHeight = height;
+    fNewTimePerFrame = timePerFrame;
+    fNewQuality = quality;
+    if(fStrand != NULL && fStrand->inFlight() > 0) {
+        // the frame on the pool still points into a capture buffer:
+        // switch once it has been delivered
+        fReconfigurePending = true;
+        fReconfigureHandler = handler;
+        fReconfigureClientData = handlerClientData;
+        return 1;
+    }
+    return finishReconfigure();
+}
+
+// Applies the pending switch and records the outcome
+int WebcamJPEGDeviceSource::finishReconfigure()
+{
+    int result = applyReconfigure();
+    fLastReconfigureError = result == 0 ? "" : envir().getResultMsg();
+    return result;
+}
+
+int WebcamJPEGDeviceSource::applyReconfigure()
+{
+    fReconfigurePending = false;
+#ifdef JPEG_TEST
+    if(fNewWidth != 0 || fNewHeight != 0 || fNewQuality >= 0) {
+        envir().setResultMsg("Only the frame rate of test.jpg can be changed");
+        return -1;
+    }
+    if(fNewTimePerFrame != 0)
+        fTimePerFrame = fNewTimePerFrame;
+#else
+    if(fNewQuality >= 0 && setQuality(fNewQuality) != 0)
+        return -1;
+    if(fNewWidth == 0 && fNewHeight == 0 && fNewTimePerFrame == 0)
+        return 0; // the quality control applies while streaming
+
+    CaptureMode oldMode = fMode;
+    CaptureMode mode = fMode;
+    if(fNewWidth != 0)
+        mode.width = fNewWidth;
+    if(fNewHeight != 0)
+        mode.height = fNewHeight;
+    if(fNewTimePerFrame != 0) {
+        mode.intervalNum = fNewTimePerFrame;
+        mode.intervalDen = 1000000;
+    }
+
+    // Most drivers refuse S_FMT and S_PARM while streaming, and the buffer
+    // size depends on the format: start over with new buffers.
+    stopCapture(fFd);
+    int result = startCapture(envir(), fFd, mode);
+    if(result == 0 && (fSizeImage > fFrameSizeLimit
+                       || (fMaxSize != 0 && fSizeImage > fMaxSize))) {
+        // the sink's and the consumers' buffers were sized at startup
+        envir().setResultMsg("Frames of this mode may not fit the output buffers;"
+                             " restart with it instead");
+        result = -1;
+    }
+    if(result != 0) {
+        std::string msg = envir().getResultMsg();
+        stopCapture(fFd);
+        if(startCapture(envir(), fFd, oldMode) != 0) {
+            envir() << "Failed to restore the previous capture mode: "
+                    << envir().getResultMsg() << "\n";
+        }
+        envir().setResultMsg(msg.c_str());
+        return -1;
+    }
+    if(fNewTimePerFrame != 0)
+        fTimePerFrame = fNewTimePerFrame;
+#endif // JPEG_TEST
+    fAverageFrameSize = 0;
+
+    // the gap is measured from the last frame the sink got
+    fGapStart = fLastDeliveryTime;
+    if(fGapStart.tv_sec == 0 && fGapStart.tv_usec == 0)
+        gettimeofday(&fGapStart, NULL);
+    fMeasuringGap = true;
+    return 0;
+}
+
+unsigned WebcamJPEGDeviceSource::maxFrameSize() const
+{
+#ifdef JPEG_TEST
+    return jpeg_datlen;
+#else
+    return fSizeImage;
+#endif
+}
+
+unsigned WebcamJPEGDeviceSource::frameSizeLimit() const
+{
+#ifdef JPEG_TEST
+    return jpeg_datlen;
+#else
+    return fFrameSizeLimit;
+#endif
+}
+
+unsigned WebcamJPEGDeviceSource::takeLargestFrameSize()
+{
+    unsigned size = fLargestFrameSize;
+    fLargestFrameSize = 0;
+    return size;
+}
+
+int WebcamJPEGDeviceSource::quality()
+{
+#ifdef JPEG_TEST
+    return -1;
+#else
+    if(fMode.pixelFormat != V4L2_PIX_FMT_MJPEG)
+        return fRawEncoder.quality();
+    struct v4l2_control ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+    if(-1==xioctl(fFd, VIDIOC_G_CTRL, &ctrl))
+        return -1;
+    return ctrl.value;
+#endif
+}
+
+unsigned WebcamJPEGDeviceSource::captureWidth()
+{
+#ifdef JPEG_TEST
+    return parser.frameWidth();
+#else
+    return fMode.width;
+#endif
+}
+
+unsigned WebcamJPEGDeviceSource::captureHeight()
+{
+#ifdef JPEG_TEST
+    return parser.frameHeight();
+#else
+    return fMode.height;
+#endif
+}
+
 WebcamJPEGDeviceSource
-::WebcamJPEGDeviceSource(UsageEnvironment& env, int fd, unsigned timePerFrame)
-  : JPEGVideoSource(env), fFd(fd), fTimePerFrame(timePerFrame)
+::WebcamJPEGDeviceSource(UsageEnvironment& env, int fd, unsigned timePerFrame,
+                         unsigned width, unsigned height,
+                         char const* probeCacheFile)
+  : JPEGVideoSource(env), fFd(fd), fTimePerFrame(timePerFrame),
+    fKeepAliveInterval(0), fLastFingerprint(0), fSuppressedFrames(0),
+    fStrand(NULL), fReconfigurePending(false), fMeasuringGap(false),
+    fReconfigureHandler(NULL), fReconfigureClientData(NULL),
+    fLastReconfigureGap(0), fAverageFrameSize(0), fLargestFrameSize(0)
 {
+    memset(&fJob, 0, sizeof(fJob));
+    fJob.source = this;
+    fLastDeliveryTime.tv_sec = fLastDeliveryTime.tv_usec = 0;
+    fLastSentTime.tv_sec = fLastSentTime.tv_usec = 0;
 #ifdef JPEG_TEST
     jpeg_dat = new unsigned char [MAX_JPEG_FILE_SZ];
     FILE *fp = fopen("test.jpg", "rb");
@@ -264,7 +659,18 @@ WebcamJPEGDeviceSource
     jpeg_datlen = fread(jpeg_dat, 1, MAX_JPEG_FILE_SZ, fp);
     fclose(fp);
 #else
+    fBuffers = NULL;
+    fNbuffers = 0;
+    fRequestedWidth = width;
+    fRequestedHeight = height;
+    fProbeCache = probeCacheFile ? new DeviceProbeCache(probeCacheFile) : NULL;
+    memset(&fMode, 0, sizeof(fMode));
+    fSizeImage = 0;
+    fFrameSizeLimit = 0;
+    fBytesPerLine = 0;
     if(initDevice(env, fd)) {
+        stopCapture(fd);
+        delete fProbeCache;
         throw DeviceException();
     }
 #endif
@@ -272,18 +678,12 @@ WebcamJPEGDeviceSource
 
 WebcamJPEGDeviceSource::~WebcamJPEGDeviceSource()
 {
+    delete fStrand; // waits for a frame still on the pool
 #ifdef JPEG_TEST
     delete [] jpeg_dat;
 #else
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if(-1==xioctl(fFd, VIDIOC_STREAMOFF, &type)) {
-        
-    }
-    for(int i=0; i< fNbuffers; i++) {
-        if(-1==munmap(fBuffers[i].start, fBuffers[i].length)) {
-            
-        }
-    }
+    stopCapture(fFd);
+    delete fProbeCache;
     ::close(fFd);
 #endif
 }
@@ -314,27 +714,89 @@ static float timeval_diff(struct timeval *x, struct timeval *y)
 
 static struct timezone Idunno;
 
+void WebcamJPEGDeviceSource::setWorkerPool(FrameWorkerPool* pool)
+{
+    delete fStrand;
+    fStrand = NULL;
+#ifndef JPEG_TEST
+    fRawEncoder.setWorkerPool(NULL);
+#endif
+    if(pool == NULL)
+        return;
+    fStrand = new FrameStrand(*pool, envir().taskScheduler(),
+                              processFrameJob, frameJobDone, this);
+#ifndef JPEG_TEST
+    fcntl(fFd, F_SETFL, fcntl(fFd, F_GETFL) | O_NONBLOCK);
+    fRawEncoder.setWorkerPool(pool);
+#endif
+}
+
 void WebcamJPEGDeviceSource::doGetNextFrame()
+{
+    if(fStrand != NULL) {
+        if(fStrand->inFlight() > 0)
+            return; // restarted while a frame is on the pool: see deliverFrame()
+#ifdef JPEG_TEST
+        if(captureFrame(fJob) == 0)
+            fStrand->submit(&fJob);
+#else
+        // wait for the driver to fill a buffer; see captureHandler()
+        envir().taskScheduler().turnOnBackgroundReadHandling(fFd,
+                    (TaskScheduler::BackgroundHandlerProc*)captureHandler, this);
+#endif
+        return;
+    }
+
+    if(captureFrame(fJob) != 0) { // this will block if no frames are available
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(fTimePerFrame,
+                        (TaskFunc*)retryGetNextFrame, this);
+        return;
+    }
+    processFrame(fJob);
+    deliverFrame(fJob);
+}
+
+void WebcamJPEGDeviceSource::doStopGettingFrames()
+{
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+#ifndef JPEG_TEST
+    if(fStrand != NULL)
+        envir().taskScheduler().turnOffBackgroundReadHandling(fFd);
+#endif
+}
+
+// Takes the next frame from the device.  With a worker pool the device is
+// non-blocking and this is only called once it is readable.
+int WebcamJPEGDeviceSource::captureFrame(FrameJob& job)
 {
     static unsigned long framecount = 0;
     static struct timeval starttime;
-    
+
 #ifdef JPEG_TEST
-    fFrameSize = jpeg_to_rtp(fTo, jpeg_dat, jpeg_datlen);
-    gettimeofday(&fLastCaptureTime, &Idunno);
-    if(framecount==0)
-        starttime = fLastCaptureTime;
-    framecount++;
-    fPresentationTime = fLastCaptureTime;
+    job.bufferIndex = -1;
+    job.data = jpeg_dat;
+    job.length = jpeg_datlen;
     fDurationInMicroseconds = fTimePerFrame;
 #else
     struct v4l2_buffer buf;
     memset(&buf, 0, sizeof(buf));
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buf.memory = V4L2_MEMORY_MMAP;
-    if(-1==xioctl(fFd, VIDIOC_DQBUF, &buf)) { // this will block if no frames are available
-        
+    WEBCAM_TRACE1(dqbuf_entry, fFd);
+    int result = xioctl(fFd, VIDIOC_DQBUF, &buf);
+    WEBCAM_TRACE3(dqbuf_return, result, buf.sequence, buf.bytesused);
+    if(-1==result) {
+        return -1;
     }
+    job.bufferIndex = buf.index;
+    job.data = (unsigned char*)fBuffers[buf.index].start;
+    job.length = buf.bytesused;
+    if(fMode.pixelFormat == V4L2_PIX_FMT_MJPEG && buf.bytesused > fMaxSize) {
+        fprintf(stderr, "WebcamJPEGDeviceSource::doGetNextFrame(): read maximum buffer size: %d bytes.  Frame may be truncated\n", fMaxSize);
+        job.length = fMaxSize;
+    }
+#endif // JPEG_TEST
+    job.to = fTo;
     gettimeofday(&fLastCaptureTime, &Idunno);
     if(framecount==0)
         starttime = fLastCaptureTime;
@@ -344,17 +806,170 @@ void WebcamJPEGDeviceSource::doGetNextFrame()
     if(framecount % 30 == 0)
         printf("frame rate=%f\n", (float)framecount/timeval_diff(&fLastCaptureTime, &starttime));
      */
-    if(buf.bytesused > fMaxSize) {
-        fprintf(stderr, "WebcamJPEGDeviceSource::doGetNextFrame(): read maximum buffer size: %d bytes.  Frame may be truncated\n", fMaxSize);
+    return 0;
+}
+
+// The per-frame work that may run on a pool thread: it touches only the job
+// and the parser, which nobody else uses until the job is delivered.
+void WebcamJPEGDeviceSource::processFrame(FrameJob& job)
+{
+#ifndef JPEG_TEST
+    if(fMode.pixelFormat != V4L2_PIX_FMT_MJPEG) {
+        // the parser (and so the consumers) then point into fRawJpeg
+        job.frameSize = 0;
+        job.fingerprint = 0;
+        if(fRawEncoder.encode(fMode.pixelFormat, fMode.width, fMode.height,
+                              fBytesPerLine, job.data, job.length, fRawJpeg) != 0)
+            return;
+        job.data = &fRawJpeg[0];
+        job.length = fRawJpeg.size();
+    }
+#endif
+    job.frameSize = jpeg_to_rtp(job.to, job.data, job.length);
+    job.fingerprint = 0;
+    if(fKeepAliveInterval != 0 && job.frameSize > 0)
+        job.fingerprint = frameFingerprint(job.to, job.frameSize);
+}
+
+void WebcamJPEGDeviceSource::deliverFrame(FrameJob& job)
+{
+    fFrameSize = job.frameSize;
+    if(fFrameSize > 0) {
+        // the scan data still points into the capture buffer
+        for(size_t i = 0; i < fConsumers.size(); i++)
+            fConsumers[i]->consumeJpegFrame(parser, fPresentationTime);
     }
-    fFrameSize = jpeg_to_rtp(fTo, fBuffers[buf.index].start, std::min(buf.bytesused, fMaxSize));
+#ifndef JPEG_TEST
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = job.bufferIndex;
     if(-1==xioctl(fFd, VIDIOC_QBUF, &buf)) {
         
     }
-#endif // JPEG_TEST
+#endif
+    if(fReconfigurePending) {
+        int result = finishReconfigure();
+        if(result != 0)
+            envir() << "Reconfiguration failed: " << envir().getResultMsg() << "\n";
+        ReconfigureHandler* handler = fReconfigureHandler;
+        fReconfigureHandler = NULL;
+        if(handler != NULL)
+            (*handler)(fReconfigureClientData, result);
+    }
+    if(!isCurrentlyAwaitingData())
+        return; // the sink stopped while the frame was on the pool
+    if(job.to != fTo) {
+        // ... and asked again, for a different buffer
+        doGetNextFrame();
+        return;
+    }
+
+    if(fKeepAliveInterval != 0 && suppressStaticFrame(job.fingerprint)) {
+        // Nothing changed: skip this frame and wait for the next capture
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds,
+                        (TaskFunc*)retryGetNextFrame, this);
+        return;
+    }
+    if(fFrameSize > 0) {
+        if(fAverageFrameSize == 0)
+            fAverageFrameSize = fFrameSize;
+        else
+            fAverageFrameSize += (fFrameSize - fAverageFrameSize) / 16;
+        if(fFrameSize > fLargestFrameSize)
+            fLargestFrameSize = fFrameSize;
+        fLastDeliveryTime = fPresentationTime;
+        if(fMeasuringGap) {
+            fMeasuringGap = false;
+            fLastReconfigureGap
+                = (unsigned)(timeval_diff(&fLastDeliveryTime, &fGapStart)*1000000);
+            envir() << "Reconfigured to " << captureWidth() << "x"
+                    << captureHeight() << " at " << 1000000/fTimePerFrame
+                    << " fps: frame gap " << fLastReconfigureGap/1000 << " ms\n";
+        }
+    }
     // Switch to another task, and inform the reader that he has data:
     nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
-                    (TaskFunc*)FramedSource::afterGetting, this);
+                    (TaskFunc*)deliverToSink, this);
+}
+
+void WebcamJPEGDeviceSource::deliverToSink(void* clientData)
+{
+    WebcamJPEGDeviceSource* source = (WebcamJPEGDeviceSource*)clientData;
+    WEBCAM_TRACE3(after_getting, source->fFrameSize,
+                  source->fPresentationTime.tv_sec,
+                  source->fPresentationTime.tv_usec);
+    FramedSource::afterGetting(source);
+}
+
+void WebcamJPEGDeviceSource::captureHandler(void* clientData, int /*mask*/)
+{
+#ifndef JPEG_TEST
+    WebcamJPEGDeviceSource* source = (WebcamJPEGDeviceSource*)clientData;
+    UsageEnvironment& env = source->envir();
+
+    env.taskScheduler().turnOffBackgroundReadHandling(source->fFd);
+    if(source->captureFrame(source->fJob) == 0) {
+        source->fStrand->submit(&source->fJob);
+    } else if(errno == EAGAIN) {
+        source->doGetNextFrame();
+    } else {
+        source->nextTask() = env.taskScheduler().scheduleDelayedTask(source->fTimePerFrame,
+                                (TaskFunc*)retryGetNextFrame, source);
+    }
+#endif
+}
+
+void WebcamJPEGDeviceSource::processFrameJob(void* job)
+{
+    FrameJob* frameJob = (FrameJob*)job;
+    frameJob->source->processFrame(*frameJob);
+}
+
+void WebcamJPEGDeviceSource::frameJobDone(void* clientData, void* job)
+{
+    ((WebcamJPEGDeviceSource*)clientData)->deliverFrame(*(FrameJob*)job);
+}
+
+void WebcamJPEGDeviceSource::retryGetNextFrame(void* clientData)
+{
+    ((WebcamJPEGDeviceSource*)clientData)->doGetNextFrame();
+}
+
+void WebcamJPEGDeviceSource::addFrameConsumer(JpegFrameConsumer* consumer)
+{
+    fConsumers.push_back(consumer);
+}
+
+void WebcamJPEGDeviceSource::removeFrameConsumer(JpegFrameConsumer* consumer)
+{
+    fConsumers.erase(std::remove(fConsumers.begin(), fConsumers.end(), consumer),
+                     fConsumers.end());
+}
+
+void WebcamJPEGDeviceSource::setStaticSceneSuppression(unsigned keepAliveInterval)
+{
+    fKeepAliveInterval = keepAliveInterval;
+    fLastFingerprint = 0;
+}
+
+// Returns true if this frame repeats the previous one and the keep-alive
+// interval has not yet expired.  Any change in the scan data resumes
+// full-rate delivery at once.
+bool WebcamJPEGDeviceSource::suppressStaticFrame(unsigned long long fingerprint)
+{
+    if(fFrameSize == 0)
+        return false;
+    bool repeated = (fingerprint == fLastFingerprint);
+    fLastFingerprint = fingerprint;
+    if(repeated
+       && timeval_diff(&fLastCaptureTime, &fLastSentTime)*1000000 < fKeepAliveInterval) {
+        fSuppressedFrames++;
+        return true;
+    }
+    fLastSentTime = fLastCaptureTime;
+    return false;
 }
 
 static unsigned char calcQ(unsigned char const *qt);
@@ -382,6 +997,11 @@ size_t WebcamJPEGDeviceSource::jpeg_to_rtp(void *pto, void *pfrom, size_t len)
     unsigned char const * dat;
     if(parser.parse(from, len) == 0) { // successful parsing
         dat = parser.scandata(datlen);
+        if(datlen > fMaxSize) {
+            fprintf(stderr, "WebcamJPEGDeviceSource: %u bytes of scan data exceed the %u byte buffer; frame truncated\n", datlen, fMaxSize);
+            datlen = fMaxSize;
+        }
+        WEBCAM_TRACE1(jpeg_copy, datlen);
         memcpy(to, dat, datlen);
         to += datlen;
         return datlen;
@@ -400,6 +1020,11 @@ u_int8_t WebcamJPEGDeviceSource::type()
     return parser.type();
 }
 
+u_int16_t WebcamJPEGDeviceSource::restartInterval()
+{
+    return parser.restartInterval();
+}
+
 u_int8_t WebcamJPEGDeviceSource::qFactor()
 {
     return parser.qFactor();
@@ -22,10 +22,17 @@
 
 #include "JPEGVideoSource.hh"
 #include "JpegFrameParser.hh"
+#include "JpegFrameConsumer.hh"
+#include "DeviceProbeCache.hh"
+#include "FrameWorkerPool.hh"
+#include "RawFrameEncoder.hh"
 
 #include <exception>
+#include <string>
+#include <vector>
 
 #define MAX_JPEG_FILE_SZ 100000
+#define DEFAULT_VIDEO_DEVICE "/dev/video0"
 
 class DeviceException : public std::exception {
     
@@ -34,19 +41,91 @@ class DeviceException : public std::exception {
 class WebcamJPEGDeviceSource: public JPEGVideoSource {
 public:
     static WebcamJPEGDeviceSource* createNew(UsageEnvironment& env,
-					   unsigned timePerFrame);
+					   unsigned timePerFrame,
+					   char const* deviceName = DEFAULT_VIDEO_DEVICE,
+					   unsigned width = 0, unsigned height = 0,
+					   char const* probeCacheFile = DEFAULT_PROBE_CACHE_FILE);
     // "timePerFrame" is in microseconds
+    // A non-zero "width" and "height" select the capture mode directly
+    // (with "timePerFrame" as the frame interval), skipping the probe.
+    // "probeCacheFile" may be NULL to always probe the device.
+    // Cameras without MJPEG are captured in YUYV or NV12 and every frame
+    // is JPEG-encoded here, on the worker pool if there is one.
+
+    void setStaticSceneSuppression(unsigned keepAliveInterval);
+    // While the scan data of consecutive frames is identical, deliver only
+    // one frame per "keepAliveInterval" microseconds; 0 (the default)
+    // delivers every frame.
+    unsigned long suppressedFrames() const { return fSuppressedFrames; }
+
+    virtual unsigned maxFrameSize() const;
+    // the largest frame the current mode can produce: the driver's
+    // "sizeimage"
+    unsigned frameSizeLimit() const;
+    // the largest frame any mode reconfigure() accepts can produce: buffers
+    // holding frames (the sink's, the consumers') must be this large
+    unsigned averageFrameSize() const { return (unsigned)fAverageFrameSize; }
+    // moving average of the delivered frame sizes, 0 before the first frame
+    unsigned takeLargestFrameSize();
+    // the largest frame delivered since the last call, 0 if none
+
+    void addFrameConsumer(JpegFrameConsumer* consumer);
+    void removeFrameConsumer(JpegFrameConsumer* consumer);
+    // Consumers see every captured frame, including suppressed ones.
+
+    typedef void ReconfigureHandler(void* clientData, int result);
+    int reconfigure(unsigned width, unsigned height, unsigned timePerFrame,
+                    int quality = -1, ReconfigureHandler* handler = NULL,
+                    void* handlerClientData = NULL);
+    // Switches the capture mode while streaming: STREAMOFF, S_FMT/S_PARM
+    // with freshly mapped buffers, STREAMON; the sink keeps running.  0
+    // keeps the current width, height or frame interval.  "quality"
+    // (0..100) sets the camera's JPEG quality control (or that of our own
+    // encoder, for raw formats), -1 leaves it alone.
+    // Modes whose frames could exceed frameSizeLimit() are refused.
+    // On failure the previous mode is restored where possible.
+    // Returns 0 once switched, -1 on failure (see envir().getResultMsg()),
+    // or 1 if the switch has to wait for a frame still on the worker pool:
+    // "handler" then gets the outcome (0 or -1, with the message set) once
+    // it has been applied.  Only one switch can be pending at a time.
+    bool reconfigurePending() const { return fReconfigurePending; }
+    char const* lastReconfigureError() const { return fLastReconfigureError.c_str(); }
+    // "" if the last switch succeeded
+    void forgetReconfigureHandler(void* handlerClientData) {
+        if(fReconfigureClientData == handlerClientData) fReconfigureHandler = NULL;
+    }
+    // for a handler's owner going away before the outcome
+    int quality();
+    // the current JPEG quality (0..100), -1 if the camera has no quality
+    // control
+    unsigned captureWidth();
+    unsigned captureHeight();
+    unsigned timePerFrame() const { return fTimePerFrame; }
+    unsigned lastReconfigureGap() const { return fLastReconfigureGap; }
+    // microseconds between the last frame before and the first frame after
+    // the latest reconfigure(); 0 until that frame arrives
+
+    void setWorkerPool(FrameWorkerPool* pool);
+    // Parse, copy and fingerprint frames on "pool" rather than on the event
+    // loop; the device is then read without blocking.  Frames still reach
+    // the sink (and the consumers) in capture order, on the event loop.
+    // Raw frames are also cut into slices encoded in parallel on "pool".
+    // NULL (the default) processes every frame inline.
 
 protected:
     WebcamJPEGDeviceSource(UsageEnvironment& env,
-			 int fd, unsigned timePerFrame);
+			 int fd, unsigned timePerFrame,
+			 unsigned width, unsigned height,
+			 char const* probeCacheFile);
     // called only by createNew()
     virtual ~WebcamJPEGDeviceSource();
 
 private:
     // redefined virtual functions:
     virtual void doGetNextFrame();
+    virtual void doStopGettingFrames();
     virtual u_int8_t type();
+    virtual u_int16_t restartInterval();
     virtual u_int8_t qFactor();
     virtual u_int8_t width();
     virtual u_int8_t height();
@@ -55,13 +134,43 @@ private:
 private:
 #ifndef JPEG_TEST
     int initDevice(UsageEnvironment& env, int fd);
+    int probeModes(int fd, std::vector<CaptureMode>& modes);
+    int probeFormat(int fd, unsigned pixelFormat, std::vector<CaptureMode>& modes);
+    int selectMode(std::vector<CaptureMode> const& modes, CaptureMode& best);
+    int startCapture(UsageEnvironment& env, int fd, CaptureMode const& mode);
+    unsigned largestFrameSize(int fd, std::vector<CaptureMode> const& modes);
+    void stopCapture(int fd);
+    int setQuality(int quality);
 #endif
+    int applyReconfigure();
+    int finishReconfigure();
     struct buffer {
         void   *start;
         size_t  length;
     };
 
+    // One captured frame on its way from the device to the sink
+    struct FrameJob {
+        WebcamJPEGDeviceSource* source;
+        int bufferIndex;        // V4L2 buffer to requeue, -1 for none
+        unsigned char* data;
+        size_t length;
+        unsigned char* to;
+        unsigned frameSize;
+        unsigned long long fingerprint;
+    };
+
+    int captureFrame(FrameJob& job);
+    void processFrame(FrameJob& job);
+    void deliverFrame(FrameJob& job);
+    static void captureHandler(void* clientData, int mask);
+    static void processFrameJob(void* job);
+    static void frameJobDone(void* clientData, void* job);
+
     size_t jpeg_to_rtp(void *to, void *from, size_t len);
+    bool suppressStaticFrame(unsigned long long fingerprint);
+    static void retryGetNextFrame(void* clientData);
+    static void deliverToSink(void* clientData);
     
 private:
     int fFd;
@@ -70,8 +179,36 @@ private:
 #ifndef JPEG_TEST
     struct buffer *fBuffers;
     unsigned int fNbuffers;
+    unsigned fRequestedWidth;
+    unsigned fRequestedHeight;
+    DeviceProbeCache* fProbeCache;
+    CaptureMode fMode;
+    unsigned fSizeImage;
+    unsigned fFrameSizeLimit;
+    unsigned fBytesPerLine;
+    RawFrameEncoder fRawEncoder;
+    std::vector<unsigned char> fRawJpeg;
 #endif
     JpegFrameParser parser;
+    unsigned fKeepAliveInterval;
+    unsigned long long fLastFingerprint;
+    struct timeval fLastSentTime;
+    unsigned long fSuppressedFrames;
+    std::vector<JpegFrameConsumer*> fConsumers;
+    FrameStrand* fStrand;
+    FrameJob fJob;
+    struct timeval fLastDeliveryTime;
+    bool fReconfigurePending;
+    bool fMeasuringGap;
+    unsigned fNewWidth, fNewHeight, fNewTimePerFrame;
+    int fNewQuality;
+    ReconfigureHandler* fReconfigureHandler;
+    void* fReconfigureClientData;
+    std::string fLastReconfigureError;
+    struct timeval fGapStart;
+    unsigned fLastReconfigureGap;
+    float fAverageFrameSize;
+    unsigned fLargestFrameSize;
     
 #ifdef JPEG_TEST
     unsigned char *jpeg_dat;
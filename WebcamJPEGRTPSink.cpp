@@ -0,0 +1,117 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// RTP/JPEG sink with restart-aligned packets and optional XOR FEC on a
+// separate port
+// Implementation
+
+#include "WebcamJPEGRTPSink.hh"
+#include "JPEGVideoSource.hh"
+#include "WebcamTrace.hh"
+
+WebcamJPEGRTPSink*
+WebcamJPEGRTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs)
+{
+    return new WebcamJPEGRTPSink(env, RTPgs);
+}
+
+WebcamJPEGRTPSink::WebcamJPEGRTPSink(UsageEnvironment& env, Groupsock* RTPgs)
+  : JPEGVideoRTPSink(env, RTPgs), fFecGroupsock(NULL), fFecTask(NULL)
+{
+}
+
+WebcamJPEGRTPSink::~WebcamJPEGRTPSink()
+{
+    envir().taskScheduler().unscheduleDelayedTask(fFecTask);
+}
+
+void WebcamJPEGRTPSink::enableFec(Groupsock* fecGroupsock, unsigned groupSize)
+{
+    fFecGroupsock = fecGroupsock;
+    fFecEncoder.setGroupSize(groupSize);
+}
+
+void WebcamJPEGRTPSink::setFecGroupSize(unsigned groupSize)
+{
+    fFecEncoder.setGroupSize(groupSize);
+}
+
+Boolean WebcamJPEGRTPSink::restartAligned() const
+{
+    JPEGVideoSource* source = (JPEGVideoSource*)fSource;
+    return source != NULL && source->type() >= 64 && source->type() <= 127
+        && source->restartInterval() != 0;
+}
+
+// Called when the rest of the frame, at fOutBuf->curPtr(), does not fit
+// in the packet: returns how much of it to leave for the next packets.
+unsigned WebcamJPEGRTPSink::computeOverflowForNewFrame(unsigned newFrameSize) const
+{
+    unsigned overflow = JPEGVideoRTPSink::computeOverflowForNewFrame(newFrameSize);
+    if (overflow == 0 || !restartAligned())
+        return overflow;
+    return fRestartAligner.overflow(fOutBuf->curPtr(), newFrameSize,
+                                    newFrameSize - overflow,
+                                    curFragmentationOffset() == 0);
+}
+
+void WebcamJPEGRTPSink::doSpecialFrameHandling(unsigned fragmentationOffset,
+                                               unsigned char* frameStart,
+                                               unsigned numBytesInFrame,
+                                               struct timeval framePresentationTime,
+                                               unsigned numRemainingBytes)
+{
+    JPEGVideoRTPSink::doSpecialFrameHandling(fragmentationOffset, frameStart,
+                                             numBytesInFrame,
+                                             framePresentationTime,
+                                             numRemainingBytes);
+    if (restartAligned()) {
+        unsigned char header[2];
+        fRestartAligner.packetHeader(frameStart, numBytesInFrame,
+                                     fragmentationOffset, numRemainingBytes,
+                                     header);
+        // after the 8-byte main header and the 2-byte restart interval
+        setSpecialHeaderBytes(header, 2, 10);
+    }
+    // JPEG puts one fragment in each packet, so the packet is complete
+    // now: header, special header and payload.  It is sent on return.
+    unsigned char* packet = fOutBuf->packet();
+    unsigned packetSize = frameStart + numBytesInFrame - packet;
+    WEBCAM_TRACE3(rtp_packet, packetSize, fragmentationOffset, numRemainingBytes);
+    if(fFecGroupsock == NULL)
+        return;
+
+    std::vector<unsigned char> fec;
+    if(fFecEncoder.addPacket(packet, packetSize, fec)) {
+        // send it after the packet it completes, which goes out on return
+        fPendingFec.push_back(fec);
+        if(fFecTask == NULL)
+            fFecTask = envir().taskScheduler().scheduleDelayedTask(0,
+                            (TaskFunc*)sendPendingFec, this);
+    }
+}
+
+void WebcamJPEGRTPSink::sendPendingFec(void* clientData)
+{
+    WebcamJPEGRTPSink* sink = (WebcamJPEGRTPSink*)clientData;
+    sink->fFecTask = NULL;
+    while(!sink->fPendingFec.empty()) {
+        std::vector<unsigned char>& fec = sink->fPendingFec.front();
+        WEBCAM_TRACE1(fec_packet, fec.size());
+        sink->fFecGroupsock->output(sink->envir(), &fec[0], fec.size());
+        sink->fPendingFec.pop_front();
+    }
+}
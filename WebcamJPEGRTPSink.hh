@@ -0,0 +1,75 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// RTP/JPEG sink with restart-aligned packets and optional XOR FEC on a
+// separate port
+// C++ header
+
+#ifndef _WEBCAM_JPEG_RTP_SINK_HH
+#define _WEBCAM_JPEG_RTP_SINK_HH
+
+#include "JPEGVideoRTPSink.hh"
+#include "Groupsock.hh"
+#include "RtpJpegRestart.hh"
+#include "RtpXorFec.hh"
+
+#include <deque>
+#include <vector>
+
+// Frames with restart markers (types 64-127) are cut into packets at
+// restart interval boundaries, and each packet's restart marker header
+// carries its F and L bits and restart count (RFC 2435, section 3.1.7)
+// instead of the "not aligned" 1, 1, 0x3FFF: a receiver losing a packet
+// loses only the intervals in it, and can decode the others.  Intervals
+// too big for one packet span several, with the F bit in the first and
+// the L bit in the last.
+class WebcamJPEGRTPSink: public JPEGVideoRTPSink {
+public:
+    static WebcamJPEGRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs);
+
+    void enableFec(Groupsock* fecGroupsock, unsigned groupSize);
+    // Sends an RFC 5109 XOR FEC packet on "fecGroupsock" for every
+    // "groupSize" RTP packets, and for the last packets of each frame.
+    void setFecGroupSize(unsigned groupSize);
+    // takes effect at the next frame
+    unsigned fecGroupSize() const { return fFecGroupsock ? fFecEncoder.groupSize() : 0; }
+
+protected:
+    WebcamJPEGRTPSink(UsageEnvironment& env, Groupsock* RTPgs);
+    // called only by createNew()
+    virtual ~WebcamJPEGRTPSink();
+
+    // redefined virtual functions:
+    virtual void doSpecialFrameHandling(unsigned fragmentationOffset,
+                                        unsigned char* frameStart,
+                                        unsigned numBytesInFrame,
+                                        struct timeval framePresentationTime,
+                                        unsigned numRemainingBytes);
+    virtual unsigned computeOverflowForNewFrame(unsigned newFrameSize) const;
+
+private:
+    Boolean restartAligned() const;
+    static void sendPendingFec(void* clientData);
+
+private:
+    Groupsock* fFecGroupsock;
+    RtpXorFecEncoder fFecEncoder;
+    std::deque<std::vector<unsigned char> > fPendingFec;
+    TaskToken fFecTask;
+    RtpJpegRestartAligner fRestartAligner;
+};
+
+#endif // _WEBCAM_JPEG_RTP_SINK_HH
@@ -0,0 +1,221 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-demand RTSP subsession giving each unicast client its own,
+// congestion-decimated copy of the webcam stream
+// Implementation
+
+#include "WebcamServerMediaSubsession.hh"
+#include "DecimatingJPEGSource.hh"
+#include "WebcamJPEGRTPSink.hh"
+
+WebcamServerMediaSubsession*
+WebcamServerMediaSubsession::createNew(UsageEnvironment& env,
+                                       WebcamJPEGDeviceSource* input)
+{
+    return new WebcamServerMediaSubsession(env, input);
+}
+
+// Every client gets a source of its own, so that skipping frames for one
+// of them leaves the others alone.
+WebcamServerMediaSubsession
+::WebcamServerMediaSubsession(UsageEnvironment& env,
+                              WebcamJPEGDeviceSource* input)
+  : OnDemandServerMediaSubsession(env, False /*a source per client*/),
+    fInput(input), fQuality(0), fCropX(0), fCropY(0), fCropWidth(0),
+    fCropHeight(0), fSettingsChanged(false), fTranscodeResult(1),
+    fStrand(NULL), fJobInFlight(false)
+{
+    fTranscodedTime.tv_sec = fTranscodedTime.tv_usec = 0;
+    fTranscoder.setQuality(0);
+    fJob.subsession = this;
+    fJob.presentationTime = fTranscodedTime;
+    fJob.result = -1;
+}
+
+WebcamServerMediaSubsession::~WebcamServerMediaSubsession()
+{
+    delete fStrand; // waits for a frame still on the pool
+}
+
+// The settings reach fTranscoder in applySettings(), once the pool is done
+// with it.
+void WebcamServerMediaSubsession::setQuality(int quality)
+{
+    if(quality < 0)
+        quality = 0;
+    if(quality > 99)
+        quality = 99;
+    fQuality = quality;
+    fSettingsChanged = true;
+    fTranscodedTime.tv_sec = fTranscodedTime.tv_usec = 0; // stale now
+}
+
+void WebcamServerMediaSubsession::setCrop(unsigned x, unsigned y,
+                                          unsigned width, unsigned height)
+{
+    fCropX = x;
+    fCropY = y;
+    fCropWidth = width;
+    fCropHeight = height;
+    fSettingsChanged = true;
+    fTranscodedTime.tv_sec = fTranscodedTime.tv_usec = 0;
+}
+
+void WebcamServerMediaSubsession::setWorkerPool(FrameWorkerPool* pool)
+{
+    delete fStrand;
+    fStrand = NULL;
+    fJobInFlight = false;
+    fWaiting.clear();
+    if(pool != NULL)
+        fStrand = new FrameStrand(*pool, envir().taskScheduler(),
+                                  transcodeJob, transcodeJobDone, this);
+}
+
+void WebcamServerMediaSubsession::applySettings()
+{
+    if(!fSettingsChanged)
+        return;
+    fTranscoder.setQuality(fQuality);
+    fTranscoder.setCrop(fCropX, fCropY, fCropWidth, fCropHeight);
+    fSettingsChanged = false;
+}
+
+int WebcamServerMediaSubsession
+::transcode(DecimatingJPEGSource* client, JpegFrameParser& parser,
+            struct timeval presentationTime)
+{
+    if(fQuality == 0 && !cropping()) {
+        client->deliverFrame(parser, presentationTime, 1, NULL, 0);
+        return 0;
+    }
+    if(fJobInFlight) {
+        if(presentationTime.tv_sec != fJob.presentationTime.tv_sec
+           || presentationTime.tv_usec != fJob.presentationTime.tv_usec)
+            return -1; // the pool can't keep up: skip the frame
+        fWaiting.push_back(client);
+        return 0;
+    }
+    if(presentationTime.tv_sec == fTranscodedTime.tv_sec
+       && presentationTime.tv_usec == fTranscodedTime.tv_usec) {
+        deliverTranscoded(client, parser, presentationTime);
+        return 0;
+    }
+
+    applySettings();
+    if(fStrand == NULL) {
+        finishTranscode(parser, fTranscoder.transcode(parser, fTranscoded),
+                        presentationTime);
+        deliverTranscoded(client, parser, presentationTime);
+        return 0;
+    }
+    unsigned length;
+    unsigned char const* frame = parser.frame(length);
+    fJob.frame.assign(frame, frame + length);
+    fJob.presentationTime = presentationTime;
+    fJobInFlight = true;
+    fWaiting.push_back(client);
+    fStrand->submit(&fJob);
+    return 0;
+}
+
+void WebcamServerMediaSubsession::cancelTranscode(DecimatingJPEGSource* client)
+{
+    for(size_t i = 0; i < fWaiting.size(); i++) {
+        if(fWaiting[i] == client) {
+            fWaiting.erase(fWaiting.begin() + i);
+            return;
+        }
+    }
+}
+
+// Records the outcome of transcoding the frame "parser" holds
+void WebcamServerMediaSubsession
+::finishTranscode(JpegFrameParser& parser, int result,
+                  struct timeval presentationTime)
+{
+    if(result < 0 && fTranscodeResult >= 0)
+        envir() << "Failed to " << (cropping() ? "crop" : "requantize")
+                << " a " << parser.frameWidth() << "x" << parser.frameHeight()
+                << " frame; skipping frames until it works again\n";
+    fTranscodeResult = result;
+    fTranscodedTime = presentationTime;
+}
+
+void WebcamServerMediaSubsession
+::deliverTranscoded(DecimatingJPEGSource* client, JpegFrameParser& parser,
+                    struct timeval presentationTime)
+{
+    if(fTranscodeResult < 0)
+        client->deliverFrame(parser, presentationTime, -1, NULL, 0);
+    else if(fTranscodeResult > 0 && !cropping())
+        client->deliverFrame(parser, presentationTime, 1, NULL, 0); // coarse enough already
+    else
+        client->deliverFrame(parser, presentationTime, 0, &fTranscoded[0],
+                             fTranscoded.size());
+}
+
+// On a pool thread: the job has fTranscoder to itself
+void WebcamServerMediaSubsession::transcodeJob(void* job)
+{
+    TranscodeJob* transcodeJob = (TranscodeJob*)job;
+    if(transcodeJob->parser.parse(&transcodeJob->frame[0],
+                                  transcodeJob->frame.size()) != 0)
+        transcodeJob->result = -1;
+    else
+        transcodeJob->result = transcodeJob->subsession->fTranscoder
+            .transcode(transcodeJob->parser, transcodeJob->out);
+}
+
+void WebcamServerMediaSubsession::transcodeJobDone(void* clientData, void* job)
+{
+    WebcamServerMediaSubsession* subsession = (WebcamServerMediaSubsession*)clientData;
+    TranscodeJob* transcodeJob = (TranscodeJob*)job;
+    subsession->fJobInFlight = false;
+    subsession->fTranscoded.swap(transcodeJob->out);
+    subsession->finishTranscode(transcodeJob->parser, transcodeJob->result,
+                                transcodeJob->presentationTime);
+    if(subsession->fSettingsChanged) // while the job was on the pool
+        subsession->fTranscodedTime.tv_sec = subsession->fTranscodedTime.tv_usec = 0;
+
+    std::vector<DecimatingJPEGSource*> waiting;
+    waiting.swap(subsession->fWaiting);
+    for(size_t i = 0; i < waiting.size(); i++)
+        subsession->deliverTranscoded(waiting[i], transcodeJob->parser,
+                                      transcodeJob->presentationTime);
+}
+
+FramedSource* WebcamServerMediaSubsession
+::createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate)
+{
+    unsigned averageFrameSize = fInput->averageFrameSize();
+    if(averageFrameSize == 0) // no frames yet
+        averageFrameSize = fInput->maxFrameSize()/4;
+    estBitrate = (unsigned)((8*1000*(unsigned long long)averageFrameSize)
+                            /fInput->timePerFrame()) + 1; // kbps
+    return DecimatingJPEGSource::createNew(envir(), fInput, clientSessionId, this);
+}
+
+RTPSink* WebcamServerMediaSubsession
+::createNewRTPSink(Groupsock* rtpGroupsock,
+                   unsigned char /*rtpPayloadTypeIfDynamic*/,
+                   FramedSource* inputSource)
+{
+    WebcamJPEGRTPSink* sink = WebcamJPEGRTPSink::createNew(envir(), rtpGroupsock);
+    ((DecimatingJPEGSource*)inputSource)->setRTPSink(sink);
+    return sink;
+}
@@ -0,0 +1,112 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// On-demand RTSP subsession giving each unicast client its own,
+// congestion-decimated copy of the webcam stream
+// C++ header
+
+#ifndef _WEBCAM_SERVER_MEDIA_SUBSESSION_HH
+#define _WEBCAM_SERVER_MEDIA_SUBSESSION_HH
+
+#include "OnDemandServerMediaSubsession.hh"
+#include "FrameWorkerPool.hh"
+#include "JpegTranscoder.hh"
+#include "WebcamJPEGDeviceSource.hh"
+
+#include <vector>
+
+class DecimatingJPEGSource;
+
+class WebcamServerMediaSubsession: public OnDemandServerMediaSubsession {
+public:
+    static WebcamServerMediaSubsession*
+    createNew(UsageEnvironment& env, WebcamJPEGDeviceSource* input);
+
+    void setQuality(int quality);
+    int quality() const { return fQuality; }
+    // RFC 2435 Q factor (1..99) the clients' streams are requantized to,
+    // independently of the capture quality; 0 keeps the captured one
+    void setCrop(unsigned x, unsigned y, unsigned width, unsigned height);
+    // Sends only the MCUs covering this rectangle (in pixels), without
+    // decoding the frames; see JpegTranscoder::setCrop()
+    void setWorkerPool(FrameWorkerPool* pool);
+    // Transcode on "pool" rather than on the event loop; NULL (the
+    // default) transcodes inline.
+
+    int transcode(DecimatingJPEGSource* client, JpegFrameParser& parser,
+                  struct timeval presentationTime);
+    // Requantizes and/or crops the frame "parser" has just parsed for
+    // "client", and hands the result to client->deliverFrame(): right
+    // away, or with a worker pool once the pool is done with it, on the
+    // event loop.  Clients share the result, so a frame is transcoded once
+    // however many of them receive it.  Returns -1, without a delivery, if
+    // the pool is still busy with an earlier frame.
+    void cancelTranscode(DecimatingJPEGSource* client);
+    // forgets a client waiting for the pool, e.g. one going away
+    JpegTranscoder const& transcoder() const { return fTranscoder; }
+    // the RTP/JPEG header fields of the frame being delivered
+
+protected:
+    WebcamServerMediaSubsession(UsageEnvironment& env,
+                                WebcamJPEGDeviceSource* input);
+    // called only by createNew()
+    virtual ~WebcamServerMediaSubsession();
+
+private:
+    // redefined virtual functions:
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId,
+                                                unsigned& estBitrate);
+    virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,
+                                      unsigned char rtpPayloadTypeIfDynamic,
+                                      FramedSource* inputSource);
+
+private:
+    // A frame on its way through the pool, with a copy of its data: the
+    // input's parser moves on to the next frame meanwhile
+    struct TranscodeJob {
+        WebcamServerMediaSubsession* subsession;
+        std::vector<unsigned char> frame;
+        JpegFrameParser parser;
+        struct timeval presentationTime;
+        std::vector<unsigned char> out;
+        int result;
+    };
+
+    bool cropping() const { return fCropWidth != 0 && fCropHeight != 0; }
+    void applySettings();
+    void finishTranscode(JpegFrameParser& parser, int result,
+                         struct timeval presentationTime);
+    void deliverTranscoded(DecimatingJPEGSource* client, JpegFrameParser& parser,
+                           struct timeval presentationTime);
+    static void transcodeJob(void* job);
+    static void transcodeJobDone(void* clientData, void* job);
+
+private:
+    WebcamJPEGDeviceSource* fInput;
+    int fQuality;
+    unsigned fCropX, fCropY, fCropWidth, fCropHeight;
+    bool fSettingsChanged;      // not passed on to fTranscoder yet
+    JpegTranscoder fTranscoder; // the pool's while a job is in flight
+    std::vector<unsigned char> fTranscoded;
+    struct timeval fTranscodedTime;
+    int fTranscodeResult;
+    FrameStrand* fStrand;
+    TranscodeJob fJob;
+    bool fJobInFlight;
+    std::vector<DecimatingJPEGSource*> fWaiting; // for fJob's result
+};
+
+#endif // _WEBCAM_SERVER_MEDIA_SUBSESSION_HH
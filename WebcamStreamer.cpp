@@ -22,17 +22,100 @@
 #include "GroupsockHelper.hh"
 
 #include "BasicUsageEnvironment.hh"
+#include "EpollTaskScheduler.hh"
+#include "AdaptiveQualityController.hh"
+#ifdef WITH_H264
+#include "H264ServerMediaSubsession.hh"
+#endif
 #include "WebcamJPEGDeviceSource.hh"
+#include "PreviewServerMediaSubsession.hh"
+#include "WebcamServerMediaSubsession.hh"
+#include "WebcamControlServer.hh"
+#include "PacingRateController.hh"
+#include "WebcamJPEGRTPSink.hh"
+#include "SharedFrameRing.hh"
+#include "SnapshotServer.hh"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 UsageEnvironment* env;
 char* progName;
 int fps;
+char const* deviceName = DEFAULT_VIDEO_DEVICE;
+unsigned captureWidth = 0, captureHeight = 0;
+char const* probeCacheFile = DEFAULT_PROBE_CACHE_FILE;
+unsigned keepAliveMs = 0;
+unsigned previewFps = 0;
+int workerThreads = -1; // no pool
+unsigned controlPort = 0;
+unsigned pacingPercent = 0;
+unsigned fecGroupSize = 0;
+char const* frameRingName = NULL;
+char const* schedulerMode = NULL; // select()
+unsigned unicastQuality = 0; // as captured
+unsigned targetLossPercent = 0; // no adaptation
+char const* auditFileName = NULL;
+unsigned h264Bitrate = 0; // no H.264
+unsigned cropX = 0, cropY = 0, cropWidth = 0, cropHeight = 0; // no crop
+unsigned snapshotPort = 0;
+SharedFrameRing* frameRing = NULL;
+SnapshotServer* snapshotServer = NULL;
+FrameWorkerPool* workerPool = NULL;
+
+// Room for the RTP/JPEG main, restart and quantization table headers
+#define OUTPUT_BUFFER_HEADROOM 1024
+// Frames to average before sizing the RTCP bandwidth share
+#define WARM_UP_FRAMES 30
+#define MIN_WARM_UP_TIME 1000000 // microseconds
 
 void play(); // forward
+void startRTCP(void* clientData); // forward
 
 void usage()
 {
-    *env << "Usage: " << progName << " <frames-per-second>\n";
+    *env << "Usage: " << progName
+        << " [-d <device>] [-r <width>x<height>] [-c <probe-cache-file>|-C]"
+        << " [-s <keep-alive-ms>] [-p <preview-fps>] [-w <threads>]"
+        << " [-k <control-port>] [-P <percent>] [-F <group-size>]"
+        << " [-m <name>] [-e lt|et] [-Q <quality>]"
+        << " [-A <loss-percent> [-L <audit-file>]] [-x <kbps>]"
+        << " [-R <x>,<y>,<width>,<height>] [-H <http-port>]"
+        << " <frames-per-second>\n";
+    *env << "\t-d: V4L2 capture device (default " << DEFAULT_VIDEO_DEVICE << ")\n";
+    *env << "\t-r: capture at this resolution, skipping the mode probe\n";
+    *env << "\t-c: cache device probe results in this file (default "
+        << DEFAULT_PROBE_CACHE_FILE << ")\n";
+    *env << "\t-C: do not cache device probe results\n";
+    *env << "\t-s: suppress repeated frames of a static scene, sending one"
+        << " every <keep-alive-ms>\n";
+    *env << "\t-p: also serve a 1/8-scale preview stream at <preview-fps>\n";
+    *env << "\t-w: process frames on a pool of <threads> worker threads"
+        << " (0: one per CPU); cameras without MJPEG need it to encode"
+        << " large frames in real time\n";
+    *env << "\t-k: accept \"set\" and \"status\" commands on UDP port"
+        << " <control-port> of 127.0.0.1\n";
+    *env << "\t-P: pace RTP packets so that a frame takes <percent> of its"
+        << " interval (needs the fq qdisc, with a flow_limit above the"
+        << " packets of a frame)\n";
+    *env << "\t-F: send XOR FEC (RFC 5109) for every <group-size> RTP packets"
+        << " on port 16386\n";
+    *env << "\t-m: publish every captured frame in the shared memory ring"
+        << " /dev/shm/<name>\n";
+    *env << "\t-e: run the event loop on epoll instead of select(), level-"
+        << " (lt) or edge-triggered (et); for many RTSP clients\n";
+    *env << "\t-Q: requantize the unicast streams to JPEG quality <quality>"
+        << " (1-99) without re-encoding, e.g. for clients on slow links\n";
+    *env << "\t-A: adapt the camera's quality, then frame rate, to keep the"
+        << " multicast receivers' loss under <loss-percent>\n";
+    *env << "\t-L: append every adaptation decision to <audit-file> (CSV)\n";
+    *env << "\t-x: also serve the stream as H.264 at <kbps> (session \"h264\"),"
+        << " encoded while a client plays it (needs make H264=1)\n";
+    *env << "\t-R: also serve this rectangle of the picture, cut out without"
+        << " decoding (grown to whole MCUs, 16x8 or 16x16 pixels)\n";
+    *env << "\t-H: serve the latest frame as a JPEG still on HTTP port"
+        << " <http-port>, e.g. http://<host>:<http-port>/snapshot.jpg\n";
     exit(1);
 }
 
@@ -42,17 +125,117 @@ int main(int argc, char** argv)
     TaskScheduler* scheduler = BasicTaskScheduler::createNew();
     env = BasicUsageEnvironment::createNew(*scheduler);
 
-    //OutPacketBuffer::numPacketsLimit = 100;
-    // Allow for up to 100 RTP packets per JPEG frame
-
     progName = argv[0];
-    if (argc != 2)
+    int opt;
+    while ((opt = getopt(argc, argv, "d:r:c:Cs:p:w:k:P:F:m:e:Q:A:L:x:R:H:")) != -1) {
+        switch (opt) {
+            case 'd':
+                deviceName = optarg;
+                break;
+            case 'r':
+                if (sscanf(optarg, "%ux%u", &captureWidth, &captureHeight) != 2
+                    || captureWidth == 0 || captureHeight == 0)
+                    usage();
+                break;
+            case 'c':
+                probeCacheFile = optarg;
+                break;
+            case 'C':
+                probeCacheFile = NULL;
+                break;
+            case 's':
+                if (sscanf(optarg, "%u", &keepAliveMs) != 1 || keepAliveMs == 0)
+                    usage();
+                break;
+            case 'p':
+                if (sscanf(optarg, "%u", &previewFps) != 1 || previewFps == 0)
+                    usage();
+                break;
+            case 'w':
+                if (sscanf(optarg, "%d", &workerThreads) != 1 || workerThreads < 0)
+                    usage();
+                break;
+            case 'k':
+                if (sscanf(optarg, "%u", &controlPort) != 1
+                    || controlPort == 0 || controlPort > 65535)
+                    usage();
+                break;
+            case 'P':
+                if (sscanf(optarg, "%u", &pacingPercent) != 1
+                    || pacingPercent == 0 || pacingPercent > 100)
+                    usage();
+                break;
+            case 'F':
+                if (sscanf(optarg, "%u", &fecGroupSize) != 1
+                    || fecGroupSize == 0 || fecGroupSize > FEC_MAX_GROUP_SIZE)
+                    usage();
+                break;
+            case 'm':
+                frameRingName = optarg;
+                break;
+            case 'e':
+                if (strcmp(optarg, "lt") != 0 && strcmp(optarg, "et") != 0)
+                    usage();
+                schedulerMode = optarg;
+                break;
+            case 'A':
+                if (sscanf(optarg, "%u", &targetLossPercent) != 1
+                    || targetLossPercent == 0 || targetLossPercent > 50)
+                    usage();
+                break;
+            case 'L':
+                auditFileName = optarg;
+                break;
+            case 'x':
+                if (sscanf(optarg, "%u", &h264Bitrate) != 1 || h264Bitrate == 0)
+                    usage();
+#ifndef WITH_H264
+                *env << progName << " was built without H.264 support"
+                    << " (make H264=1)\n";
+                exit(1);
+#endif
+                break;
+            case 'R':
+                if (sscanf(optarg, "%u,%u,%u,%u", &cropX, &cropY,
+                           &cropWidth, &cropHeight) != 4
+                    || cropWidth == 0 || cropHeight == 0)
+                    usage();
+                break;
+            case 'H':
+                if (sscanf(optarg, "%u", &snapshotPort) != 1
+                    || snapshotPort == 0 || snapshotPort > 65535)
+                    usage();
+                break;
+            case 'Q':
+                if (sscanf(optarg, "%u", &unicastQuality) != 1
+                    || unicastQuality == 0 || unicastQuality > 99)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind != 1 || (auditFileName != NULL && targetLossPercent == 0))
         usage();
 
-    if (sscanf(argv[1], "%d", &fps) != 1 || fps <= 0) {
+    if (sscanf(argv[optind], "%d", &fps) != 1 || fps <= 0) {
         usage();
     }
 
+    if (schedulerMode != NULL) {
+        // Only usage() has used the environment so far: replace it
+        EpollTaskScheduler* epollScheduler
+            = EpollTaskScheduler::createNew(strcmp(schedulerMode, "et") == 0);
+        if (epollScheduler == NULL) {
+            *env << "epoll is not available; staying with select()\n";
+        } else {
+            env->reclaim();
+            delete scheduler;
+            scheduler = epollScheduler;
+            env = BasicUsageEnvironment::createNew(*scheduler);
+        }
+    }
+
     play();
 
     return 0;
@@ -68,19 +251,56 @@ struct sessionState_t {
     RTCPInstance* rtcpInstance;
     Groupsock* rtpGroupsock;
     Groupsock* rtcpGroupsock;
+    Groupsock* fecGroupsock;
     RTSPServer* rtspServer;
+    WebcamControlServer* controlServer;
+    PacingRateController* pacer;
+    AdaptiveQualityController* adapter;
 } sessionState;
 
 void play() {
     // Open the webcam
     unsigned timePerFrame = 1000000/fps; // microseconds
-    sessionState.source
-        = WebcamJPEGDeviceSource::createNew(*env, timePerFrame);
-    if (sessionState.source == NULL) {
+    WebcamJPEGDeviceSource* webcam
+        = WebcamJPEGDeviceSource::createNew(*env, timePerFrame, deviceName,
+                                            captureWidth, captureHeight,
+                                            probeCacheFile);
+    if (webcam == NULL) {
         *env << "Unable to open webcam: "
             << env->getResultMsg() << "\n";
         exit(1);
     }
+    webcam->setStaticSceneSuppression(keepAliveMs*1000);
+    if (frameRingName != NULL) {
+        // slots for the largest mode, so that frames keep coming after a
+        // reconfigure; pages of the object are only allocated once written
+        frameRing = SharedFrameRing::create(frameRingName, DEFAULT_SHARED_FRAME_SLOTS,
+                                            webcam->frameSizeLimit());
+        if (frameRing == NULL) {
+            *env << "Failed to create the shared memory ring: " << strerror(errno) << "\n";
+            exit(1);
+        }
+        webcam->addFrameConsumer(frameRing);
+        *env << "Publishing frames in /dev/shm/" << frameRingName << "\n";
+    }
+    if (snapshotPort != 0) {
+        snapshotServer = SnapshotServer::create(snapshotPort);
+        if (snapshotServer == NULL) {
+            *env << "Failed to start the snapshot server: " << strerror(errno) << "\n";
+            exit(1);
+        }
+        webcam->addFrameConsumer(snapshotServer);
+        *env << "Serving snapshots on http://<host>:" << snapshotPort
+            << "/snapshot.jpg\n";
+    }
+    if (workerThreads >= 0) {
+        // one pool for all cameras
+        workerPool = new FrameWorkerPool(workerThreads);
+        webcam->setWorkerPool(workerPool);
+        *env << "Processing frames on " << workerPool->numThreads()
+            << " worker threads\n";
+    }
+    sessionState.source = webcam;
 
     // Create 'groupsocks' for RTP and RTCP:
     struct in_addr destinationAddress;
@@ -100,26 +320,38 @@ void play() {
         = new Groupsock(*env, destinationAddress, rtcpPort, ttl);
     sessionState.rtcpGroupsock->multicastSendOnly(); // we're a SSM source
   
+    // Size the sink's buffer for the largest frame the camera can deliver
+    // in any mode it may be reconfigured to (the buffer is allocated when
+    // the sink is created; the unicast sinks get the same), plus room for
+    // the RTP/JPEG headers of the first packet:
+    OutPacketBuffer::maxSize = webcam->frameSizeLimit() + OUTPUT_BUFFER_HEADROOM;
+
     // Create an appropriate RTP sink from the RTP 'groupsock':
-    sessionState.sink
-        = JPEGVideoRTPSink::createNew(*env, sessionState.rtpGroupsock);
-  
-    // Create (and start) a 'RTCP instance' for this RTP sink:
-    unsigned const averageFrameSizeInBytes = 35000; // estimate
-    const unsigned totalSessionBandwidth
-        = (8*1000*averageFrameSizeInBytes)/timePerFrame;
-        // in kbps; for RTCP b/w share
-    const unsigned maxCNAMElen = 100;
-    unsigned char CNAME[maxCNAMElen+1];
-    //gethostname((char*)CNAME, maxCNAMElen);
-    sprintf((char*)CNAME, "Webcam"); // "gethostname()" isn't supported
-    CNAME[maxCNAMElen] = '\0'; // just in case
-    sessionState.rtcpInstance
-        = RTCPInstance::createNew(*env, sessionState.rtcpGroupsock,
-			      totalSessionBandwidth, CNAME,
-			      sessionState.sink, NULL /* we're a server */,
-			      True /* we're a SSM source*/);
-    // Note: This starts RTCP running automatically
+    WebcamJPEGRTPSink* jpegSink
+        = WebcamJPEGRTPSink::createNew(*env, sessionState.rtpGroupsock);
+    sessionState.sink = jpegSink;
+
+    if (fecGroupSize != 0) {
+        // FEC goes next to RTP and RTCP, to the same group
+        const Port fecPort(rtpPortNum+2);
+        sessionState.fecGroupsock
+            = new Groupsock(*env, destinationAddress, fecPort, ttl);
+        sessionState.fecGroupsock->multicastSendOnly(); // we're a SSM source
+        jpegSink->enableFec(sessionState.fecGroupsock, fecGroupSize);
+    }
+
+    if (pacingPercent != 0) {
+        sessionState.pacer
+            = PacingRateController::createNew(*env, sessionState.rtpGroupsock->socketNum(),
+                                              webcam, pacingPercent);
+    }
+
+    // The RTCP instance is created once the average frame size has been
+    // measured, since its bandwidth share can't be changed afterwards:
+    unsigned warmUpTime = WARM_UP_FRAMES*timePerFrame;
+    if (warmUpTime < MIN_WARM_UP_TIME)
+        warmUpTime = MIN_WARM_UP_TIME;
+    env->taskScheduler().scheduleDelayedTask(warmUpTime, startRTCP, webcam);
 
     // Create and start a RTSP server to serve this stream:
     sessionState.rtspServer
@@ -139,6 +371,81 @@ void play() {
     *env << "Play this stream using the URL \"" << url << "\"\n";
     delete[] url;
 
+    // Unicast clients each get their own stream, which skips frames while
+    // that client's link can't keep up:
+    ServerMediaSession* unicastSms
+        = ServerMediaSession::createNew(*env, "unicast", progName,
+            "Session streamed by the Webcam, one stream per client");
+    WebcamServerMediaSubsession* unicastSubsession
+        = WebcamServerMediaSubsession::createNew(*env, webcam);
+    unicastSubsession->setQuality(unicastQuality);
+    unicastSubsession->setWorkerPool(workerPool);
+    unicastSms->addSubsession(unicastSubsession);
+    sessionState.rtspServer->addServerMediaSession(unicastSms);
+
+    url = sessionState.rtspServer->rtspURL(unicastSms);
+    *env << "Play a unicast stream using the URL \"" << url << "\"\n";
+    delete[] url;
+
+#ifdef WITH_H264
+    // A session of its own: a client playing "unicast" would otherwise
+    // set up both tracks, and have every frame re-encoded for nothing.
+    if (h264Bitrate != 0) {
+        ServerMediaSession* h264Sms
+            = ServerMediaSession::createNew(*env, "h264", progName,
+                "Session streamed by the Webcam, re-encoded as H.264");
+        h264Sms->addSubsession(H264ServerMediaSubsession
+            ::createNew(*env, webcam, h264Bitrate, workerPool));
+        sessionState.rtspServer->addServerMediaSession(h264Sms);
+
+        url = sessionState.rtspServer->rtspURL(h264Sms);
+        *env << "Play the H.264 stream using the URL \"" << url << "\"\n";
+        delete[] url;
+    }
+#endif
+
+    if (cropWidth != 0) {
+        ServerMediaSession* cropSms
+            = ServerMediaSession::createNew(*env, "crop", progName,
+                "Part of the picture streamed by the Webcam");
+        WebcamServerMediaSubsession* cropSubsession
+            = WebcamServerMediaSubsession::createNew(*env, webcam);
+        cropSubsession->setCrop(cropX, cropY, cropWidth, cropHeight);
+        cropSubsession->setWorkerPool(workerPool);
+        cropSms->addSubsession(cropSubsession);
+        sessionState.rtspServer->addServerMediaSession(cropSms);
+
+        url = sessionState.rtspServer->rtspURL(cropSms);
+        *env << "Play the " << cropWidth << "x" << cropHeight << " crop at "
+            << cropX << "," << cropY << " using the URL \"" << url << "\"\n";
+        delete[] url;
+    }
+
+    if (previewFps > 0) {
+        ServerMediaSession* previewSms
+            = ServerMediaSession::createNew(*env, "preview", progName,
+                "Low-resolution preview of the Webcam");
+        previewSms->addSubsession(PreviewServerMediaSubsession
+            ::createNew(*env, webcam, 1000000/previewFps, workerPool));
+        sessionState.rtspServer->addServerMediaSession(previewSms);
+
+        url = sessionState.rtspServer->rtspURL(previewSms);
+        *env << "Play the preview using the URL \"" << url << "\"\n";
+        delete[] url;
+    }
+
+    if (controlPort != 0) {
+        sessionState.controlServer
+            = WebcamControlServer::createNew(*env, webcam, controlPort);
+        if (sessionState.controlServer == NULL) {
+            *env << "Failed to create control socket: " << env->getResultMsg() << "\n";
+            exit(1);
+        }
+        sessionState.controlServer->setRTPSink(jpegSink);
+        sessionState.controlServer->setUnicastSubsession(unicastSubsession);
+        *env << "Accepting control commands on 127.0.0.1:" << controlPort << "/udp\n";
+    }
+
     // Finally, start the streaming:
     *env << "Beginning streaming...\n";
     sessionState.sink->startPlaying(*sessionState.source, afterPlaying, NULL);
@@ -147,15 +454,59 @@ void play() {
 }
 
 
+void startRTCP(void* clientData)
+{
+    WebcamJPEGDeviceSource* webcam = (WebcamJPEGDeviceSource*)clientData;
+    unsigned averageFrameSizeInBytes = webcam->averageFrameSize();
+    if (averageFrameSizeInBytes == 0) // no frames yet
+        averageFrameSizeInBytes = webcam->maxFrameSize()/4;
+    const unsigned totalSessionBandwidth
+        = (8*1000*(unsigned long long)averageFrameSizeInBytes)/webcam->timePerFrame();
+        // in kbps; for RTCP b/w share
+    *env << "Average frame size " << averageFrameSizeInBytes
+        << " bytes: session bandwidth " << totalSessionBandwidth << " kbps\n";
+
+    const unsigned maxCNAMElen = 100;
+    unsigned char CNAME[maxCNAMElen+1];
+    //gethostname((char*)CNAME, maxCNAMElen);
+    sprintf((char*)CNAME, "Webcam"); // "gethostname()" isn't supported
+    CNAME[maxCNAMElen] = '\0'; // just in case
+    sessionState.rtcpInstance
+        = RTCPInstance::createNew(*env, sessionState.rtcpGroupsock,
+			      totalSessionBandwidth, CNAME,
+			      sessionState.sink, NULL /* we're a server */,
+			      True /* we're a SSM source*/);
+    // Note: This starts RTCP running automatically
+
+    if (targetLossPercent != 0) {
+        sessionState.adapter
+            = AdaptiveQualityController::createNew(*env, sessionState.rtcpInstance,
+                  sessionState.sink, webcam, targetLossPercent, auditFileName);
+        if (sessionState.adapter == NULL) {
+            *env << "Failed to set up quality adaptation: " << env->getResultMsg() << "\n";
+            exit(1);
+        }
+        if (sessionState.controlServer != NULL)
+            sessionState.controlServer->setQualityController(sessionState.adapter);
+    }
+}
+
 void afterPlaying(void* /*clientData*/)
 {
     *env << "...done streaming\n";
 
     // End by closing the media:
+    Medium::close(sessionState.controlServer);
+    Medium::close(sessionState.pacer);
     Medium::close(sessionState.rtspServer);
     Medium::close(sessionState.sink);
     delete sessionState.rtpGroupsock;
+    delete sessionState.fecGroupsock;
     Medium::close(sessionState.source);
+    delete frameRing;
+    delete snapshotServer;
+    delete workerPool;
+    Medium::close(sessionState.adapter);
     Medium::close(sessionState.rtcpInstance);
     delete sessionState.rtcpGroupsock;
 
@@ -0,0 +1,56 @@
+/*
+ Copyright (C) 2015, Kyle Zhou <kyle.zhou at live.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Static (USDT) tracepoints on the capture and streaming path
+// C++ header
+
+#ifndef _WEBCAM_TRACE_HH
+#define _WEBCAM_TRACE_HH
+
+// Each probe compiles to a single nop plus an ELF note, so it costs
+// nothing until a tracer attaches, e.g.
+//   bpftrace -e 'usdt:./WebcamStreamer:webcam:dqbuf_return { printf("%d %d\n", arg1, arg2); }'
+//   perf probe -x ./WebcamStreamer sdt_webcam:rtp_packet
+// Probes (provider "webcam"):
+//   dqbuf_entry(fd)
+//   dqbuf_return(result, sequence, bytesused)
+//   parse_start(size)
+//   parse_end(result, scanLength)
+//   jpeg_copy(bytes)
+//   after_getting(frameSize, seconds, microseconds)
+//   rtp_packet(packetSize, fragmentOffset, bytesRemaining)
+//   fec_packet(packetSize)
+// Builds without <sys/sdt.h> (systemtap-sdt-dev), or with -DNO_USDT,
+// compile the probes away entirely.
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WEBCAM_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef WEBCAM_HAVE_USDT
+#define WEBCAM_TRACE1(name, a)          DTRACE_PROBE1(webcam, name, a)
+#define WEBCAM_TRACE2(name, a, b)       DTRACE_PROBE2(webcam, name, a, b)
+#define WEBCAM_TRACE3(name, a, b, c)    DTRACE_PROBE3(webcam, name, a, b, c)
+#else
+#define WEBCAM_TRACE1(name, a)          do {} while (0)
+#define WEBCAM_TRACE2(name, a, b)       do {} while (0)
+#define WEBCAM_TRACE3(name, a, b, c)    do {} while (0)
+#endif
+
+#endif // _WEBCAM_TRACE_HH